@@ -1,8 +1,11 @@
 #include "GNSSambres.hpp"
+#include "threadBudget.hpp"
 
 int nltrclvl=3;
 int NLambEstm( Trace& trace, KFState& kfState, ARState& ambState)
 {
+	StageScope stageScope(E_Stage::AMBIGUITY_RESOLUTION);
+
 	int epoc = kfState.time.time;
 	int nfix = 0;
 
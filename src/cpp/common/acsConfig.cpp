@@ -1,7 +1,10 @@
 #include <sstream>
 #include <iostream>
+#include <atomic>
+#include <mutex>
 #include <memory>
 #include <string>
+#include <tuple>
 // #include <filesystem>
 
 using std::unique_ptr;
@@ -18,6 +21,7 @@ using std::string;
 #include "ntripSourceTable.hpp"
 #include "acsNtripBroadcast.hpp"
 #include "rtsSmoothing.hpp"
+#include "fileWatcher.hpp"
 #include "streamTrace.hpp"
 #include "acsConfig.hpp"
 #include "acsStream.hpp"
@@ -226,6 +230,7 @@ bool configure(
 	("elevation_mask", 			boost::program_options::value<float>(), 	"Elevation Mask")
 	("max_epochs", 				boost::program_options::value<int>(), 		"Maximum Epochs")
 	("epoch_interval", 			boost::program_options::value<float>(), 	"Epoch Interval")
+	("thread_budget", 			boost::program_options::value<int>(), 		"Number of threads to use")
 	("rnx", 					boost::program_options::value<string>(),	"RINEX station file")
 	("root_input_dir", 			boost::program_options::value<string>(),	"Directory containg the input data")
 	("root_output_directory", 	boost::program_options::value<string>(),	"Output directory")
@@ -266,6 +271,7 @@ bool configure(
 		KFState kfState;
 		kfState.rts_lag = -1;
 		kfState.rts_filename		= forward;
+		kfState.rts_forward_filename	= forward + FORWARD_SUFFIX;
 		acsConfig.output_clocks		= true;
 		acsConfig.clocks_filename	= forward + SMOOTHED_SUFFIX + "_clk";
 
@@ -598,9 +604,10 @@ void getFromYaml(
 	recOpts._initialised = true;
 }
 
-/** Set satellite options for a specific satellite using a hierarchy of sources
+/** Set satellite options for a specific satellite using a hierarchy of sources.
+* Populates satOptsMap, and walks the yaml configuration, so must not be run concurrently
 */
-SatelliteOptions& ACSConfig::getSatOpts(
+SatelliteOptions& ACSConfig::resolveSatOpts(
 	SatSys& Sat)	///< Satellite to search for options for
 {
 	auto& satOpts = satOptsMap[Sat.id()];
@@ -653,10 +660,11 @@ SatelliteOptions& ACSConfig::getSatOpts(
 
 	return satOpts;
 }
-	//todo aaron these are just asking for it to crash in parallel
-/** Set receiver options for a specific receiver using a hierarchy of sources
+
+/** Set receiver options for a specific receiver using a hierarchy of sources.
+* Populates recOptsMap, and walks the yaml configuration, so must not be run concurrently
 */
-ReceiverOptions& ACSConfig::getRecOpts(
+ReceiverOptions& ACSConfig::resolveRecOpts(
 	string id)		///< Receiver to search for options for
 {
 	auto& recOpts = recOptsMap[id];
@@ -683,6 +691,112 @@ ReceiverOptions& ACSConfig::getRecOpts(
 	return recOpts;
 }
 
+/** Options snapshot currently used by processing, and the one it replaced, which is kept while references to it may remain in use
+*/
+std::atomic<OptionsSnapshot*>		currentOptions_ptr	= nullptr;
+std::unique_ptr<OptionsSnapshot>	currentOptions;
+std::unique_ptr<OptionsSnapshot>	previousOptions;
+
+/** Guards resolution of options that are not in the current snapshot
+*/
+std::mutex							optionsMutex;
+bool								optionsReloaded		= true;		///< The configuration has been reloaded since the last snapshot was published
+
+/** Resolve the options of all satellites and of all receivers that are configured or have been seen, and publish them as a new snapshot.
+* Must be called between epochs, when no processing threads are running
+*/
+void ACSConfig::publishOptions()
+{
+	std::lock_guard<std::mutex> guard(optionsMutex);
+
+	if	( optionsReloaded == false
+		&&currentOptions->satOptsMap.size() == satOptsMap.size()
+		&&currentOptions->recOptsMap.size() == recOptsMap.size())
+	{
+		//nothing has been resolved since the last snapshot
+		return;
+	}
+
+	optionsReloaded = false;
+
+	for (auto& [sys, minPrn, maxPrn] :	{	std::tuple<E_Sys, int, int>{E_Sys::GPS, MINPRNGPS, MAXPRNGPS},
+											std::tuple<E_Sys, int, int>{E_Sys::GLO, MINPRNGLO, MAXPRNGLO},
+											std::tuple<E_Sys, int, int>{E_Sys::GAL, MINPRNGAL, MAXPRNGAL},
+											std::tuple<E_Sys, int, int>{E_Sys::QZS, MINPRNQZS, MAXPRNQZS},
+											std::tuple<E_Sys, int, int>{E_Sys::CMP, MINPRNCMP, MAXPRNCMP},
+											std::tuple<E_Sys, int, int>{E_Sys::SBS, MINPRNSBS, MAXPRNSBS}})
+	for (int prn = minPrn; prn <= maxPrn; prn++)
+	{
+		SatSys Sat(sys, prn);
+		resolveSatOpts(Sat);
+	}
+
+	auto stationsNode = stringsToYamlObject(yaml, {"override_filter_parameters", "stations"});
+	if (stationsNode.IsMap())
+	for (auto stationNode : stationsNode)
+	{
+		resolveRecOpts(stationNode.first.as<string>());
+	}
+
+	if (currentOptions)
+	for (auto& [id, recOpts] : currentOptions->recOptsMap)
+	{
+		resolveRecOpts(id);
+	}
+
+	auto newOptions = std::make_unique<OptionsSnapshot>();
+	newOptions->version		= currentOptions ? currentOptions->version + 1 : 1;
+	newOptions->satOptsMap	= satOptsMap;
+	newOptions->recOptsMap	= recOptsMap;
+
+	currentOptions_ptr.store(newOptions.get(), std::memory_order_release);
+
+	previousOptions	= std::move(currentOptions);
+	currentOptions	= std::move(newOptions);
+}
+
+/** Get the options for a satellite, from the current snapshot if available
+*/
+SatelliteOptions& ACSConfig::getSatOpts(
+	SatSys& Sat)	///< Satellite to search for options for
+{
+	OptionsSnapshot* options_ptr = currentOptions_ptr.load(std::memory_order_acquire);
+	if (options_ptr)
+	{
+		auto it = options_ptr->satOptsMap.find(Sat.id());
+		if (it != options_ptr->satOptsMap.end())
+		{
+			return it->second;
+		}
+	}
+
+	//not seen before, resolve it now and include it in the next snapshot
+	std::lock_guard<std::mutex> guard(optionsMutex);
+
+	return resolveSatOpts(Sat);
+}
+
+/** Get the options for a receiver, from the current snapshot if available
+*/
+ReceiverOptions& ACSConfig::getRecOpts(
+	string id)		///< Receiver to search for options for
+{
+	OptionsSnapshot* options_ptr = currentOptions_ptr.load(std::memory_order_acquire);
+	if (options_ptr)
+	{
+		auto it = options_ptr->recOptsMap.find(id);
+		if (it != options_ptr->recOptsMap.end())
+		{
+			return it->second;
+		}
+	}
+
+	//not seen before, resolve it now and include it in the next snapshot
+	std::lock_guard<std::mutex> guard(optionsMutex);
+
+	return resolveRecOpts(id);
+}
+
 /** Set minimum constraint options for a specific receiver using a hierarchy of sources
 */
 MinimumStationOptions& ACSConfig::getMinConOpts(
@@ -913,6 +1027,14 @@ bool ACSConfig::parse(
 {
 	configFilename = filename;
 
+	if (fileWatcher.changed(filename) == false)
+	{
+		//include any options that were first needed during the last epoch
+		publishOptions();
+
+		return false;
+	}
+
 // 	std::filesystem::path filePath(filename);
 	boost::filesystem::path filePath(filename);
 // 	auto currentConfigModifyTime = std::filesystem::last_write_time(filePath);
@@ -920,6 +1042,9 @@ bool ACSConfig::parse(
 
 	if (currentConfigModifyTime == configModifyTimeMap["CONFIG"])
 	{
+		//include any options that were first needed during the last epoch
+		publishOptions();
+
 		return false;
 	}
 	
@@ -929,9 +1054,10 @@ bool ACSConfig::parse(
 	BOOST_LOG_TRIVIAL(info)
 	<< "Loading configuration from file " << filename;
 
-	//clear old saved parameters
+	//clear old saved parameters, the published snapshot holds its own copies until it is replaced
 	satOptsMap.clear();
 	recOptsMap.clear();
+	optionsReloaded = true;
 	
 	try
 	{
@@ -1056,6 +1182,7 @@ bool ACSConfig::parse(
 		trySetFromYaml(input_persistance,		output_files, {"input_persistance"		});
 		trySetFromYaml(persistance_directory,	output_files, {"persistance_directory"	});
 		trySetFromYaml(persistance_filename,	output_files, {"persistance_filename"	});
+		trySetFromYaml(persistance_snapshot_interval,	output_files, {"persistance_snapshot_interval"	});
 
 		trySetFromYaml(output_mongo_measurements,		output_files, {"output_mongo_measurements"	});
 		trySetFromYaml(output_mongo_states,				output_files, {"output_mongo_states"		});
@@ -1147,14 +1274,36 @@ bool ACSConfig::parse(
 			}
 		}
 		trySetFromYaml(joseph_stabilisation,		processing_options, {"joseph_stabilisation"						});
+		trySetFromYaml(rts_compression,				processing_options, {"rts_compression"							});
+
+		trySetFromAny(thread_budget,	commandOpts, processing_options, {"thread_budget"	});
+
+		for (int i = 0; i < E_Stage::_size(); i++)
+		{
+			int		index	= E_Stage::_values()[i];
+			string	stage	= E_Stage::_names() [i];		boost::algorithm::to_lower(stage);
+
+			trySetFromYaml(stage_threads[index],	processing_options, {"stage_threads", stage	});
+		}
+
+		trySetFromYaml(pipeline_depth,		processing_options, {"pipeline_depth"		});
+		trySetFromYaml(watch_input_files,	processing_options, {"watch_input_files"	});
+		trySetFromYaml(share_satellite_states,	processing_options, {"share_satellite_states"	});
+		trySetFromYaml(ephemeris_retention,		processing_options, {"ephemeris_retention"		});
+
+		fileWatcher.enabled = watch_input_files;
 	}
 
 	auto user_filter = stringsToYamlObject(yaml, {"user_filter_parameters"});
 	{
 		trySetEnumOpt( pppOpts.inverter, 				user_filter,	{"inverter" 				}, E_Inverter::_from_string_nocase);
+		trySetFromYaml(pppOpts.chunk_size,				user_filter,	{"chunk_size"				});
+		trySetFromYaml(pppOpts.incremental_rejection,	user_filter,	{"incremental_rejection"	});
 		trySetFromYaml(pppOpts.max_filter_iter,			user_filter,	{"max_filter_iterations"	});
 		trySetFromYaml(pppOpts.max_prefit_remv,			user_filter,	{"max_prefit_remvovals"		});
 		trySetFromYaml(pppOpts.rts_lag,					user_filter,	{"rts_lag"					});
+		trySetFromYaml(pppOpts.rts_spill,				user_filter,	{"rts_spill"				});
+		trySetFromYaml(pppOpts.rts_memory_budget,		user_filter,	{"rts_memory_budget"		});
 		trySetFromYaml(pppOpts.rts_directory,			user_filter,	{"rts_directory"			});
 		trySetFromYaml(pppOpts.rts_filename,			user_filter,	{"rts_filename"				});
 		trySetFromYaml(pppOpts.outage_reset_limit,		user_filter,	{"outage_reset_limit"		});
@@ -1164,10 +1313,13 @@ bool ACSConfig::parse(
 	auto network_filter = stringsToYamlObject(yaml, {"network_filter_parameters"});
 	{
 		trySetEnumOpt( netwOpts.inverter, 			network_filter,	{"inverter" 				}, E_Inverter::_from_string_nocase);
+		trySetFromYaml(netwOpts.chunk_size,			network_filter,	{"chunk_size"				});
+		trySetFromYaml(netwOpts.incremental_rejection,	network_filter,	{"incremental_rejection"	});
 		trySetEnumOpt( netwOpts.filter_mode, 		network_filter, {"process_mode" 			}, E_FilterMode::_from_string_nocase);
 		trySetFromYaml(netwOpts.max_filter_iter,	network_filter, {"max_filter_iterations"	});
 		trySetFromYaml(netwOpts.max_prefit_remv,	network_filter, {"max_prefit_remvovals"		});
 		trySetFromYaml(netwOpts.rts_lag,			network_filter,	{"rts_lag"					});
+		trySetFromYaml(netwOpts.rts_spill,			network_filter,	{"rts_spill"				});
 		trySetFromYaml(netwOpts.rts_directory,		network_filter,	{"rts_directory"			});
 		trySetFromYaml(netwOpts.rts_filename,		network_filter,	{"rts_filename"				});
 		trySetFromYaml(netwOpts.outage_reset_limit,	network_filter,	{"outage_reset_limit"		});
@@ -1220,7 +1372,11 @@ bool ACSConfig::parse(
 		trySetFromYaml(ionFilterOpts.model_noise,		ionFilter, {"model_noise"			});
 		trySetFromYaml(ionFilterOpts.max_filter_iter,	ionFilter, {"max_filter_iterations"	});
 		trySetFromYaml(ionFilterOpts.max_prefit_remv,	ionFilter, {"max_filter_removals"	});
+		trySetEnumOpt( ionFilterOpts.inverter,			ionFilter, {"inverter"				}, E_Inverter::_from_string_nocase);
+		trySetFromYaml(ionFilterOpts.chunk_size,		ionFilter, {"chunk_size"			});
+		trySetFromYaml(ionFilterOpts.incremental_rejection,	ionFilter, {"incremental_rejection"	});
 		trySetFromYaml(ionFilterOpts.rts_lag,			ionFilter, {"rts_lag"				});
+		trySetFromYaml(ionFilterOpts.rts_spill,			ionFilter, {"rts_spill"				});
 		trySetFromYaml(ionFilterOpts.rts_directory,		ionFilter, {"rts_directory"			});
 		trySetFromYaml(ionFilterOpts.rts_filename,		ionFilter, {"rts_filename"			});
 
@@ -1629,6 +1785,14 @@ bool ACSConfig::parse(
 	}
 #	endif
 
+#	ifndef ENABLE_ZLIB
+	if (rts_compression)
+	{
+		std::cout << std::endl << "Error: RTS archive compression requested by config but this binary was built without zlib." << std::endl;
+		exit(1);
+	}
+#	endif
+
 #	ifndef ENABLE_UNIT_TESTS
 	if (process_tests)
 	{
@@ -1638,5 +1802,7 @@ bool ACSConfig::parse(
 	}
 #	endif
 
+	publishOptions();
+
 	return true;
 }
@@ -108,6 +108,7 @@ struct OutputOptions
 	bool	input_persistance			= false;
 	string 	persistance_directory		= "./";
 	string	persistance_filename		= "<CONFIG><WWWW><D>.persist";
+	int		persistance_snapshot_interval	= 100;
 
 	bool	output_mongo_measurements	= false;
 	bool	output_mongo_states			= false;
@@ -198,6 +199,14 @@ struct GlobalOptions
 	double	wait_all_stations	= 0;
 
 	bool	joseph_stabilisation	= false;
+	bool	rts_compression			= false;
+
+	int				thread_budget	= 0;		///< Total threads to use for processing (0 for all available)
+	map<int, int>	stage_threads;				///< Maximum threads for individual processing stages (indexed by E_Stage)
+	int				pipeline_depth	= 0;		///< Number of epochs of observations to decode in the background while the current epoch is processed
+	bool			watch_input_files	= true;	///< Use file change notifications rather than checking every input file each epoch
+	bool			share_satellite_states	= false;	///< Interpolate satellite states from a cache shared by all stations rather than calculating them for each station
+	double			ephemeris_retention		= 86400;	///< Broadcast ephemerides with reference times older than this (s) are removed (0 to keep all)
 
 	list<string>							station_files;
 
@@ -266,11 +275,14 @@ struct NetworkOptions
 
 	int			filter_mode		= E_FilterMode::KALMAN;
 	int			inverter		= E_Inverter::INV;
+	int			chunk_size		= 64;
+	bool		incremental_rejection	= false;
 
 	int			max_filter_iter = 2;
 	int			max_prefit_remv = 2;
 
 	int			rts_lag			= 0;
+	bool		rts_spill		= false;
 	string		rts_directory	= "./";
 	string		rts_filename	= "Network-<YYYY><DDD><HH>.rts";
 
@@ -304,8 +316,11 @@ struct IonFilterOptions
 	int				max_filter_iter = 2;
 	int				max_prefit_remv = 2;
 	int				inverter		= E_Inverter::INV;
+	int				chunk_size		= 64;
+	bool			incremental_rejection	= false;
 
 	int		rts_lag			= 0;
+	bool	rts_spill		= false;
 	string	rts_directory	= "./";
 	string	rts_filename	= "Ionosphere-<YYYY><DDD><HH>.rts";
 
@@ -430,8 +445,12 @@ struct PPPOptions
 	int			max_prefit_remv 	= 2;
 
 	int			inverter			= E_Inverter::INV;
+	int			chunk_size			= 64;
+	bool		incremental_rejection	= false;
 
 	int			rts_lag				= 0;
+	bool		rts_spill			= false;
+	double		rts_memory_budget	= 0;		///< Memory available for smoothing station filters concurrently at the end of processing (MB, 0 for unlimited)
 	string		rts_directory		= "./";
 	string		rts_filename		= "PPP-<Station>-<YYYY><DDD><HH>.rts";
 };
@@ -476,6 +495,16 @@ struct SsrOptions
 	bool	read_from_files			= false;
 };
 
+/** Satellite and receiver options fully resolved from the configuration.
+* Snapshots are not modified once published, so processing threads may read them without locking
+*/
+struct OptionsSnapshot
+{
+	long int									version	= 0;
+	unordered_map<string,	SatelliteOptions>	satOptsMap;
+	unordered_map<string,	ReceiverOptions>	recOptsMap;
+};
+
 /** General options object to be used throughout the software
 */
 struct ACSConfig : GlobalOptions, InputOptions, OutputOptions, DebugOptions
@@ -499,6 +528,10 @@ struct ACSConfig : GlobalOptions, InputOptions, OutputOptions, DebugOptions
 	ReceiverOptions&			getRecOpts		(string		id);
 	MinimumStationOptions&		getMinConOpts	(string 	id);
 
+	SatelliteOptions&			resolveSatOpts	(SatSys&	Sat);
+	ReceiverOptions&			resolveRecOpts	(string		id);
+	void						publishOptions	();
+
 	unordered_map<string,		SatelliteOptions>	satOptsMap;
 	unordered_map<string,		ReceiverOptions>	recOptsMap;
 
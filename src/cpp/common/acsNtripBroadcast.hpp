@@ -9,12 +9,13 @@
 #include "ntripTrace.hpp"
 #include "navigation.hpp"
 #include "acsConfig.hpp"
+#include "traceSink.hpp"
 #include "enums.h"
 
 
 
 template<typename T>
-extern std::ofstream getTraceFile(T& thing);
+extern TraceStream getTraceFile(T& thing);
 
 struct NtripBroadcaster
 {
@@ -550,6 +550,8 @@ void SSRDecoder::decodeSSR(uint8_t* data, unsigned int message_length)
 		SatSys Sat(sys, satId);
 		
 		auto& ssr = nav.satNavMap[Sat].ssr;
+
+		satStateCache.invalidate(Sat);
 			
 		if 	( message_number == +RtcmMessageType::GPS_SSR_ORB_CORR
 			||message_number == +RtcmMessageType::GPS_SSR_COMB_CORR
@@ -573,11 +575,12 @@ void SSRDecoder::decodeSSR(uint8_t* data, unsigned int message_length)
 
 								
 			//tracepdeex(rtcmdeblvl,std::cout, "\n#RTCM_DEC SSRORB %s %s %4d %10.3f %10.3f %10.3f ", Sat.id(),ssrEph.t0.to_string(2), ssrEph.iode,ssrEph.deph[0],ssrEph.deph[1],ssrEph.deph[2]);
-			if	( ssr.ssrEph_map.size() == 0
-				||ssrEph.iod		!= ssr.ssrEph_map.begin()->second.iod
-				||ssrEph.t0			!= ssr.ssrEph_map.begin()->second.t0)
+			auto newest_ptr = ssr.ssrEph_map.newest();
+			if	( newest_ptr == nullptr
+				||ssrEph.iod	!= newest_ptr->iod
+				||ssrEph.t0		!= newest_ptr->t0)
 			{
-				ssr.ssrEph_map[ssrEph.t0] = ssrEph;
+				ssr.ssrEph_map.insert(ssrEph.t0, ssrEph);
 			}
 			
 			traceSsrEph(Sat,ssrEph);
@@ -602,11 +605,12 @@ void SSRDecoder::decodeSSR(uint8_t* data, unsigned int message_length)
 			ssrClk.dclk[2]		= getbitsInc(data, i, 27) * 0.00002e-3;
 			
 			//tracepdeex(rtcmdeblvl,std::cout, "\n#RTCM_DEC SSRCLK %s %s      %10.3f %10.3f %10.3f", Sat.id(),ssrClk.t0.to_string(2), ssrClk.dclk[0],ssrClk.dclk[1],ssrClk.dclk[2]);
-			if	( ssr.ssrClk_map.size() == 0
-				||ssrClk.iod		!= ssr.ssrClk_map.begin()->second.iod
-				||ssrClk.t0			!= ssr.ssrClk_map.begin()->second.t0)
+			auto newest_ptr = ssr.ssrClk_map.newest();
+			if	( newest_ptr == nullptr
+				||ssrClk.iod	!= newest_ptr->iod
+				||ssrClk.t0		!= newest_ptr->t0)
 			{
-				ssr.ssrClk_map[ssrClk.t0] = ssrClk;
+				ssr.ssrClk_map.insert(ssrClk.t0, ssrClk);
 			}
 			
 			traceSsrClk(Sat,ssrClk);
@@ -623,13 +627,14 @@ void SSRDecoder::decodeSSR(uint8_t* data, unsigned int message_length)
 			ssrUra.iod 			= iod;
 			ssrUra.ura			= getbituInc(data, i, 6);
 			
-			if	( ssr.ssrUra_map.size() == 0
-				||ssrUra.iod		!= ssr.ssrUra_map.begin()->second.iod
-				||ssrUra.t0			!= ssr.ssrUra_map.begin()->second.t0)
+			auto newest_ptr = ssr.ssrUra_map.newest();
+			if	( newest_ptr == nullptr
+				||ssrUra.iod	!= newest_ptr->iod
+				||ssrUra.t0		!= newest_ptr->t0)
 			{
 				// This is the total User Range Accuracy calculated from all the SSR.
 				// TODO: Check implementation, RTCM manual DF389.                     
-				ssr.ssrUra_map[ssrUra.t0] = ssrUra;
+				ssr.ssrUra_map.insert(ssrUra.t0, ssrUra);
 			}
 		}
 		
@@ -669,11 +674,12 @@ void SSRDecoder::decodeSSR(uint8_t* data, unsigned int message_length)
 				}
 			}
 			
-			if	( ssr.ssrCodeBias_map.size() == 0
-				||ssrBiasCode.iod		!= ssr.ssrCodeBias_map.begin()->second.iod
-				||ssrBiasCode.t0		!= ssr.ssrCodeBias_map.begin()->second.t0)
+			auto newest_ptr = ssr.ssrCodeBias_map.newest();
+			if	( newest_ptr == nullptr
+				||ssrBiasCode.iod	!= newest_ptr->iod
+				||ssrBiasCode.t0		!= newest_ptr->t0)
 			{
-				ssr.ssrCodeBias_map[ssrBiasCode.t0] = ssrBiasCode;
+				ssr.ssrCodeBias_map.insert(ssrBiasCode.t0, ssrBiasCode);
 			}
 		}
 		
@@ -730,11 +736,12 @@ void SSRDecoder::decodeSSR(uint8_t* data, unsigned int message_length)
 				}
 			}
 			
-			if	( ssr.ssrPhasBias_map.size() == 0
-				||ssrBiasPhas.iod		!= ssr.ssrPhasBias_map.begin()->second.iod
-				||ssrBiasPhas.t0		!= ssr.ssrPhasBias_map.begin()->second.t0)
+			auto newest_ptr = ssr.ssrPhasBias_map.newest();
+			if	( newest_ptr == nullptr
+				||ssrBiasPhas.iod	!= newest_ptr->iod
+				||ssrBiasPhas.t0		!= newest_ptr->t0)
 			{
-				ssr.ssrPhasBias_map[ssrBiasPhas.t0] = ssrBiasPhas;
+				ssr.ssrPhasBias_map.insert(ssrBiasPhas.t0, ssrBiasPhas);
 			}
 		}
 	}
@@ -923,17 +930,16 @@ void EphemerisDecoder::decodeEphemeris(uint8_t* data, unsigned int message_lengt
 	}
 	
 	//check for iode, add if not found.
-	for (auto& eph_ : nav.ephMap[eph.Sat])
+	auto& ephStore = nav.ephMap[eph.Sat];
+	if (ephStore.find(eph.iode, eph.toe, 6*60*60))	//current iode is guaranteed to be different from other iode's transmitted in the last 6 hours, but then it begins to repeat
 	{
-		if	( eph_.iode == eph.iode
-			&&fabs(timediff(eph.toe,eph_.toe))<6*60*60) //current iode is guaranteed to be different from other iode's transmitted in the last 6 hours, but then it begins to repeat
-		{
-			return;
-		}
-	}		
+		return;
+	}
 	//tracepdeex(rtcmdeblvl,std::cout, "\n#RTCM_DEC BRCEPH %s %s %4d %16.9e %13.6e %10.3e, %d ", eph.Sat.id(),eph.toe.to_string(2), eph.iode, eph.f0,eph.f1,eph.f2, message_number);
 	//std::cout << "Adding ephemeris for " << eph.Sat.id() << std::endl;
-	nav.ephMap[eph.Sat].push_back(eph);
+	ephStore.add(eph);
+
+	satStateCache.invalidate(eph.Sat);
 	
 	traceBroEph(eph,sys);
 }
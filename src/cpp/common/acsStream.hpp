@@ -111,6 +111,16 @@ struct ObsStream
 	}
 
 
+	/** Decode observations ahead of their use, until a number of epochs are held.
+	* This may be called from a background thread while earlier epochs are processed, so implementations must only modify the stream itself.
+	* Streams that also decode navigation data (eg. RTCM) update shared objects as they decode, and do nothing here.
+	*/
+	virtual void prefetchObs(
+		int		epochs)			///< Number of epochs to hold, including the one currently in use
+	{
+
+	}
+
 	/** Check to see if this stream has run out of data
 	*/
 	virtual bool isDead()
@@ -421,6 +431,36 @@ struct FileRinexStream : ACSFileStream, RinexStream
 		lastObsListSize = obsList.size();
 		return obsList;
 	}
+
+	void prefetchObs(
+		int		epochs)			///< Number of epochs to hold, including the one currently in use
+	override
+	{
+		if (ctype != 'O')
+		{
+			//navigation files update the shared navigation data as they are parsed
+			return;
+		}
+
+		FileState fileState = openFile();
+
+		while	( obsListList.size() < epochs
+				&&fileState.inputStream)
+		{
+			long int pos = fileState.inputStream.tellg();
+
+			parseRINEX(fileState.inputStream);
+
+			if (!fileState.inputStream)
+			{
+				//leave finding the end of the file to getObs(), so that the stream is not reported dead while it still holds observations
+				fileState.inputStream.clear();
+				fileState.inputStream.seekg(pos);
+				tempObsList.clear();
+				break;
+			}
+		}
+	}
 	
 	bool parse()
 	{
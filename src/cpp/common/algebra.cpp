@@ -6,9 +6,11 @@
 using std::list;
 using std::pair;
 
+#include <boost/log/trivial.hpp>
 
 #include "eigenIncluder.hpp"
 #include "algebraTrace.hpp"
+#include "threadBudget.hpp"
 #include "streamTrace.hpp"
 #include "acsConfig.hpp"
 #include "algebra.hpp"
@@ -50,10 +52,10 @@ bool KFKey::operator ==(const KFKey& b) const
 
 bool KFKey::operator <(const KFKey& b) const
 {
-	int strCompare = str.compare(b.str);
 	if (type < b.type)		return true;
 	if (type > b.type)		return false;
 
+	int strCompare = str.compare(b.str);
 	if (strCompare < 0)		return true;
 	if (strCompare > 0)		return false;
 
@@ -92,6 +94,81 @@ int KFState::getKFIndex(
 	return index->second;
 }
 
+/** Returns the integer handle for a key in this filter, interning it if it has not been seen before.
+* Handles remain valid while their key is in the state, and are released for reuse by later keys once it has been removed (see updateHandleIndices()).
+*/
+int KFState::getKFHandle(
+	const KFKey&	key)		///< [in]	Key to get handle for
+{
+	auto [iter, isNew] = kfHandleMap.try_emplace(key, -1);
+	if (isNew == false)
+	{
+		return iter->second;
+	}
+
+	int handle;
+	if (kfFreeHandles.empty())
+	{
+		handle = kfHandleKeys.size();
+
+		kfHandleKeys	.push_back(key);
+		kfHandleIndices	.push_back(getKFIndex(key));
+	}
+	else
+	{
+		handle = kfFreeHandles.back();
+		kfFreeHandles.pop_back();
+
+		kfHandleKeys	[handle] = key;
+		kfHandleIndices	[handle] = getKFIndex(key);
+	}
+
+	iter->second = handle;
+
+	return handle;
+}
+
+/** Finds the position in the KF state vector of the state with a particular key handle.
+*/
+int KFState::getHandleIndex(
+	int			handle)		///< [in]	Handle of key to search for in state
+{
+	if	( handle < 0
+		||handle >= kfHandleIndices.size())
+	{
+		return -1;
+	}
+
+	return kfHandleIndices[handle];
+}
+
+/** Refreshes the state vector indexes of all interned key handles.
+* Must be called whenever the kfIndexMap is replaced.
+* Handles of keys that are no longer in the state are released, so that the table only grows with the number of states rather than with every key ever seen.
+* Released handles keep their old key until reused, so that stale references can still be reported.
+*/
+void KFState::updateHandleIndices()
+{
+	for (auto it = kfHandleMap.begin(); it != kfHandleMap.end(); )
+	{
+		auto& [key, handle] = *it;
+
+		int index = getKFIndex(key);
+
+		kfHandleIndices[handle] = index;
+
+		if (index < 0)
+		{
+			kfFreeHandles.push_back(handle);
+
+			it = kfHandleMap.erase(it);
+			continue;
+		}
+
+		it++;
+	}
+}
+
 /** Returns the value and variance of a state within the kalman filter object
 */
 bool KFState::getKFValue(
@@ -273,6 +350,15 @@ void KFState::addKFState(
 	}
 }
 
+/** Adds a state to the filter using a key handle previously obtained from getKFHandle()
+*/
+void KFState::addKFHandle(
+	int				handle,			///< [in]	Handle of the key to add to the state
+	InitialState	initialState)	///< [in]	The initial conditions to add to the state
+{
+	addKFState(kfHandleKeys[handle], initialState);
+}
+
 /** Limit state values according to configured parameters
 */
 void KFState::clampStateValues()
@@ -305,13 +391,129 @@ void KFState::clampStateValues()
 	x = x.cwiseMax(clampMinVec).cwiseMin(clampMaxVec);
 }
 
+/** Assign indices in the state vector for all states that will exist after the next state transition.
+* Existing states keep their current index where possible, and new states are placed in the slots left by removed states.
+* If states have been removed overall, the states at the end of the vector are moved into the remaining gaps to keep the vector compact.
+* This keeps the transition matrix close to identity, so that the covariance matrix can be updated in place.
+*/
+map<KFKey, short int> KFState::stableStateLayout()
+{
+	int newStateCount = stateTransitionMap.size();
+
+	map<KFKey, short int>	newKFIndexMap;
+	vector<bool>			slotUsed(newStateCount, false);
+	list<KFKey>				unplacedKeys;
+
+	for (auto& [kfKey, map] : stateTransitionMap)
+	{
+		int index = getKFIndex(kfKey);
+
+		if	( (index >= 0)
+			&&(index < newStateCount))
+		{
+			newKFIndexMap[kfKey]	= index;
+			slotUsed[index]			= true;
+		}
+		else
+		{
+			unplacedKeys.push_back(kfKey);
+		}
+	}
+
+	int slot = 0;
+	for (auto& kfKey : unplacedKeys)
+	{
+		while (slotUsed[slot])
+		{
+			slot++;
+		}
+
+		newKFIndexMap[kfKey]	= slot;
+		slotUsed[slot]			= true;
+	}
+
+	return newKFIndexMap;
+}
+
+/** Apply a sparse state transition matrix to a state vector and covariance matrix in place, computing F * x and F * P * F'.
+* Rows of F that are a single unit entry on the diagonal leave a state where it is, so their elements of P are not touched at all,
+* while the remaining rows (new or moved states, rates, Gauss-Markov states) are computed using sparse products.
+* The result is the same as the dense product, without the O(n^3) cost of multiplying through all of the identity elements.
+*/
+void sparseTransition(
+	SparseMatrix<double, Eigen::RowMajor>&	F,		///< [in]		Compressed state transition matrix
+	VectorXd&								x,		///< [in/out]	State vector to transition
+	MatrixXd&								P)		///< [in/out]	Covariance matrix to transition
+{
+	vector<int> keepRows;
+	vector<int> otherRows;
+
+	for (int row = 0; row < F.outerSize(); row++)
+	{
+		SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(F, row);
+
+		if	( (F.innerVector(row).nonZeros()	== 1)
+			&&(it.col()							== row)
+			&&(it.value()						== 1))
+		{
+			keepRows	.push_back(row);
+		}
+		else
+		{
+			otherRows	.push_back(row);
+		}
+	}
+
+	//calculate the changed rows using the old values, before any are overwritten
+	VectorXd xo;
+	MatrixXd FoP;
+	MatrixXd PoO;
+
+	if (otherRows.empty() == false)
+	{
+		SparseMatrix<double, Eigen::RowMajor> Fo(otherRows.size(), F.cols());
+		{
+			vector<Triplet<double>> triplets;
+
+			for (int i = 0; i < otherRows.size(); i++)
+			for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(F, otherRows[i]); it; ++it)
+			{
+				triplets.push_back({i, (int) it.col(), it.value()});
+			}
+
+			Fo.setFromTriplets(triplets.begin(), triplets.end());
+		}
+
+		xo	= Fo	* x;
+		FoP	= Fo	* P;
+		PoO	= FoP	* Fo.transpose();
+	}
+
+	//every element outside the kept block is overwritten below, so resizing does not need to preserve anything else
+	if (F.rows() != x.rows())
+	{
+		x.conservativeResize(F.rows());
+		P.conservativeResize(F.rows(), F.rows());
+	}
+
+	if (otherRows.empty() == false)
+	{
+		x(otherRows)				= xo;
+		P(otherRows, keepRows)		= FoP(Eigen::all, keepRows);
+		P(keepRows,	otherRows)		= P(otherRows, keepRows).transpose();
+		P(otherRows, otherRows)		= PoO;
+	}
+}
+
 /** Add process noise and dynamics to filter object according to time gap.
- * This will also sort states according to their kfKey as a result of the way the state transition matrix is generated.
+ * Existing states keep their index in the state vector where possible (see stableStateLayout()), so the order of states does not follow their kfKeys.
  */
 void KFState::stateTransition(
 	Trace&		trace,		///< [out]	Trace file for output
 	GTime		newTime)	///< [in]	Time of update for process noise and dynamics (s)
 {
+	StageScope stageScope(E_Stage::STATE_TRANSITION);
+
 	KFState& kfState = *this;
 	
 	if (time == GTime::noTime())
@@ -334,20 +536,22 @@ void KFState::stateTransition(
 	if	(rtsFilterInProgress)
 	{
 		//add some states to prvent bad things happening.
-		spitFilterToFile(kfState, E_SerialObject::FILTER_MINUS,	kfState.rts_forward_filename);
-		spitFilterToFile(kfState, E_SerialObject::FILTER_PLUS,	kfState.rts_forward_filename);
+		spitFilterToRTS(kfState, E_SerialObject::FILTER_MINUS);
+		spitFilterToRTS(kfState, E_SerialObject::FILTER_PLUS);
 		rtsFilterInProgress = false;
 	}
 
 	//Initialise and populate a state transition matrix
-	MatrixXd F = MatrixXd::Zero(newStateCount, x.rows());
+	//almost every row is a single identity entry, so keep it sparse and only store the couplings that exist
+	SparseMatrix<double, Eigen::RowMajor> F(newStateCount, x.rows());
+	F.reserve(Eigen::VectorXi::Constant(newStateCount, 2));
+
+	map<KFKey, short int> newKFIndexMap = stableStateLayout();
 
 	//add transitions for any states (usually close to identity)
-	int row = 0;
-	map<KFKey, short int> newKFIndexMap;
 	for (auto& [kfKey1, map] : stateTransitionMap)
 	{
-		newKFIndexMap[kfKey1] = row;
+		int row = newKFIndexMap[kfKey1];
 
 		for (auto& [kfKey2, value] : map)
 		{
@@ -359,9 +563,8 @@ void KFState::stateTransition(
 				continue;
 			}
 
-			F(row, index2) = value;
+			F.coeffRef(row, index2) = value;
 		}
-		row++;
 	}
 
 	//add transitions for states using a first-order Gauss-Markov model 
@@ -381,7 +584,7 @@ void KFState::stateTransition(
 		{
 			continue;
 		}
-		F(row, index2) = exp(-tgap/tau); // Ref: El-Mowafy (2011) - Dynamic Modelling of Zenith Wet Delay in GNSS Measurements - https://ro.ecu.edu.au/cgi/viewcontent.cgi?referer=&httpsredir=1&article=1789&context=ecuworks2011
+		F.coeffRef(row, index2) = exp(-tgap/tau); // Ref: El-Mowafy (2011) - Dynamic Modelling of Zenith Wet Delay in GNSS Measurements - https://ro.ecu.edu.au/cgi/viewcontent.cgi?referer=&httpsredir=1&article=1789&context=ecuworks2011
 	}
 
 	//add transitions for any dynamics that are scaled by time
@@ -406,11 +609,18 @@ void KFState::stateTransition(
 			continue;
 		}
 
-		F(index1, index2) = val * tgap;
+		F.coeffRef(index1, index2) = val * tgap;
 	}
 
-	//scale and add process noise
-	MatrixXd Q0 = MatrixXd::Zero(newStateCount, newStateCount);
+	//remove any explicit zeros (eg new states initialised to zero) so that they dont count as couplings
+	F.prune([](const Eigen::Index& row, const Eigen::Index& col, const double& value)
+	{
+		return value != 0;
+	});
+	F.makeCompressed();
+
+	//scale and add process noise (only diagonal elements are ever populated)
+	VectorXd Q0 = VectorXd::Zero(newStateCount);
 	tgap = fabs(tgap);
 
 	//add noise as 'process noise' as the method of initialising a state's variance
@@ -430,7 +640,7 @@ void KFState::stateTransition(
 			continue;
 		}
 
-		Q0(index, index) = value;
+		Q0(index) = value;
 	}
 
 	//add time dependent process noise
@@ -468,11 +678,11 @@ void KFState::stateTransition(
 		if (gmIter != gaussMarkovTauMap.end())
 		{
 			double tau = gmIter->second;
-			Q0(index, index) += value * (1-exp(-2*tgap/tau)) * tgap;  // Ref: El-Mowafy (2011) - Dynamic Modelling of Zenith Wet Delay in GNSS Measurements - https://ro.ecu.edu.au/cgi/viewcontent.cgi?referer=&httpsredir=1&article=1789&context=ecuworks2011
+			Q0(index) += value * (1-exp(-2*tgap/tau)) * tgap;  // Ref: El-Mowafy (2011) - Dynamic Modelling of Zenith Wet Delay in GNSS Measurements - https://ro.ecu.edu.au/cgi/viewcontent.cgi?referer=&httpsredir=1&article=1789&context=ecuworks2011
 			continue;
 		}
 
-		Q0(index, index) += value * tgap;
+		Q0(index) += value * tgap;
 	}
 
 	//add process noise according to the uncertainty in dynamical states
@@ -512,15 +722,15 @@ void KFState::stateTransition(
 		if	( (index1 < 0)
 			||(index2 < 0)
 			||(index1 >= Q0.rows())
-			||(index2 >= Q0.cols()))
+			||(index2 >= Q0.rows()))
 		{
 			continue;
 		}
 
-		double sourceNoise = Q0(index2, index2) * val;
+		double sourceNoise = Q0(index2) * val;
 // 		Q0(index1, index2) += sourceNoise / 2 * tgap * tgap;
 // 		Q0(index2, index1) += sourceNoise / 2 * tgap * tgap;
-		Q0(index1, index1) += sourceNoise / 3 * tgap * tgap * tgap;
+		Q0(index1) += sourceNoise / 3 * tgap * tgap * tgap;
 	}
 
 	//output the state transition matrix to a trace file (used by RTS smoother)
@@ -530,27 +740,55 @@ void KFState::stateTransition(
 		transitionMatrixObject.rows = F.rows();
 		transitionMatrixObject.cols = F.cols();
 
-		for (auto& [kfKey1, newIndex] : newKFIndexMap)
-		for (auto& [kfKey2, oldIndex] : kfIndexMap)
+		//only non zero elements are stored in F, which saves space
+		for (int newIndex = 0; newIndex < F.outerSize(); newIndex++)
+		for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(F, newIndex); it; ++it)
 		{
-			double transition	= F(newIndex, oldIndex);
-
-			//only output non zero elements to save space
-			if	(transition	!= 0)
-			{
-				transitionMatrixObject.forwardTransitionMap[{newIndex, oldIndex}] = transition;
-			}
+			transitionMatrixObject.forwardTransitionMap[{newIndex, (int) it.col()}] = it.value();
 		}
-		spitFilterToFile(transitionMatrixObject,	E_SerialObject::TRANSITION_MATRIX,	rts_forward_filename);
+		spitFilterToRTS(kfState, transitionMatrixObject);
 		rtsFilterInProgress = true;
 	}
 
+	//the UD factors are propagated alongside the covariance if they are still valid for it, otherwise they are recomputed at the next update
+	bool ud = (inverter == E_Inverter::UD) && udFactorsCurrent();
+
 	//compute the updated states and covariance matrices
-	x = (F * x							).eval();
-	P = (F * P * F.transpose()	+ Q0	).eval();
+	if (denseTransition)
+	{
+		MatrixXd Fdense = F;
+
+		x = (Fdense * x								).eval();
+		P = (Fdense * P * Fdense.transpose()		).eval();
+	}
+	else
+	{
+		sparseTransition(F, x, P);
+	}
+
+	P.diagonal() += Q0;
+
+	if (ud)
+	{
+		int clamped = udTransition(F, Q0, U, D);
+		if (clamped)
+		{
+			tracepdeex(2, trace, "\nWarning: UD state transition clamped %d negative pivots to zero", clamped);
+		}
+
+		udDiagonal = P.diagonal();
+	}
+	else
+	{
+		U			.resize(0, 0);
+		D			.resize(0);
+		udDiagonal	.resize(0);
+	}
 
 	//replace the index map with the updated version that corresponds to the updated state
 	kfIndexMap = newKFIndexMap;
+
+	updateHandleIndices();
 }
 
 /** Compare variances of measurements and filtered states to detect unreasonable values
@@ -561,13 +799,14 @@ int KFState::postFitSigmaCheck(
 	VectorXd&	xp,         ///< The post-filter state vector to compare with measurements
 	VectorXd&	dx)			///< The innovations from filtering to recalculate the deltas.
 {
-	MatrixXd&	H = kfMeas.A;
+	auto&		H = kfMeas.A;
 	VectorXd	v = kfMeas.V	- H * dx;
+	ArrayXd		mask			= kfMeas.usedMask();
 
 	//use 'array' for component-wise calculations
 	auto		variations		= v.array().square();	//delta squared
 	auto		variances		= kfMeas.R.array();
-	auto		ratios			= variations / variances;
+	auto		ratios			= variations / variances * mask;
 	auto		outsideExp		= ratios > SQR(4);
 // 	double		meanVariations	= variations.mean();
 
@@ -578,6 +817,11 @@ int KFState::postFitSigmaCheck(
 
 		for (int i = 0; i < kfMeas.V.rows(); i++)
 		{
+			if (mask(i) == 0)
+			{
+				continue;
+			}
+
 			tracepdeex(2, trace, "* %20s %13.4f %13.4f %16.9f\n", ((string)kfMeas.obsKeys[i]).c_str(), kfMeas.V(i), v(i), kfMeas.R(i));
 		}
 		trace << "- Residuals" << std::endl;
@@ -611,17 +855,28 @@ int KFState::preFitSigmaCheck(
 	Trace&		trace,		///< Trace to output to
 	KFMeas&		kfMeas)		///< Measurements, noise, and design matrix
 {
-	auto	v = kfMeas.V;
-	auto	R = kfMeas.R;
-	auto	H = kfMeas.A;
-	auto	P = this->P;
+	auto&	v = kfMeas.V;
+	auto&	R = kfMeas.R;
+
+	auto&	H = kfMeas.A;
+
+	//only the diagonal of HPH' is required
+	MatrixXd	HP			= H * P;
+	VectorXd	HPHtDiag	= VectorXd::Zero(H.rows());
+
+	for (int meas = 0; meas < H.rows(); meas++)
+	for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(H, meas); it; ++it)
+	{
+		HPHtDiag(meas) += HP(meas, it.col()) * it.value();
+	}
+
+	ArrayXd	mask		= kfMeas.usedMask();
 
 	//use 'array' for component-wise calculations
-	MatrixXd	HPHt		= H * P * H.transpose();
 	auto		variations	= v.array().square();	//delta squared
-	auto		variances	= (R + (H * P * H.transpose()).diagonal()).array();
+	auto		variances	= (R + HPHtDiag).array();
 
-	auto		ratios		= variations / variances;
+	auto		ratios		= variations / variances * mask;
 	auto		outsideExp	= ratios > SQR(4);
 
 // 	double		meanRatios		= ratios.mean();
@@ -643,6 +898,34 @@ int KFState::preFitSigmaCheck(
 	return -1;
 }
 
+/** Output the inputs of a filter update and exit if it has produced invalid states.
+*/
+void exitIfNaN(
+	const VectorXd&	xp,			///< Post-update state vector to check
+	const VectorXd&	R,			///< Measurement noise
+	const VectorXd&	v,			///< Measurement innovations
+	const string&	gainName,	///< Label of the gain matrix in the output
+	const MatrixXd&	K,			///< Kalman gain, or its transpose
+	const MatrixXd&	P)			///< Pre-update covariance of states
+{
+	bool error = xp.array().isNaN().any();
+	if (error == false)
+	{
+		return;
+	}
+
+	std::cout << std::endl << "xp:" << std::endl << xp << std::endl;
+	std::cout << std::endl << "R :" << std::endl << R << std::endl;
+	std::cout << std::endl << "v :" << std::endl << v << std::endl;
+	std::cout << std::endl << gainName << ":" << std::endl << K << std::endl;
+	std::cout << std::endl << "P :" << std::endl << P << std::endl;
+	std::cout << std::endl;
+	std::cout << "NAN found. Exiting...";
+	std::cout << std::endl;
+
+	exit(0);
+}
+
 /** Kalman filter.
 */
 int KFState::kFilter(
@@ -746,108 +1029,639 @@ int KFState::kFilter(
 	}
 
 
-	bool error = xp.array().isNaN().any();
-	if (error)
-	{
-		std::cout << std::endl << "xp:" << std::endl << xp << std::endl;
-		std::cout << std::endl << "R :" << std::endl << R << std::endl;
-		std::cout << std::endl << "v :" << std::endl << v << std::endl;
-		std::cout << std::endl << "K :" << std::endl << K << std::endl;
-		std::cout << std::endl << "P :" << std::endl << P << std::endl;
-		std::cout << std::endl;
-		std::cout << "NAN found. Exiting...";
-		std::cout << std::endl;
-
-		exit(0);
-	}
+	exitIfNaN(xp, R, v, "K ", K, P);
 
 	bool pass = true;
 	return pass;
 }
 
-/** Perform chi squared quality control.
+/** Kalman filter state update, with the covariance update deferred to symmetricCovarianceUpdate().
+* The design matrix is treated as sparse, and the covariance is not copied or modified here,
+* so that repeated iterations after measurement rejection do not need to touch the full covariance matrix.
 */
-bool KFState::chiQC(
-	Trace&		trace,      ///< Trace to output to
-	KFMeas&		kfMeas,		///< Measurements, noise, and design matrix
-	VectorXd&	xp)         ///< Post filtered state vector
+int KFState::kFilterStates(
+	Trace&			trace,		///< Trace to output to
+	KFMeas&			kfMeas,		///< Measurements, noise, and design matrices
+	VectorXd&		xp,   		///< Post-update state vector
+	VectorXd&		dx,			///< Post-update state innovation
+	MatrixXd&		HP,			///< Product of design and covariance matrices, for use in covariance update
+	MatrixXd&		Kt,			///< Transposed kalman gain, for use in covariance update (empty if no update is to be applied)
+	KFInnovationFactor*	factor_ptr)	///< Optional output of the factorised innovation covariance, for use by kFilterRejections()
 {
 	auto& H = kfMeas.A;
-	auto W = kfMeas.W(Eigen::all, 0);
-
-	VectorXd&	y		= kfMeas.Y;
-	VectorXd	v		= y - H * xp;
-	double		v_Wv	= v.transpose() * W.asDiagonal() * v;
-
-	//trace << std::endl << "chiqcV" << v.rows() << std::endl;	tracematpde(5, trace, v, 15, 5);
+	auto& R = kfMeas.R;
+	auto& v = kfMeas.V;
 
-	int obsNumber = v.rows() - x.rows() + 1;
-	double val = v_Wv / (obsNumber);
+	HP			= H		* P;
+	MatrixXd Q	= HP	* H.transpose();
 
-	double thres;
-	if (obsNumber <= 100) 	thres = chisqr[obsNumber - 1] / (obsNumber);
-	else					thres = 3;
+	Q += R.asDiagonal();
 
-	/* chi-square validation */
-	if (val > thres)
+	//chunks of measurements are small enough to factorise directly
+	int method = inverter;
+	if (method == E_Inverter::CHUNKED)
 	{
-		tracepdeex(1, trace, "\n ChiSquare error detected");
-
-		auto variations	= v.array().square();
-// 		Eigen::MatrixXf::Index index;
-// 		trace << " -> LARGEe ERROR OF " << sqrt(variations.maxCoeff(&index)) << " AT " << index;
-
-		return false;
+		method = E_Inverter::LLT;
 	}
 
-	return true;
-}
+	bool repeat = true;
+	while (repeat)
+	{
+		switch (method)
+		{
+			default:
+			case E_Inverter::LDLT:
+			{
+				LDLT<MatrixXd> solver;
+				solver.compute(Q);
+				if (solver.info() != Eigen::ComputationInfo::Success)
+				{
+					tracepdeex(1, trace, "Warning: kalman filter error1\n");
+					xp = x;
+					dx = VectorXd::Zero(xp.rows());
+					Kt.resize(0, 0);
 
-/** Combine a list of KFMeasEntrys into a single KFMeas object for used in the filter
-*/
-KFMeas KFState::combineKFMeasList(
-	KFMeasEntryList&	kfEntryList)	///< [in]	List of input measurements as lists of entries
-{
-	int numMeas = kfEntryList.size();
+					return 1;
+				}
 
-	KFMeas kfMeas;
+				Kt = solver.solve(HP);
+				if (solver.info() != Eigen::ComputationInfo::Success)
+				{
+					tracepdeex(1, trace, "Warning: kalman filter error2\n");
+					xp = x;
+					dx = VectorXd::Zero(xp.rows());
+					Kt.resize(0, 0);
 
-	kfMeas.R.resize(numMeas);
-	kfMeas.V.resize(numMeas);
-	kfMeas.Y.resize(numMeas);
+					return 1;
+				}
+
+				break;
+			}
+			case E_Inverter::LLT:
+			{
+				LLT<MatrixXd> solver;
+				solver.compute(Q);
+				if (solver.info() != Eigen::ComputationInfo::Success)
+				{
+					if (inverter == E_Inverter::LLT)
+					{
+						inverter = E_Inverter::LDLT;
+					}
+					method = E_Inverter::LDLT;
+					continue;
+				}
 
-	kfMeas.A = MatrixXd::Zero(numMeas, x.rows());
+				Kt = solver.solve(HP);
 
-	kfMeas.obsKeys		.resize(numMeas);
-	kfMeas.metaDataMaps	.resize(numMeas);
+				if (factor_ptr)
+				{
+					auto& factor = *factor_ptr;
 
-	int meas = 0;
-	for (auto& entry: kfEntryList)
-	{
-		kfMeas.R(meas) = entry.noise;
-		kfMeas.Y(meas) = entry.value;
-		kfMeas.V(meas) = entry.innov;
+					factor.llt		= std::move(solver);
+					factor.Q		= std::move(Q);
+					factor.R		= R;
+					factor.mask		= kfMeas.usedMask();
+					factor.valid	= true;
+				}
 
-		for (auto& [kfKey, value] : entry.designEntryMap)
-		{
-			int index = getKFIndex(kfKey);
-			if (index < 0)
+				break;
+			}
+			case E_Inverter::INV:
 			{
-				std::cout << "hhuh?" << kfKey << std::endl;
-				return KFMeas();
+				MatrixXd Qinv = Q.inverse();
+				Kt = Qinv * HP;
+
+				break;
 			}
-			kfMeas.A(meas, index) = value;
 		}
-
-		kfMeas.obsKeys		[meas] = std::move(entry.obsKey);
-		kfMeas.metaDataMaps	[meas] = std::move(entry.metaDataMap);
-		meas++;
+		repeat = false;
 	}
 
-	return kfMeas;
-}
+	dx = Kt.transpose() * v;
+	xp = x + dx;
 
-void KFState::doRejectCallbacks(
+	exitIfNaN(xp, R, v, "Kt", Kt, P);
+
+	bool pass = true;
+	return pass;
+}
+
+/** Apply changes made to measurements by reject callbacks since the last call to kFilterStates(), without refactorising the innovation covariance.
+* Deweighted measurements are applied to the factorisation as rank one updates, and removed measurements as low rank updates.
+* The gain is updated using the Sherman-Morrison identity, a removal being the limit of infinite deweighting.
+* Returns false if the changes cannot be applied, in which case the filter must be recalculated in full.
+*/
+bool KFState::kFilterRejections(
+	Trace&				trace,		///< Trace to output to
+	KFMeas&				kfMeas,		///< Measurements, noise, and design matrices
+	KFInnovationFactor&	factor,		///< Factorised innovation covariance from kFilterStates()
+	VectorXd&			xp,			///< Post-update state vector
+	VectorXd&			dx,			///< Post-update state innovation
+	MatrixXd&			Kt)			///< Transposed kalman gain from kFilterStates(), updated in place
+{
+	auto&	R		= kfMeas.R;
+	ArrayXd	mask	= kfMeas.usedMask();
+
+	int numMeas = R.rows();
+
+	if	( (factor.valid		== false)
+		||(factor.R.rows()	!= numMeas)
+		||(Kt.rows()		!= numMeas))
+	{
+		factor.valid = false;
+		return false;
+	}
+
+	int updates = 0;
+
+	for (int i = 0; i < numMeas; i++)
+	{
+		if (factor.mask(i) == 0)
+		{
+			//already has no gain, any further changes are irrelevant
+			continue;
+		}
+
+		bool	remove	= (mask(i) == 0);
+		double	delta	= R(i) - factor.R(i);
+
+		if	( (remove	== false)
+			&&(delta	== 0))
+		{
+			continue;
+		}
+
+		VectorXd e		= VectorXd::Unit(numMeas, i);
+		VectorXd u		= factor.llt.solve(e);
+		MatrixXd Kti	= Kt.row(i);
+
+		if (remove)
+		{
+			Kt.noalias() -= (u / u(i)) * Kti;
+			Kt.row(i).setZero();
+
+			//replace the row and column of the innovation covariance with the measurement noise, as a pair of rank one updates and a diagonal correction
+			VectorXd a = factor.Q.col(i);
+			a(i) = 0;
+
+			double diagonal = R(i) - factor.Q(i,i);
+
+			factor.llt.rankUpdate((a - e) / sqrt(2),	+1);
+			factor.llt.rankUpdate((a + e) / sqrt(2),	-1);
+			factor.llt.rankUpdate(sqrt(fabs(diagonal)) * e,	diagonal > 0 ? +1 : -1);
+
+			factor.Q.row(i).setZero();
+			factor.Q.col(i).setZero();
+			factor.Q(i,i) = R(i);
+		}
+		else
+		{
+			Kt.noalias() -= (delta / (1 + delta * u(i)) * u) * Kti;
+
+			factor.llt.rankUpdate(sqrt(fabs(delta)) * e,	delta > 0 ? +1 : -1);
+
+			factor.Q(i,i) += delta;
+		}
+
+		if (factor.llt.info() != Eigen::ComputationInfo::Success)
+		{
+			factor.valid = false;
+			return false;
+		}
+
+		factor.R(i)		= R(i);
+		factor.mask(i)	= mask(i);
+
+		updates++;
+	}
+
+	tracepdeex(4, trace, "\nApplied %d rejections to factorised innovation covariance", updates);
+
+	dx = Kt.transpose() * kfMeas.V;
+	xp = x + dx;
+
+	return true;
+}
+
+/** Apply the covariance update P = P - HP' * Kt calculated by kFilterStates() to the filter in place.
+* Only the lower triangle is computed, and it is then mirrored to keep the covariance exactly symmetric.
+*/
+void KFState::symmetricCovarianceUpdate(
+	MatrixXd&		HP,			///< Product of design and covariance matrices from kFilterStates()
+	MatrixXd&		Kt)			///< Transposed kalman gain from kFilterStates()
+{
+	if (Kt.rows() == 0)
+	{
+		return;
+	}
+
+	lowerTriangularProduct(P, HP, Kt, -1);
+}
+
+/** Factorise a covariance matrix as P = U * D * U', with U unit upper triangular and D diagonal.
+* Pivots that are not positive due to rounding or uninitialised states are set to zero,
+* so that the factorised covariance is always symmetric and positive semi-definite.
+* Returns the number of negative pivots that were clamped, zero pivots are expected for uninitialised states.
+*/
+int udFactorise(
+	const MatrixXd&	P,		///< [in]	Covariance matrix to factorise
+	MatrixXd&		U,		///< [out]	Unit upper triangular factor
+	VectorXd&		D)		///< [out]	Diagonal factor
+{
+	int n = P.rows();
+	int clamped = 0;
+
+	//only the lower triangle of the working copy is maintained
+	MatrixXd M = P;
+
+	U = MatrixXd::Identity(n, n);
+	D = VectorXd::Zero(n);
+
+	for (int j = n - 1; j >= 0; j--)
+	{
+		double d = M(j,j);
+		if (d <= 0)
+		{
+			if (d < 0)
+			{
+				clamped++;
+			}
+
+			continue;
+		}
+
+		D(j) = d;
+
+		VectorXd u = M.row(j).head(j).transpose() / d;
+
+		U.col(j).head(j) = u;
+
+		M.topLeftCorner(j, j).selfadjointView<Eigen::Lower>().rankUpdate(u, -d);
+	}
+
+	return clamped;
+}
+
+/** Propagate the UD factors of a covariance through a state transition, such that U * D * U' = F * P * F' + diag(Q),
+* using Thornton's modified weighted Gram-Schmidt orthogonalisation of the rows of [F * U | I].
+* Only states with process noise are given a noise column.
+* Returns the number of negative pivots that were clamped, zero pivots are expected for uninitialised states.
+*/
+int udTransition(
+	SparseMatrix<double, Eigen::RowMajor>&	F,		///< [in]		Compressed state transition matrix
+	VectorXd&								Q,		///< [in]		Process noise to add to the transitioned covariance
+	MatrixXd&								U,		///< [in/out]	Unit upper triangular factor
+	VectorXd&								D)		///< [in/out]	Diagonal factor
+{
+	int n = F.rows();
+	int m = F.cols();
+	int clamped = 0;
+
+	vector<int> noisy;
+	for (int i = 0; i < Q.rows(); i++)
+	{
+		if (Q(i) != 0)
+		{
+			noisy.push_back(i);
+		}
+	}
+
+	int cols = m + noisy.size();
+
+	MatrixXd W = MatrixXd::Zero(n, cols);
+	VectorXd Dw(cols);
+
+	W.leftCols(m)	= F * U;
+	Dw.head(m)		= D;
+
+	for (int i = 0; i < noisy.size(); i++)
+	{
+		W(noisy[i], m + i)	= 1;
+		Dw(m + i)			= Q(noisy[i]);
+	}
+
+	U = MatrixXd::Identity(n, n);
+	D = VectorXd::Zero(n);
+
+	for (int k = n - 1; k >= 0; k--)
+	{
+		VectorXd c = W.row(k).transpose().cwiseProduct(Dw);
+
+		double d = W.row(k).dot(c);
+		if (d <= 0)
+		{
+			if (d < 0)
+			{
+				clamped++;
+			}
+
+			//a row without weight has nothing to remove from the rows above it
+			continue;
+		}
+
+		D(k) = d;
+
+		VectorXd u = W.topRows(k) * c / d;
+
+		U.col(k).head(k) = u;
+
+		W.topRows(k).noalias() -= u * W.row(k);
+	}
+
+	return clamped;
+}
+
+/** Check that the UD factors correspond to the current covariance matrix.
+* Changes made to P outside of the UD update and state transition (eg least squares initialisation) are detected by its diagonal, and require the factors to be recomputed.
+*/
+bool KFState::udFactorsCurrent()
+{
+	return	( U.rows()			== P.rows()
+			&&udDiagonal.rows()	== P.rows()
+			&&(udDiagonal.array() == P.diagonal().array()).all());
+}
+
+/** Kalman filter update using the UD factors of the covariance matrix.
+* Measurements are applied sequentially as scalars using Bierman's algorithm, which updates the factors directly,
+* so the covariance remains symmetric and positive semi-definite without symmetrisation or the joseph form.
+* The covariance is kept consistent with the factors by a rank one update per measurement, using P * h which is a by-product of the factor update.
+* The measurement noise must be uncorrelated, as it is for all KFMeas objects.
+*/
+int KFState::kFilterUD(
+	Trace&			trace,		///< Trace to output to
+	KFMeas&			kfMeas,		///< Measurements, noise, and design matrices
+	MatrixXd&		U,			///< Unit upper triangular factor of the covariance, updated in place
+	VectorXd&		D,			///< Diagonal factor of the covariance, updated in place
+	MatrixXd&		Pp,			///< Covariance, lower triangle updated in place
+	VectorXd&		xp,   		///< Post-update state vector
+	VectorXd&		dx)			///< Post-update state innovation
+{
+	auto& H = kfMeas.A;
+	auto& R = kfMeas.R;
+	auto& v = kfMeas.V;
+
+	int n = x.rows();
+
+	ArrayXd mask = kfMeas.usedMask();
+
+	dx = VectorXd::Zero(n);
+
+	VectorXd f(n);
+	VectorXd g(n);
+	VectorXd b(n);
+	VectorXd Ucol(n);
+
+	for (int meas = 0; meas < H.rows(); meas++)
+	{
+		if (mask(meas) == 0)
+		{
+			continue;
+		}
+
+		//innovation relative to the state after previous measurements, and f = U' * h
+		double innov = v(meas);
+
+		f.setZero();
+		for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(H, meas); it; ++it)
+		{
+			innov	-= it.value() * dx(it.col());
+			f		+= it.value() * U.row(it.col()).transpose();
+		}
+
+		g = D.cwiseProduct(f);
+		b.setZero();
+
+		double alpha = R(meas);
+
+		for (int j = 0; j < n; j++)
+		{
+			if (f(j) == 0)
+			{
+				//nothing to change in this column
+				continue;
+			}
+
+			double alphaPrev = alpha;
+
+			alpha	+= f(j) * g(j);
+			D(j)	*= alphaPrev / alpha;
+
+			double p = -f(j) / alphaPrev;
+
+			Ucol.head(j)		= U.col(j).head(j);
+			U.col(j).head(j)	+= p	* b.head(j);
+			b.head(j)			+= g(j)	* Ucol.head(j);
+			b(j)				=  g(j);
+		}
+
+		if	( alpha <= 0
+			||std::isnan(alpha))
+		{
+			tracepdeex(1, trace, "Warning: kalman filter error in UD update\n");
+			xp = x;
+			dx = VectorXd::Zero(n);
+
+			return 0;
+		}
+
+		//b = P * h here, so the covariance update is -b * b' / alpha
+		dx += b * (innov / alpha);
+
+		Pp.selfadjointView<Eigen::Lower>().rankUpdate(b, -1 / alpha);
+	}
+
+	Pp.triangularView<Eigen::StrictlyUpper>() = Pp.transpose();
+
+	xp = x + dx;
+
+	return 1;
+}
+
+/** Perform chi squared quality control.
+*/
+bool KFState::chiQC(
+	Trace&		trace,      ///< Trace to output to
+	KFMeas&		kfMeas,		///< Measurements, noise, and design matrix
+	VectorXd&	xp)         ///< Post filtered state vector
+{
+	auto& H = kfMeas.A;
+	auto W = kfMeas.W(Eigen::all, 0);
+
+	VectorXd&	y		= kfMeas.Y;
+	VectorXd	v		= y - H * xp;
+	v.array() *= kfMeas.usedMask();
+
+	double		v_Wv	= v.transpose() * W.asDiagonal() * v;
+
+	//trace << std::endl << "chiqcV" << v.rows() << std::endl;	tracematpde(5, trace, v, 15, 5);
+
+	int obsNumber = kfMeas.numUsed() - x.rows() + 1;
+	double val = v_Wv / (obsNumber);
+
+	double thres;
+	if (obsNumber <= 100) 	thres = chisqr[obsNumber - 1] / (obsNumber);
+	else					thres = 3;
+
+	/* chi-square validation */
+	if (val > thres)
+	{
+		tracepdeex(1, trace, "\n ChiSquare error detected");
+
+		auto variations	= v.array().square();
+// 		Eigen::MatrixXf::Index index;
+// 		trace << " -> LARGEe ERROR OF " << sqrt(variations.maxCoeff(&index)) << " AT " << index;
+
+		return false;
+	}
+
+	return true;
+}
+
+/** Combine a list of KFMeasEntrys into a single KFMeas object for used in the filter
+*/
+KFMeas KFState::combineKFMeasList(
+	KFMeasEntryList&	kfEntryList)	///< [in]	List of input measurements as lists of entries
+{
+	int numMeas = kfEntryList.size();
+
+	KFMeas kfMeas;
+
+	kfMeas.R.resize(numMeas);
+	kfMeas.V.resize(numMeas);
+	kfMeas.Y.resize(numMeas);
+
+	vector<Triplet<double>> dsgnEntries;
+	dsgnEntries.reserve(numMeas * 8);
+
+	kfMeas.obsKeys		.resize(numMeas);
+	kfMeas.metaDataList	.resize(numMeas);
+
+	int meas = 0;
+	for (auto& entry: kfEntryList)
+	{
+		kfMeas.R(meas) = entry.noise;
+		kfMeas.Y(meas) = entry.value;
+		kfMeas.V(meas) = entry.innov;
+
+		for (auto& [handle, value] : entry.designEntryList)
+		{
+			int index;
+			if (entry.kfState_ptr == this)	index = getHandleIndex(handle);
+			else							index = getKFIndex(entry.kfState_ptr->kfHandleKeys[handle]);
+
+			if (index < 0)
+			{
+				BOOST_LOG_TRIVIAL(error)
+				<< "Measurement references " << entry.kfState_ptr->kfHandleKeys[handle] << ", which is not in the filter state, measurements not combined";
+
+				return KFMeas();
+			}
+			dsgnEntries.push_back({meas, index, value});
+		}
+
+		for (auto& [kfKey, value] : entry.designEntryMap)
+		{
+			int index = getKFIndex(kfKey);
+			if (index < 0)
+			{
+				BOOST_LOG_TRIVIAL(error)
+				<< "Measurement references " << kfKey << ", which is not in the filter state, measurements not combined";
+
+				return KFMeas();
+			}
+			dsgnEntries.push_back({meas, index, value});
+		}
+
+		kfMeas.obsKeys		[meas] = std::move(entry.obsKey);
+		kfMeas.metaDataList	[meas] = entry.metaData;
+		meas++;
+	}
+
+	//later entries for the same state replace earlier ones
+	kfMeas.A.resize(numMeas, x.rows());
+	kfMeas.A.setFromTriplets(dsgnEntries.begin(), dsgnEntries.end(), [](const double& a, const double& b) { return b; });
+
+	return kfMeas;
+}
+
+/** Combine the measurements in a builder into a single KFMeas object for use in the filter.
+* Must be called after the filter's state transition, so that all states referenced by the measurements exist.
+* The observation keys are moved into the output, so this should only be called once for each builder.
+*/
+KFMeas KFMeasBuilder::combine()
+{
+	//map builder rows to output rows, skipping discarded measurements
+	vector<int> measIndex(values.size(), -1);
+
+	int numMeas = 0;
+	for (int row = 0; row < values.size(); row++)
+	{
+		if (discarded[row])
+		{
+			continue;
+		}
+
+		measIndex[row] = numMeas;
+		numMeas++;
+	}
+
+	KFMeas kfMeas;
+
+	kfMeas.R.resize(numMeas);
+	kfMeas.V.resize(numMeas);
+	kfMeas.Y.resize(numMeas);
+
+	kfMeas.obsKeys		.resize(numMeas);
+	kfMeas.metaDataList	.resize(numMeas);
+
+	for (int row = 0; row < values.size(); row++)
+	{
+		int meas = measIndex[row];
+		if (meas < 0)
+		{
+			continue;
+		}
+
+		kfMeas.R(meas) = noises[row];
+		kfMeas.Y(meas) = values[row];
+		kfMeas.V(meas) = innovs[row];
+
+		kfMeas.obsKeys		[meas] = std::move(obsKeys[row]);
+		kfMeas.metaDataList	[meas] = metaDataList[row];
+	}
+
+	//convert handles to state indices
+	vector<Triplet<double>> indexEntries;
+	indexEntries.reserve(dsgnEntries.size());
+
+	for (auto& entry : dsgnEntries)
+	{
+		int meas = measIndex[entry.row()];
+		if (meas < 0)
+		{
+			continue;
+		}
+
+		int index = kfState.getHandleIndex(entry.col());
+		if (index < 0)
+		{
+			BOOST_LOG_TRIVIAL(error)
+			<< "Measurement references " << kfState.kfHandleKeys[entry.col()] << ", which is not in the filter state, measurements not combined";
+
+			return KFMeas();
+		}
+
+		indexEntries.push_back({meas, index, entry.value()});
+	}
+
+	//later entries for the same state replace earlier ones
+	kfMeas.A.resize(numMeas, kfState.x.rows());
+	kfMeas.A.setFromTriplets(indexEntries.begin(), indexEntries.end(), [](const double& a, const double& b) { return b; });
+
+	return kfMeas;
+}
+
+void KFState::doRejectCallbacks(
 	Trace&		trace,				///< Trace file for output
 	KFMeas&		kfMeas,				///< Measurements that were passed to the filter
 	int			badIndex)			///< Index in measurement list that was unsatisfactory
@@ -894,13 +1708,15 @@ int KFState::filterKalman(
 	KFMeas&			kfMeas,				///< [in]	Measurement object
 	bool			innovReady)			///< [in]	Innovation already constructed
 {
+	StageScope stageScope(E_Stage::FILTER_UPDATE);
+
 	KFState& kfState = *this;
 
 	kfState.time = kfMeas.time;
 
 	if (kfState.rts_filename.empty() == false)
 	{
-		spitFilterToFile(kfState, E_SerialObject::FILTER_MINUS, kfState.rts_forward_filename);
+		spitFilterToRTS(kfState, E_SerialObject::FILTER_MINUS);
 	}
 
 	if (kfMeas.A.rows() == 0)
@@ -909,7 +1725,7 @@ int KFState::filterKalman(
 
 		if (kfState.rts_filename.empty() == false)
 		{
-			spitFilterToFile(kfState, E_SerialObject::FILTER_PLUS, kfState.rts_forward_filename);
+			spitFilterToRTS(kfState, E_SerialObject::FILTER_PLUS);
 			rtsFilterInProgress = false;
 		}
 		return 1;
@@ -921,6 +1737,44 @@ int KFState::filterKalman(
 		kfMeas.V = kfMeas.Y - kfMeas.A * kfState.x;
 	}
 
+	int pass;
+	if	( inverter == E_Inverter::CHUNKED
+		&&chunk_size > 0)
+	{
+		pass = kfState.filterKalmanChunks(trace, kfMeas);
+	}
+	else
+	{
+		pass = kfState.filterKalmanUpdate(trace, kfMeas);
+	}
+
+	//the filter no longer needs the indices of rejected measurements, remove them as the callers expect
+	kfMeas.dropRemoved();
+
+	if (pass == false)
+	{
+		return 0;
+	}
+
+	clampStateValues();
+
+	if (kfState.rts_filename.empty() == false)
+	{
+		spitFilterToRTS(kfState, E_SerialObject::FILTER_PLUS);
+		rtsFilterInProgress = false;
+	}
+	return 1;
+}
+
+/** Apply a set of measurements to the filter, with prefit and postfit checks and any rejections that they require.
+* The measurement innovations must already be constructed.
+*/
+int KFState::filterKalmanUpdate(
+	Trace&			trace,				///< [out]	Trace file for output
+	KFMeas&			kfMeas)				///< [in]	Measurement object
+{
+	KFState& kfState = *this;
+
 	for (int i = 0; i < max_prefit_remv; i++)
 	{
 //		cout << "A" << endl;
@@ -935,10 +1789,55 @@ int KFState::filterKalman(
 
 	MatrixXd Pp;
 	VectorXd xp;
+	MatrixXd HP;
+	MatrixXd Kt;
+
+	//the joseph form needs the full gain matrix, otherwise use the symmetric update that modifies P in place after the iterations are complete
+	bool inPlace = (acsConfig.joseph_stabilisation == false);
+
+	//the UD filter updates copies of the factors kept in the filter state, which are only recomputed if P has been changed directly
+	bool ud = (inverter == E_Inverter::UD);
+	MatrixXd	U;
+	VectorXd	D;
+	if	( ud
+		&&kfState.udFactorsCurrent() == false)
+	{
+		int clamped = udFactorise(P, kfState.U, kfState.D);
+		if (clamped)
+		{
+			tracepdeex(2, trace, "\nWarning: UD factorisation clamped %d negative pivots to zero", clamped);
+		}
+	}
+
+	//retain the factorised innovation covariance to apply rejections in later iterations
+	KFInnovationFactor	factor;
+	KFInnovationFactor*	factor_ptr = nullptr;
+	if	( inPlace
+		&&incremental_rejection)
+	{
+		factor_ptr = &factor;
+	}
 
 	for (int i = 0; i < max_filter_iter; i++)
 	{
-		bool pass = kfState.kFilter(trace, kfMeas, xp, Pp, dx);
+		bool pass = false;
+		if (factor.valid)
+		{
+			pass = kfState.kFilterRejections(trace, kfMeas, factor, xp, dx, Kt);
+		}
+
+		if (ud)
+		{
+			U	= kfState.U;
+			D	= kfState.D;
+			Pp	= kfState.P;
+			pass = kfState.kFilterUD(trace, kfMeas, U, D, Pp, xp, dx);
+		}
+		else if (pass == false)
+		{
+			if (inPlace)	pass = kfState.kFilterStates(trace, kfMeas, xp, dx, HP, Kt, factor_ptr);
+			else			pass = kfState.kFilter		(trace, kfMeas, xp, Pp, dx);
+		}
 
 		if (pass == false)
 		{
@@ -954,16 +1853,78 @@ int KFState::filterKalman(
 // 	if (pass)
 	{
 		kfState.x = std::move(xp);
-		kfState.P = std::move(Pp);
+
+		if (ud)
+		{
+			kfState.U			= std::move(U);
+			kfState.D			= std::move(D);
+			kfState.P			= std::move(Pp);
+			kfState.udDiagonal	= kfState.P.diagonal();
+		}
+		else if (inPlace)	kfState.symmetricCovarianceUpdate(HP, Kt);
+		else				kfState.P = std::move(Pp);
 	}
 
-	clampStateValues();
+	return 1;
+}
 
-	if (kfState.rts_filename.empty() == false)
+/** Apply measurements to the filter sequentially in blocks of chunk_size measurements.
+* With diagonal measurement noise this is equivalent to a single update with all measurements,
+* but only requires factorisation of small innovation covariance matrices.
+* Prefit and postfit checks and their reject callbacks are performed on each chunk.
+*/
+int KFState::filterKalmanChunks(
+	Trace&			trace,				///< [out]	Trace file for output
+	KFMeas&			kfMeas)				///< [in]	Measurement object
+{
+	int numMeas = kfMeas.V.rows();
+
+	bool hasObsKeys		= (kfMeas.obsKeys		.size() == numMeas);
+	bool hasMetaData	= (kfMeas.metaDataList	.size() == numMeas);
+
+	//innovations were calculated using the state before any chunks are applied
+	VectorXd x0 = x;
+
+	for (int begin = 0; begin < numMeas; begin += chunk_size)
 	{
-		spitFilterToFile(kfState, E_SerialObject::FILTER_PLUS, kfState.rts_forward_filename);
-		rtsFilterInProgress = false;
+		int rows = std::min(chunk_size, numMeas - begin);
+
+		KFMeas chunk;
+		chunk.time	= kfMeas.time;
+		chunk.A		= kfMeas.A.middleRows	(begin, rows);
+		chunk.R		= kfMeas.R.segment		(begin, rows);
+		chunk.V		= kfMeas.V.segment		(begin, rows) - chunk.A * (x - x0);
+
+		if (kfMeas.removed.rows() == numMeas)	chunk.removed = kfMeas.removed.segment(begin, rows);
+
+		if (hasObsKeys)		chunk.obsKeys		.assign(kfMeas.obsKeys		.begin() + begin, kfMeas.obsKeys		.begin() + begin + rows);
+		if (hasMetaData)	chunk.metaDataList	.assign(kfMeas.metaDataList	.begin() + begin, kfMeas.metaDataList	.begin() + begin + rows);
+
+		int pass = filterKalmanUpdate(trace, chunk);
+
+		//copy back any changes made by reject callbacks
+		kfMeas.R.segment(begin, rows) = chunk.R;
+
+		if (chunk.removed.rows() == rows)
+		{
+			if (kfMeas.removed.rows() != numMeas)
+			{
+				kfMeas.removed = ArrayXb::Constant(numMeas, false);
+			}
+
+			kfMeas.removed.segment(begin, rows) = chunk.removed;
+		}
+
+		if (hasMetaData)	std::copy(chunk.metaDataList.begin(), chunk.metaDataList.end(), kfMeas.metaDataList.begin() + begin);
+
+		if (pass == false)
+		{
+			return 0;
+		}
 	}
+
+	dx = x - x0;
+
 	return 1;
 }
 
@@ -973,16 +1934,18 @@ int KFState::filterLeastSquares(
 	Trace&			trace,		///< [in]		Trace to output to
 	KFMeas&			kfMeas)		///< [in]		Measurements, noise, and design matrix
 {
+	StageScope stageScope(E_Stage::LEAST_SQUARES);
+
 	KFState& kfState = *this;
 
 	trace << std::endl << " -------STARTING LS --------" << std::endl;
 
-	//invert measurement noise matrix to get a weight matrix
-	kfMeas.W = (1 / kfMeas.R.array()).matrix();
+	//invert measurement noise matrix to get a weight matrix, removed measurements have no weight
+	kfMeas.W = (kfMeas.usedMask() / kfMeas.R.array()).matrix();
 
-	if (kfMeas.R.rows() < kfState.x.rows())
+	if (kfMeas.numUsed() < kfState.x.rows())
 	{
-		trace << std::endl << "INSUFFICIENT MEASUREMENTS FOR LEAST SQUARES " << kfMeas.R.rows() <<  " " << kfState.x.rows();
+		trace << std::endl << "INSUFFICIENT MEASUREMENTS FOR LEAST SQUARES " << kfMeas.numUsed() <<  " " << kfState.x.rows();
 		return 0;
 	}
 
@@ -1048,9 +2011,11 @@ void KFState::leastSquareInitStates(
 	bool			initCovars,			///< [in]		Option to also initialise off-diagonal covariance values
 	VectorXd*		dx)					///< [out]		Optional output of state deltas
 {
+	StageScope stageScope(E_Stage::LEAST_SQUARES);
+
 	chiQCPass = false;
 
-	vector<int> newStateIndicies;
+	vector<bool> newStates(x.rows(), false);
 
 	//find all the states that aren't initialised, they need least squaring.
 	for (auto& [key, i] : kfIndexMap)
@@ -1059,23 +2024,34 @@ void KFState::leastSquareInitStates(
 			&&(P(i,i) == 0))
 		{
 			//this is a new state and needs to be evaluated using least squares
-			newStateIndicies.push_back(i);
+			newStates[i] = true;
 		}
 	}
 
-	//get the subset of the measurement matrix that applies to the uninitialised states
-	auto subsetA = kfMeas.A(Eigen::all, newStateIndicies);
-
-	//find the subset of measurements that are required for the initialisation
-	auto usedMeas = subsetA.rowwise().any();
+	auto& A = kfMeas.A;
+	ArrayXd mask = kfMeas.usedMask();
 
 	unordered_map<int, bool> pseudoMeasStates;
 	vector<int> leastSquareMeasIndicies;
 
-	for (int meas = 0; meas < usedMeas.rows(); meas++)
+	//find the subset of measurements that are required for the initialisation
+	for (int meas = 0; meas < A.rows(); meas++)
 	{
+		bool used = false;
+
+		if (mask(meas) != 0)
+		for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(A, meas); it; ++it)
+		{
+			if	( (it.value() != 0)
+				&&(newStates[it.col()]))
+			{
+				used = true;
+				break;
+			}
+		}
+
 		//if not used, dont worry about it
-		if (usedMeas(meas) == 0)
+		if (used == false)
 		{
 			continue;
 		}
@@ -1085,10 +2061,12 @@ void KFState::leastSquareInitStates(
 		leastSquareMeasIndicies.push_back(meas);
 
 		//make a pseudo measurement of anything it references that is already set
-		for (int state = 0; state < kfMeas.A.cols(); state++)
+		for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(A, meas); it; ++it)
 		{
-			if	( (kfMeas.A(meas, state)	!= 0)
-				&&(P(state,state)			!= 0))
+			int state = it.col();
+
+			if	( (it.value()			!= 0)
+				&&(P(state,state)		!= 0))
 			{
 				pseudoMeasStates[state] = true;
 			}
@@ -1097,45 +2075,56 @@ void KFState::leastSquareInitStates(
 
 	int newMeasCount = leastSquareMeasIndicies.size() + pseudoMeasStates.size();
 
-	//Create new measurement objects with larger size, (using all states for now)
-	KFMeas	leastSquareMeas;
+	//find the subset of states required for these measurements, and their design entries
+	vector<Triplet<double>>	dsgnEntries;
+	map<int, int>			usedStates;
+
+	for (int i = 0; i < leastSquareMeasIndicies.size(); i++)
+	for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(A, leastSquareMeasIndicies[i]); it; ++it)
+	{
+		if (it.value() != 0)
+		{
+			dsgnEntries.push_back({i, (int) it.col(), it.value()});
+			usedStates[it.col()] = 0;
+		}
+	}
+
+	//create a new meaurement object using only the required measurements and states.
+	KFMeas	leastSquareMeasSubs;
 
-	leastSquareMeas.Y = VectorXd::Zero(newMeasCount);
-	leastSquareMeas.R = VectorXd::Zero(newMeasCount);
-	leastSquareMeas.A = MatrixXd::Zero(newMeasCount, kfMeas.A.cols());
+	leastSquareMeasSubs.Y = VectorXd::Zero(newMeasCount);
+	leastSquareMeasSubs.R = VectorXd::Zero(newMeasCount);
 
 	int measCount = leastSquareMeasIndicies.size();
 
 	//copy in the required measurements from the old set
-	leastSquareMeas.Y.head		(measCount) = kfMeas.Y(leastSquareMeasIndicies);
-	leastSquareMeas.R.head		(measCount) = kfMeas.R(leastSquareMeasIndicies);
-	leastSquareMeas.A.topRows	(measCount) = kfMeas.A(leastSquareMeasIndicies, Eigen::all);
+	leastSquareMeasSubs.Y.head(measCount) = kfMeas.Y(leastSquareMeasIndicies);
+	leastSquareMeasSubs.R.head(measCount) = kfMeas.R(leastSquareMeasIndicies);
 
 	//append any new pseudo measurements to the end
 	for (auto& [state, boool] : pseudoMeasStates)
 	{
-		leastSquareMeas.Y(measCount)		= x(state);
-		leastSquareMeas.R(measCount)		= P(state,state);
-		leastSquareMeas.A(measCount, state)	= 1;
+		leastSquareMeasSubs.Y(measCount)	= x(state);
+		leastSquareMeasSubs.R(measCount)	= P(state,state);
+		dsgnEntries.push_back({measCount, state, 1});
+		usedStates[state] = 0;
 		measCount++;
 	}
 
-	//find the subset of states required for these measurements
 	vector<int> usedCols;
-	auto usedStates = leastSquareMeas.A.colwise().any();
-	for (int i = 0; i < usedStates.cols(); i++)
+	for (auto& [state, col] : usedStates)
 	{
-		if (usedStates(i) != 0)
-		{
-			usedCols.push_back(i);
-		}
+		col = usedCols.size();
+		usedCols.push_back(state);
 	}
 
-	//create a new meaurement object using only the required states.
-	KFMeas	leastSquareMeasSubs;
-	leastSquareMeasSubs.Y = leastSquareMeas.Y;
-	leastSquareMeasSubs.R = leastSquareMeas.R;
-	leastSquareMeasSubs.A = leastSquareMeas.A(Eigen::all, usedCols);
+	for (auto& entry : dsgnEntries)
+	{
+		entry = Triplet<double>(entry.row(), usedStates[entry.col()], entry.value());
+	}
+
+	leastSquareMeasSubs.A.resize(newMeasCount, usedCols.size());
+	leastSquareMeasSubs.A.setFromTriplets(dsgnEntries.begin(), dsgnEntries.end());
 
 	//invert measurement noise matrix to get a weight matrix
 	leastSquareMeasSubs.W = (1 / leastSquareMeasSubs.R.array()).matrix();
@@ -1383,7 +2372,8 @@ KFMeasEntryList KFState::calcPrefitResids(
 
 	// Calculate prefit resid & uncertainty S
 	Eigen::VectorXd PrefitResid = kfMeas.Y - kfMeas.A * kfState.x;
-	Eigen::MatrixXd S = kfMeas.A * kfState.P * kfMeas.A.transpose() + Eigen::MatrixXd(kfMeas.R.asDiagonal());
+	Eigen::MatrixXd HP = kfMeas.A * kfState.P;
+	Eigen::MatrixXd S = HP * kfMeas.A.transpose() + Eigen::MatrixXd(kfMeas.R.asDiagonal());
 	int numMeas = PrefitResid.size();
 	//assert(kfMeas.R.size() == numMeas);
 	assert(S.rows() == numMeas);
@@ -11,12 +11,14 @@
 #include <limits>
 #include <list>
 #include <map>
+#include <unordered_map>
 
 using std::string;
 using std::vector;
 using std::list;
 using std::hash;
 using std::map;
+using std::unordered_map;
 
 #include "streamTrace.hpp"
 #include "satSys.hpp"
@@ -25,6 +27,7 @@ using std::map;
 
 //forward declaration
 struct Station;
+struct Obs;
 
 /** Keys used to interface with Kalman filter objects.
 * These have parameters to separate states of different 'type', for different 'Sat's, with different receiver id 'str's and may have a different 'num' (eg xyz->0,1,2)
@@ -120,6 +123,15 @@ struct SubState
 	double				x;			///< Value for this state
 };
 
+/** Pointers to objects associated with a measurement, for use by reject callbacks and post-filter checks
+*/
+struct MeasMetaData
+{
+	Obs*			obs_ptr					= nullptr;		///< Observation the measurement was formed from
+	unsigned int*	phaseRejectCount_ptr	= nullptr;		///< Counter of phase rejections for the signal (cleared after a rejection)
+	unsigned int*	phaseOutageCount_ptr	= nullptr;		///< Counter of phase outages for the signal
+};
+
 /** Object to hold measurements, design matrices, and residuals for multiple observations
 */
 struct KFMeas
@@ -129,28 +141,104 @@ struct KFMeas
 	VectorXd	V;							///< Residual of the observations (for non-linear systems)
 	VectorXd	R;							///< Measurement noise for these observations
 	VectorXd	W;							///< Weight (inverse of noise) used in least squares
-	MatrixXd	A;							///< Design matrix between measurements and state
+	ArrayXb		removed;					///< Row mask of measurements removed by removeMeas() until they are dropped by dropRemoved() (empty if none have been removed)
+
+	SparseMatrix<double, Eigen::RowMajor>	A;		///< Design matrix between measurements and state (compressed rows)
 
 	vector<ObsKey>				obsKeys;					///< Optional labels for reporting when measurements are removed etc.
-	vector<map<string, void*>>	metaDataMaps;
+	vector<MeasMetaData>		metaDataList;				///< Optional pointers to objects associated with each measurement
+
+	/** Remove a measurement from use by the filter.
+	* The row is masked and its design entries are zeroed in place rather than copying the remaining rows,
+	* so that indices of other measurements, keys and metadata are unchanged.
+	*/
 	void removeMeas(int index)
 	{
-		vector<int> keepIndices;
+		if (removed.rows() != R.rows())
+		{
+			removed = ArrayXb::Constant(R.rows(), false);
+		}
+
+		removed(index) = true;
+
+		for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(A, index); it; ++it)
+		{
+			it.valueRef() = 0;
+		}
+
+		if (V.rows() > index)		V(index) = 0;
+	}
+
+	/** Drop the rows of measurements removed by removeMeas(), once the indices of the remaining measurements no longer need to be preserved
+	*/
+	void dropRemoved()
+	{
+		int numMeas = R.rows();
+
+		if	( removed.rows() != numMeas
+			||removed.any() == false)
+		{
+			removed.resize(0);
+			return;
+		}
 
-		for (int i = 0; i < Y.rows(); i++)
+		vector<int> keep;
+		for (int i = 0; i < numMeas; i++)
 		{
-			if (i != index)
+			if (removed(i) == false)
 			{
-				keepIndices.push_back(i);
+				keep.push_back(i);
 			}
 		}
 
-		obsKeys.erase(obsKeys.begin() + index);
+		vector<Triplet<double>> triplets;
+		for (int i = 0; i < keep.size(); i++)
+		for (SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(A, keep[i]); it; ++it)
+		{
+			triplets.push_back({i, (int) it.col(), it.value()});
+		}
+
+		SparseMatrix<double, Eigen::RowMajor> keptA(keep.size(), A.cols());
+		keptA.setFromTriplets(triplets.begin(), triplets.end());
+
+		A = std::move(keptA);
+		R = R(keep).eval();
+
+		if (Y.rows() == numMeas)			Y = Y(keep).eval();
+		if (V.rows() == numMeas)			V = V(keep).eval();
+		if (W.rows() == numMeas)			W = W(keep).eval();
+
+		if (obsKeys.size() == numMeas)
+		{
+			vector<ObsKey> keptKeys;
+			for (int i : keep)		keptKeys.push_back(std::move(obsKeys[i]));
+			obsKeys = std::move(keptKeys);
+		}
+
+		if (metaDataList.size() == numMeas)
+		{
+			vector<MeasMetaData> keptMetaData;
+			for (int i : keep)		keptMetaData.push_back(metaDataList[i]);
+			metaDataList = std::move(keptMetaData);
+		}
 
-		Y = ( Y(keepIndices)             ).eval();
-		V = ( V(keepIndices)             ).eval();
-		R = ( R(keepIndices)             ).eval();
-		A = ( A(keepIndices, Eigen::all) ).eval();
+		removed.resize(0);
+	}
+
+	/** Weights of 1 for measurements in use and 0 for those that have been removed
+	*/
+	ArrayXd usedMask() const
+	{
+		if (removed.rows() != R.rows())		return ArrayXd::Ones(R.rows());
+		else								return (removed == false).cast<double>();
+	}
+
+	/** Number of measurements that have not been removed
+	*/
+	int numUsed() const
+	{
+		if (removed.rows() != R.rows())		return R.rows();
+		else								return R.rows() - removed.count();
 	}
 };
 
@@ -178,6 +266,29 @@ typedef std::ostream		Trace;
 struct KFMeasEntry;
 typedef list<KFMeasEntry>	KFMeasEntryList;
 
+/** Factorised innovation covariance retained between filter iterations,
+* so that changes made to measurements by reject callbacks can be applied as low rank updates rather than refactorising
+*/
+struct KFInnovationFactor
+{
+	bool			valid	= false;	///< Factorisation corresponds to the measurements it was created for
+	LLT<MatrixXd>	llt;				///< Cholesky factorisation of the innovation covariance HPH' + R
+	MatrixXd		Q;					///< Innovation covariance that has been factorised
+	VectorXd		R;					///< Measurement noise used in the factorisation
+	ArrayXd			mask;				///< Measurements that were in use at the time of factorisation
+};
+
+int udFactorise(
+	const MatrixXd&	P,
+	MatrixXd&		U,
+	VectorXd&		D);
+
+int udTransition(
+	SparseMatrix<double, Eigen::RowMajor>&	F,
+	VectorXd&								Q,
+	MatrixXd&								U,
+	VectorXd&								D);
+
 struct KFState;
 
 typedef bool (*RejectCallback)(Trace& trace, KFState& kfState, KFMeas& meas, int index);
@@ -199,8 +310,17 @@ struct KFState
 	MatrixXd	P;										///< State Covariance
 	VectorXd	dx;										///< Last filter update
 
+	MatrixXd	U;										///< Unit upper triangular factor of P = U * D * U', maintained when using the UD inverter
+	VectorXd	D;										///< Diagonal factor of P, maintained when using the UD inverter
+	VectorXd	udDiagonal;								///< Diagonal of P when the UD factors were last updated, to detect changes made to P directly
+
 	map<KFKey, short int>			kfIndexMap;			///< Map from key to indexes of parameters in the state vector
 
+	unordered_map<KFKey, int>		kfHandleMap;		///< Map from key to the integer handle interned for it in this filter
+	vector<KFKey>					kfHandleKeys;		///< Keys that have been interned, indexed by handle
+	vector<short int>				kfHandleIndices;	///< Indexes of parameters in the state vector, indexed by handle (-1 if not in the state)
+	vector<int>						kfFreeHandles;		///< Handles released by keys that have left the state, available for reuse
+
 	map<KFKey, map<KFKey, double>>	stateTransitionMap;
 	map<KFKey, map<KFKey, double>>	rateTransitionMap;
 	map<KFKey, double>				gaussMarkovTauMap;
@@ -216,6 +336,7 @@ struct KFState
 	string		rts_filename			= "";
 	string		rts_forward_filename	= "";
 	int			rts_lag					= 0;
+	bool		rts_spill				= false;		///< Also write the in-memory history of lagged RTS smoothing to the forward archive in the background
 
 	bool		rtsFilterInProgress		= false;
 
@@ -224,7 +345,11 @@ struct KFState
 
 	bool		output_residuals		= false;
 
+	bool		denseTransition			= false;		///< Use a full dense state transition product rather than the sparse version (for testing/benchmarking)
+
 	int			inverter				= E_Inverter::INV;
+	int			chunk_size				= 64;			///< Number of measurements per update when using the CHUNKED inverter
+	bool		incremental_rejection	= false;		///< Apply rejections to the retained factorisation of the innovation covariance rather than refiltering
 
 	KFState()
 	{
@@ -243,6 +368,16 @@ struct KFState
 	int		getKFIndex(
 		KFKey		key);
 
+	int		getKFHandle(
+		const KFKey&	key);
+
+	int		getHandleIndex(
+		int			handle);
+
+	void	updateHandleIndices();
+
+	bool	udFactorsCurrent();
+
 	bool	getKFValue(
 		KFKey		key,
 		double&		value,
@@ -284,11 +419,17 @@ struct KFState
 		KFKey			kfKey,
 		InitialState	initialState = {});
 
+	void	addKFHandle(
+		int				handle,
+		InitialState	initialState = {});
+
 	void	removeState(
 		KFKey kfKey);
 
 	void	clampStateValues();
 
+	map<KFKey, short int> stableStateLayout();
+
 	void	stateTransition(
 		Trace&		trace,
 		GTime		newTime);
@@ -310,6 +451,36 @@ struct KFState
 		MatrixXd&		Pp,
 		VectorXd&		dx);
 
+	int 	kFilterStates(
+		Trace&			trace,
+		KFMeas&			kfMeas,
+		VectorXd&		xp,
+		VectorXd&		dx,
+		MatrixXd&		HP,
+		MatrixXd&		Kt,
+		KFInnovationFactor*	factor_ptr = nullptr);
+
+	bool	kFilterRejections(
+		Trace&				trace,
+		KFMeas&				kfMeas,
+		KFInnovationFactor&	factor,
+		VectorXd&			xp,
+		VectorXd&			dx,
+		MatrixXd&			Kt);
+
+	void	symmetricCovarianceUpdate(
+		MatrixXd&		HP,
+		MatrixXd&		Kt);
+
+	int		kFilterUD(
+		Trace&			trace,
+		KFMeas&			kfMeas,
+		MatrixXd&		U,
+		VectorXd&		D,
+		MatrixXd&		Pp,
+		VectorXd&		xp,
+		VectorXd&		dx);
+
 	bool		chiQC(
 		Trace&		trace,
 		KFMeas&		kfMeas,
@@ -328,6 +499,14 @@ struct KFState
 		KFMeas&			kfMeas,
 		bool			innovReady = false);
 
+	int		filterKalmanUpdate(
+		Trace&			trace,
+		KFMeas&			kfMeas);
+
+	int		filterKalmanChunks(
+		Trace&			trace,
+		KFMeas&			kfMeas);
+
 	int		filterLeastSquares(
 		Trace&			trace,
 		KFMeas&			kfMeas);
@@ -350,6 +529,30 @@ struct KFState
 		KFMeas&			kfMeas);
 };
 
+/** Checks that a measurement noise value is usable, with warnings for unexpected values.
+*/
+inline bool validNoise(
+	double value)		///< [in]	Measurement noise matrix entry value
+{
+	if (value == 0)
+	{
+		std::cout << "Zero noise encountered"	<< std::endl;
+// 		return false;
+	}
+	if 		(std::isinf(value))
+	{
+		std::cout << "Inf noise encountered"	<< std::endl;
+		return false;
+	}
+	else if (std::isnan(value))
+	{
+		std::cout << "Nan noise encountered"	<< std::endl;
+		return false;
+	}
+
+	return true;
+}
+
 /** Object to hold an individual measurement.
 * Includes the measurement itself, (or its innovation) and design matrix entries
 * Adding design matrix entries for states that do not yet exist will create and add new states to the measurement's kalman filter object.
@@ -365,8 +568,9 @@ struct KFMeasEntry
 
 
 
-	map<KFKey, double>		designEntryMap;
-	map<string, void*>		metaDataMap;
+	vector<std::pair<int, double>>	designEntryList;	///< Design matrix entries, by key handle in the filter object
+	map<KFKey, double>				designEntryMap;		///< Design matrix entries for measurements with no filter object
+	MeasMetaData					metaData;
 
 	KFMeasEntry(
 		KFState*	kfState_ptr = nullptr,
@@ -389,32 +593,48 @@ struct KFMeasEntry
 			return;
 		}
 
-		if (kfState_ptr)
+		if (kfState_ptr == nullptr)
 		{
-			kfState_ptr->addKFState(kfKey, initialState);
+			designEntryMap[kfKey] = value;
+			return;
 		}
 
-		designEntryMap[kfKey] = value;
+		addDsgnHandle(kfState_ptr->getKFHandle(kfKey), value, initialState);
 	}
 
-	/** Adds the measurement noise entry for this measurement
+	/** Adds a design matrix entry for this measurement using a key handle previously obtained from the measurement's filter object
 	*/
-	void setNoise(
-		double value)		///< [in]	Measurement noise matrix entry value
+	void addDsgnHandle(
+		int				handle,				///< [in]	Handle of key to determine which state parameter is affected
+		double			value,				///< [in]	Design matrix entry value
+		InitialState	initialState = {})	///< [in]	Initial conditions for new states
 	{
 		if (value == 0)
 		{
-			std::cout << "Zero noise encountered"	<< std::endl;
-// 			return;
+			return;
 		}
-		if 		(std::isinf(value))
+
+		kfState_ptr->addKFHandle(handle, initialState);
+
+		for (auto& [entryHandle, entryValue] : designEntryList)
 		{
-			std::cout << "Inf noise encountered"	<< std::endl;
-			return;
+			if (entryHandle == handle)
+			{
+				entryValue = value;
+				return;
+			}
 		}
-		else if (std::isnan(value))
+
+		designEntryList.push_back({handle, value});
+	}
+
+	/** Adds the measurement noise entry for this measurement
+	*/
+	void setNoise(
+		double value)		///< [in]	Measurement noise matrix entry value
+	{
+		if (validNoise(value) == false)
 		{
-			std::cout << "Nan noise encountered"	<< std::endl;
 			return;
 		}
 
@@ -438,6 +658,158 @@ struct KFMeasEntry
 	}
 };
 
+struct KFMeasBuilder;
+
+/** Reference to a single measurement within a KFMeasBuilder.
+* Has the same interface as a KFMeasEntry, but the measurement is stored in the builder's contiguous lists rather than in its own maps.
+*/
+struct KFMeasRef
+{
+	KFMeasBuilder*	builder_ptr;	///< Builder that holds this measurement
+	int				row;			///< Index of this measurement in the builder
+
+	void addDsgnEntry(
+		KFKey			kfKey,
+		double			value,
+		InitialState	initialState = {});
+
+	void addDsgnHandle(
+		int				handle,
+		double			value,
+		InitialState	initialState = {});
+
+	void setNoise(
+		double value);
+
+	void setValue(
+		double value);
+
+	void setInnov(
+		double value);
+
+	ObsKey&			obsKey();
+	MeasMetaData&	metaData();
+
+	void discard();
+};
+
+/** Object to assemble a set of measurements for a filter with few allocations.
+* Design matrix entries for all measurements are stored as (measurement, key handle, value) triplets in a single list,
+* and values, noises, keys and metadata are stored in parallel lists indexed by measurement,
+* so that no per-measurement maps or linked list nodes are created.
+*/
+struct KFMeasBuilder
+{
+	KFState&					kfState;			///< Filter object that the measurements reference
+
+	vector<Triplet<double>>		dsgnEntries;		///< Design matrix entries as (measurement, key handle, value)
+	vector<double>				values;				///< Value of measurements (for linear systems)
+	vector<double>				noises;				///< Noise of measurements
+	vector<double>				innovs;				///< Innovation of measurements (for non-linear systems)
+	vector<ObsKey>				obsKeys;			///< Optional labels to be used in output traces
+	vector<MeasMetaData>		metaDataList;		///< Optional pointers to objects associated with each measurement
+	vector<bool>				discarded;			///< Measurements that have been discarded after creation
+
+	KFMeasBuilder(
+		KFState&	kfState,				///< [in]	Filter object that the measurements reference
+		int			expectedMeas = 0)		///< [in]	Number of measurements to reserve space for
+	: kfState	(kfState)
+	{
+		values			.reserve(expectedMeas);
+		noises			.reserve(expectedMeas);
+		innovs			.reserve(expectedMeas);
+		obsKeys			.reserve(expectedMeas);
+		metaDataList	.reserve(expectedMeas);
+		discarded		.reserve(expectedMeas);
+		dsgnEntries		.reserve(expectedMeas * 16);
+	}
+
+	/** Creates a new measurement and returns a reference to it
+	*/
+	KFMeasRef addMeas(
+		ObsKey		obsKey = {})	///< [in]	Optional label to be used in output traces
+	{
+		values			.push_back(0);
+		noises			.push_back(0);
+		innovs			.push_back(0);
+		obsKeys			.push_back(obsKey);
+		metaDataList	.push_back({});
+		discarded		.push_back(false);
+
+		return {this, (int) values.size() - 1};
+	}
+
+	KFMeas combine();
+};
+
+inline void KFMeasRef::addDsgnEntry(
+	KFKey			kfKey,				///< [in]	Key to determine which state parameter is affected
+	double			value,				///< [in]	Design matrix entry value
+	InitialState	initialState)		///< [in]	Initial conditions for new states
+{
+	if (value == 0)
+	{
+		return;
+	}
+
+	addDsgnHandle(builder_ptr->kfState.getKFHandle(kfKey), value, initialState);
+}
+
+inline void KFMeasRef::addDsgnHandle(
+	int				handle,				///< [in]	Handle of key to determine which state parameter is affected
+	double			value,				///< [in]	Design matrix entry value
+	InitialState	initialState)		///< [in]	Initial conditions for new states
+{
+	if (value == 0)
+	{
+		return;
+	}
+
+	builder_ptr->kfState.addKFHandle(handle, initialState);
+
+	builder_ptr->dsgnEntries.push_back({row, handle, value});
+}
+
+inline void KFMeasRef::setNoise(
+	double value)		///< [in]	Measurement noise matrix entry value
+{
+	if (validNoise(value) == false)
+	{
+		return;
+	}
+
+	builder_ptr->noises[row] = value;
+}
+
+inline void KFMeasRef::setValue(
+	double value)		///< [in]	Actual measurement entry value
+{
+	builder_ptr->values[row] = value;
+}
+
+inline void KFMeasRef::setInnov(
+	double value)		///< [in]	Innovation entry value
+{
+	builder_ptr->innovs[row] = value;
+}
+
+inline ObsKey& KFMeasRef::obsKey()
+{
+	return builder_ptr->obsKeys[row];
+}
+
+inline MeasMetaData& KFMeasRef::metaData()
+{
+	return builder_ptr->metaDataList[row];
+}
+
+/** Excludes this measurement from the combined measurements, any states it created are retained
+*/
+inline void KFMeasRef::discard()
+{
+	builder_ptr->discarded[row] = true;
+}
+
 KFState mergeFilters(
 	list<KFState*>& kfStatePointerList);
 
@@ -1,10 +1,22 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <mutex>
 #include <map>
 
 using std::map;
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef ENABLE_ZLIB
+#	include <zlib.h>
+#endif
+
 #include "eigenIncluder.hpp"
 
 #include "peaCommitVersion.h"
@@ -20,47 +32,909 @@ using std::map;
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/string.hpp>
 
-/** Returns the type of object that is located at the specified position in a file
+/** Append raw values to a record payload
+*/
+template<typename TYPE>
+void putValues(
+	string&		payload,		///< Payload to append to
+	const TYPE*	values,			///< Pointer to first value
+	size_t		count = 1)		///< Number of values
+{
+	payload.append(reinterpret_cast<const char*>(values), count * sizeof(TYPE));
+}
+
+template<typename TYPE>
+void putValue(
+	string&		payload,		///< Payload to append to
+	TYPE		value)			///< Value to append
+{
+	putValues(payload, &value);
+}
+
+/** Pad a record payload so that the next value is aligned for direct access to doubles
+*/
+void putPadding(
+	string&		payload)		///< Payload to pad
+{
+	payload.resize((payload.size() + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT, 0);
+}
+
+/** Sequential reader of raw values from a record payload
+*/
+struct PayloadCursor
+{
+	const char*	begin;
+	const char*	ptr;
+	const char*	end;
+
+	template<typename TYPE>
+	bool get(
+		TYPE*	values,			///< Destination for values
+		size_t	count = 1)		///< Number of values
+	{
+		size_t bytes = count * sizeof(TYPE);
+		if (ptr + bytes > end)
+		{
+			return false;
+		}
+
+		memcpy(values, ptr, bytes);
+		ptr += bytes;
+		return true;
+	}
+
+	template<typename TYPE>
+	bool get(
+		TYPE&	value)			///< Destination for value
+	{
+		return get(&value, 1);
+	}
+
+	/** Skip a block of values, returning a pointer to its start
+	*/
+	template<typename TYPE>
+	const TYPE* skip(
+		size_t	count)			///< Number of values
+	{
+		size_t bytes = count * sizeof(TYPE);
+		if (ptr + bytes > end)
+		{
+			return nullptr;
+		}
+
+		const TYPE* values = reinterpret_cast<const TYPE*>(ptr);
+		ptr += bytes;
+		return values;
+	}
+
+	/** Skip the padding added by putPadding()
+	*/
+	void align()
+	{
+		ptr = begin + (ptr - begin + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+	}
+};
+
+/** Get the id of the filter in a PERSIST_FILTER payload, leaving the cursor at the filter itself
+*/
+bool getPersistFilterId(
+	PayloadCursor&	cursor,		///< Cursor at the start of the payload
+	string&			id)			///< Id of the filter
+{
+	uint16_t idLength;
+
+	bool pass = cursor.get(idLength);
+	if (pass == false)
+	{
+		return false;
+	}
+
+	id.resize(idLength);
+
+	pass = cursor.get(&id[0], idLength);
+
+	cursor.align();
+
+	return pass;
+}
+
+/** Write a record to an archive stream, compressing its payload if configured
+*/
+void writeArchiveRecord(
+	E_SerialObject	type,			///< Type of object in the payload
+	GTime			time,			///< Time of the object, for indexing
+	string&			payload,		///< Encoded object
+	std::ostream&	fileStream)		///< Archive stream to write to
+{
+	ArchiveRecordHeader header;
+	header.type		= type;
+	header.time		= time.time;
+	header.rawBytes	= payload.size();
+
+	string* stored_ptr = &payload;
+
+#	ifdef ENABLE_ZLIB
+	string compressed;
+	if (acsConfig.rts_compression)
+	{
+		uLongf compressedBytes = compressBound(payload.size());
+		compressed.resize(compressedBytes);
+
+		int result = compress2((Bytef*) &compressed[0], &compressedBytes, (const Bytef*) payload.data(), payload.size(), Z_BEST_SPEED);
+		if	( result			== Z_OK
+			&&compressedBytes	<  payload.size())
+		{
+			compressed.resize(compressedBytes);
+			header.compression	= 1;
+			stored_ptr			= &compressed;
+		}
+	}
+#	endif
+
+	header.storedBytes = stored_ptr->size();
+
+	//pad the stored payload so that every record starts aligned
+	char	padding[ARCHIVE_ALIGNMENT]	= {};
+	int		paddingBytes				= (ARCHIVE_ALIGNMENT - header.storedBytes % ARCHIVE_ALIGNMENT) % ARCHIVE_ALIGNMENT;
+
+	int64_t recordBytes = sizeof(header) + header.storedBytes + paddingBytes + sizeof(recordBytes);
+
+	fileStream.write(reinterpret_cast<const char*>(&header),		sizeof(header));
+	fileStream.write(stored_ptr->data(),							stored_ptr->size());
+	fileStream.write(padding,										paddingBytes);
+	fileStream.write(reinterpret_cast<const char*>(&recordBytes),	sizeof(recordBytes));
+}
+
+/** Write a record to the end of an archive file
+*/
+void writeArchiveRecord(
+	E_SerialObject	type,		///< Type of object in the payload
+	GTime			time,		///< Time of the object, for indexing
+	string&			payload,	///< Encoded object
+	string			filename)	///< Path to archive file
+{
+	std::ofstream fileStream(filename, std::ofstream::binary | std::ofstream::out | std::ofstream::app);
+
+	if (!fileStream)
+	{
+		std::cout << std::endl << "Error opening algebra file " << filename <<  " for writing";
+		return;
+	}
+
+	writeArchiveRecord(type, time, payload, fileStream);
+}
+
+/** Encode the time, keys, states and covariance of a filter into a record payload
+*/
+void encodeFilterPayload(
+	KFState&	kfState,	///< Filter state to encode
+	string&		payload)	///< Payload to append to
+{
+	int32_t numStates	= kfState.x.rows();
+	int32_t numKeys		= kfState.kfIndexMap.size();
+
+	payload.reserve(payload.size() + sizeof(double) * (numStates + numStates * (numStates + 1) / 2) + 32 * numKeys + 32);
+
+	putValue(payload, (int64_t) kfState.time.time);
+	putValue(payload, numStates);
+	putValue(payload, numKeys);
+
+	for (auto& [kfKey, index] : kfState.kfIndexMap)
+	{
+		putValue(payload, (int16_t) index);
+		putValue(payload, (int16_t) kfKey.type);
+		putValue(payload, (int16_t) kfKey.num);
+		putValue(payload, (int16_t) kfKey.Sat.sys);
+		putValue(payload, (int16_t) kfKey.Sat.prn);
+		putValue(payload, (uint16_t) kfKey.str.size());
+		putValues(payload, kfKey.str.data(), kfKey.str.size());
+	}
+
+	putPadding(payload);
+
+	putValues(payload, kfState.x.data(), numStates);
+
+	//the lower part of each column is contiguous, so the packed triangle is written a column at a time
+	for (int col = 0; col < numStates; col++)
+	{
+		putValues(payload, &kfState.P(col, col), numStates - col);
+	}
+}
+
+/** Output filter state to an archive for later reading
+*/
+void spitFilterToFile(
+	KFState&		kfState,	///< Filter state to output
+	E_SerialObject	type,		///< Type of object
+	string			filename)	///< Path to file to output to
+{
+	string payload;
+	encodeFilterPayload(kfState, payload);
+
+	writeArchiveRecord(type, kfState.time, payload, filename);
+}
+
+/** Output filter state to an open archive stream, for writing many records without reopening the file
+*/
+void spitFilterToFile(
+	KFState&		kfState,		///< Filter state to output
+	E_SerialObject	type,			///< Type of object
+	std::ofstream&	fileStream)		///< Archive stream to output to
+{
+	string payload;
+	encodeFilterPayload(kfState, payload);
+
+	writeArchiveRecord(type, kfState.time, payload, fileStream);
+}
+
+/** Output a state transition matrix to an archive for later reading
+*/
+void spitFilterToFile(
+	TransitionMatrixObject&	transitionMatrixObject,		///< Transition matrix to output
+	E_SerialObject			type,						///< Type of object
+	string					filename)					///< Path to file to output to
+{
+	int32_t numEntries = transitionMatrixObject.forwardTransitionMap.size();
+
+	vector<int32_t>	rows;		rows	.reserve(numEntries);
+	vector<int32_t>	cols;		cols	.reserve(numEntries);
+	vector<double>	values;		values	.reserve(numEntries);
+
+	for (auto& [keyPair, value] : transitionMatrixObject.forwardTransitionMap)
+	{
+		rows	.push_back(keyPair.first);
+		cols	.push_back(keyPair.second);
+		values	.push_back(value);
+	}
+
+	string payload;
+
+	putValue (payload, (int32_t) transitionMatrixObject.rows);
+	putValue (payload, (int32_t) transitionMatrixObject.cols);
+	putValue (payload, numEntries);
+	putValues(payload, rows		.data(),	numEntries);
+	putValues(payload, cols		.data(),	numEntries);
+	putPadding(payload);
+	putValues(payload, values	.data(),	numEntries);
+
+	writeArchiveRecord(type, GTime::noTime(), payload, filename);
+}
+
+/** Get the lower part of a column of the covariance matrix, starting at its diagonal
+*/
+Eigen::Map<const VectorXd> FilterRecordView::lowerColumn(
+	int		col)	///< Column of the covariance matrix
+	const
+{
+	long int start = (long int) col * numStates - (long int) col * (col - 1) / 2;
+
+	return Eigen::Map<const VectorXd>(packedP + start, numStates - col);
+}
+
+/** Copy a viewed filter record into a filter state (time, x, P, and kfIndexMap)
+*/
+bool FilterRecordView::copyTo(
+	KFState&	kfState)	///< Filter state to populate
+	const
+{
+	kfState.time = time;
+	kfState.kfIndexMap.clear();
+
+	PayloadCursor cursor = {keyTable, keyTable, keyTableEnd};
+
+	for (int i = 0; i < numKeys; i++)
+	{
+		int16_t		index		= 0;
+		int16_t		type		= 0;
+		int16_t		num			= 0;
+		int16_t		sys			= 0;
+		int16_t		prn			= 0;
+		uint16_t	strLength	= 0;
+
+		bool pass	= cursor.get(index)
+					&&cursor.get(type)
+					&&cursor.get(num)
+					&&cursor.get(sys)
+					&&cursor.get(prn)
+					&&cursor.get(strLength);
+
+		if	( pass == false
+			||E_Sys::_is_valid(sys) == false)
+		{
+			return false;
+		}
+
+		KFKey kfKey;
+		kfKey.type		= type;
+		kfKey.num		= num;
+		kfKey.Sat.sys	= E_Sys::_from_integral(sys);
+		kfKey.Sat.prn	= prn;
+		kfKey.str.resize(strLength);
+
+		pass = cursor.get(&kfKey.str[0], strLength);
+
+		if (pass == false)
+		{
+			return false;
+		}
+
+		kfState.kfIndexMap[kfKey] = index;
+	}
+
+	kfState.x = xMap();
+	kfState.P.resize(numStates, numStates);
+
+	for (int col = 0; col < numStates; col++)
+	{
+		kfState.P.col(col).tail(numStates - col) = lowerColumn(col);
+	}
+
+	kfState.P.triangularView<Eigen::StrictlyUpper>() = kfState.P.transpose();
+
+	return true;
+}
+
+FilterArchiveReader::~FilterArchiveReader()
+{
+	close();
+}
+
+/** Release the mapping of the archive
+*/
+void FilterArchiveReader::close()
+{
+	if (data)
+	{
+		munmap((void*) data, size);
+	}
+
+	data		= nullptr;
+	size		= 0;
+	finalised	= false;
+	index.clear();
+}
+
+/** Get the header of the record at a position in a mapped archive
+*/
+bool getArchiveHeader(
+	FilterArchiveReader&	reader,		///< Reader of the archive
+	long int				offset,		///< Position of the record
+	ArchiveRecordHeader&	header)		///< Header to populate
+{
+	if	( offset < 0
+		||offset + sizeof(header) > reader.size)
+	{
+		std::cout << std::endl << "Error: Invalid algebra file record at " << offset;
+		return false;
+	}
+
+	memcpy(&header, reader.data + offset, sizeof(header));
+
+	if (memcmp(header.magic, ArchiveRecordHeader().magic, sizeof(header.magic)) != 0)
+	{
+		std::cout << std::endl << "Error: Invalid algebra file record at " << offset;
+		return false;
+	}
+
+	return true;
+}
+
+/** Get the payload of the record at a position in a mapped archive, directly from the mapping, or decompressed into scratch space
+*/
+bool getArchivePayload(
+	FilterArchiveReader&	reader,		///< Reader of the archive
+	long int				offset,		///< Position of the record
+	PayloadCursor&			cursor)		///< Cursor to position at the start of the payload
+{
+	ArchiveRecordHeader recordHeader;
+	bool pass = getArchiveHeader(reader, offset, recordHeader);
+	if (pass == false)
+	{
+		return false;
+	}
+
+	const char* stored = reader.data + offset + sizeof(recordHeader);
+
+	if (stored + recordHeader.storedBytes > reader.data + reader.size)
+	{
+		std::cout << std::endl << "Error: Truncated algebra file record at " << offset;
+		return false;
+	}
+
+	if (recordHeader.compression == 0)
+	{
+		cursor = {stored, stored, stored + recordHeader.storedBytes};
+		return true;
+	}
+
+#	ifdef ENABLE_ZLIB
+	if (recordHeader.compression == 1)
+	{
+		auto& scratch = reader.scratch;
+		scratch.resize(recordHeader.rawBytes);
+
+		uLongf rawBytes = recordHeader.rawBytes;
+		int result = uncompress((Bytef*) &scratch[0], &rawBytes, (const Bytef*) stored, recordHeader.storedBytes);
+		if	( result	!= Z_OK
+			||rawBytes	!= recordHeader.rawBytes)
+		{
+			std::cout << std::endl << "Error: Failed to decompress algebra file record at " << offset;
+			return false;
+		}
+
+		cursor = {scratch.data(), scratch.data(), scratch.data() + scratch.size()};
+		return true;
+	}
+#	endif
+
+	std::cout << std::endl << "Error: Unsupported algebra file compression " << (int) recordHeader.compression;
+	return false;
+}
+
+/** Map an archive and load or build its index
+*/
+bool FilterArchiveReader::open(
+	string		filename,	///< Path to archive file
+	bool		recover)	///< Index by walking forwards from the start, ignoring any partially written record at the end
+{
+	close();
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	if (fileStat.st_size == 0)
+	{
+		//nothing has been recorded yet
+		::close(fd);
+		return true;
+	}
+
+	void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (mapping == MAP_FAILED)
+	{
+		std::cout << std::endl << "Error mapping algebra file " << filename;
+		return false;
+	}
+
+	data	= (const char*) mapping;
+	size	= fileStat.st_size;
+
+	if (recover)
+	{
+		//an interrupted writer may leave an incomplete record at the end, keep everything before it
+		long int pos = 0;
+		while (pos + sizeof(ArchiveRecordHeader) <= size)
+		{
+			ArchiveRecordHeader recordHeader;
+			memcpy(&recordHeader, data + pos, sizeof(recordHeader));
+
+			if	( memcmp(recordHeader.magic, ArchiveRecordHeader().magic, sizeof(recordHeader.magic)) != 0
+				||recordHeader.storedBytes > size)
+			{
+				break;
+			}
+
+			int64_t recordBytes	= sizeof(recordHeader)
+								+ (recordHeader.storedBytes + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT
+								+ sizeof(recordBytes);
+
+			int64_t trailerBytes = 0;
+			if (pos + recordBytes <= (long int) size)
+			{
+				memcpy(&trailerBytes, data + pos + recordBytes - sizeof(trailerBytes), sizeof(trailerBytes));
+			}
+
+			if (trailerBytes != recordBytes)
+			{
+				break;
+			}
+
+			ArchiveIndexEntry entry;
+			entry.offset	= pos;
+			entry.type		= E_SerialObject::_from_integral(recordHeader.type);
+			entry.time.time	= recordHeader.time;
+
+			if (entry.type != +E_SerialObject::ARCHIVE_INDEX)
+			{
+				index.push_back(entry);
+			}
+
+			pos += recordBytes;
+		}
+
+		if (pos < (long int) size)
+		{
+			std::cout << std::endl << "Warning: Ignoring incomplete records at end of " << filename;
+		}
+
+		return true;
+	}
+
+	//walk backwards until the start of the archive, or an index covering all preceding records
+	vector<ArchiveIndexEntry> reversed;
+	long int pos = size;
+	while (pos > 0)
+	{
+		int64_t recordBytes = 0;
+		if (pos >= (long int) sizeof(recordBytes))
+		{
+			memcpy(&recordBytes, data + pos - sizeof(recordBytes), sizeof(recordBytes));
+		}
+
+		long int offset = pos - recordBytes;
+		if	( recordBytes	< (int64_t) (sizeof(ArchiveRecordHeader) + sizeof(recordBytes))
+			||offset		< 0)
+		{
+			std::cout << std::endl << "Error: Corrupt algebra file " << filename;
+			close();
+			return false;
+		}
+
+		ArchiveRecordHeader recordHeader;
+		bool pass = getArchiveHeader(*this, offset, recordHeader);
+		if (pass == false)
+		{
+			close();
+			return false;
+		}
+
+		ArchiveIndexEntry entry;
+		entry.offset	= offset;
+		entry.type		= E_SerialObject::_from_integral(recordHeader.type);
+		entry.time.time	= recordHeader.time;
+
+		if (entry.type == +E_SerialObject::ARCHIVE_INDEX)
+		{
+			PayloadCursor cursor;
+			int64_t numEntries = 0;
+
+			pass	= getArchivePayload(*this, offset, cursor)
+					&&cursor.get(numEntries);
+
+			for (int i = 0; i < numEntries && pass; i++)
+			{
+				int64_t entryOffset	= 0;
+				int32_t entryType	= 0;
+				int64_t entryTime	= 0;
+
+				pass	= cursor.get(entryOffset)
+						&&cursor.get(entryType)
+						&&cursor.get(entryTime)
+						&&E_SerialObject::_is_valid(entryType);
+
+				if (pass == false)
+				{
+					break;
+				}
+
+				ArchiveIndexEntry indexEntry;
+				indexEntry.offset		= entryOffset;
+				indexEntry.type			= E_SerialObject::_from_integral(entryType);
+				indexEntry.time.time	= entryTime;
+
+				index.push_back(indexEntry);
+			}
+
+			if (pass == false)
+			{
+				std::cout << std::endl << "Error: Corrupt algebra file index in " << filename;
+				close();
+				return false;
+			}
+
+			if (reversed.empty())
+			{
+				finalised = true;
+			}
+
+			break;
+		}
+
+		reversed.push_back(entry);
+
+		pos = offset;
+	}
+
+	index.insert(index.end(), reversed.rbegin(), reversed.rend());
+
+	return true;
+}
+
+/** Get a view of the i'th record of the archive, which must be a FILTER_MINUS, FILTER_PLUS, or PERSIST_FILTER.
+* The view refers directly to the mapped archive unless the record is compressed, and is valid until the next record is read or viewed
+*/
+bool FilterArchiveReader::view(
+	int					i,			///< Index of the record in the archive
+	FilterRecordView&	view)		///< View to populate
+{
+	PayloadCursor cursor;
+	int64_t	time;
+	int32_t	numStates;
+	int32_t	numKeys;
+	string	id;
+
+	bool pass	= getArchivePayload(*this, index[i].offset, cursor);
+
+	if (index[i].type == +E_SerialObject::PERSIST_FILTER)
+	{
+		pass &= getPersistFilterId(cursor, id);
+	}
+
+	pass		= pass
+				&&cursor.get(time)
+				&&cursor.get(numStates)
+				&&cursor.get(numKeys);
+
+	if (pass == false)
+	{
+		return false;
+	}
+
+	view.time.time	= time;
+	view.numStates	= numStates;
+	view.numKeys	= numKeys;
+	view.keyTable	= cursor.ptr;
+
+	//the key table has variable length entries, find its end to locate the aligned blocks that follow
+	for (int key = 0; key < numKeys; key++)
+	{
+		uint16_t strLength;
+
+		pass	= cursor.skip<int16_t>(5)
+				&&cursor.get(strLength)
+				&&cursor.skip<char>(strLength);
+
+		if (pass == false)
+		{
+			return false;
+		}
+	}
+
+	view.keyTableEnd = cursor.ptr;
+
+	cursor.align();
+
+	view.x			= cursor.skip<double>(numStates);
+	view.packedP	= cursor.skip<double>((long int) numStates * (numStates + 1) / 2);
+
+	return	( view.x		!= nullptr
+			&&view.packedP	!= nullptr);
+}
+
+/** Read the i'th record of the archive into a filter state
+*/
+bool FilterArchiveReader::read(
+	int			i,			///< Index of the record in the archive
+	KFState&	kfState)	///< Filter state to populate (time, x, P and kfIndexMap)
+{
+	FilterRecordView filterView;
+
+	return	( view(i, filterView)
+			&&filterView.copyTo(kfState));
+}
+
+/** Read the i'th record of the archive into a transition matrix
+*/
+bool FilterArchiveReader::read(
+	int						i,							///< Index of the record in the archive
+	TransitionMatrixObject&	transitionMatrixObject)		///< Transition matrix to populate
+{
+	PayloadCursor cursor;
+	int32_t rows;
+	int32_t cols;
+	int32_t numEntries;
+
+	bool pass	= getArchivePayload(*this, index[i].offset, cursor)
+				&&cursor.get(rows)
+				&&cursor.get(cols)
+				&&cursor.get(numEntries);
+
+	if (pass == false)
+	{
+		return false;
+	}
+
+	const int32_t*	entryRows	= cursor.skip<int32_t>(numEntries);
+	const int32_t*	entryCols	= cursor.skip<int32_t>(numEntries);
+	cursor.align();
+	const double*	entryValues	= cursor.skip<double>(numEntries);
+
+	if	( entryRows		== nullptr
+		||entryCols		== nullptr
+		||entryValues	== nullptr)
+	{
+		return false;
+	}
+
+	transitionMatrixObject.rows = rows;
+	transitionMatrixObject.cols = cols;
+	transitionMatrixObject.forwardTransitionMap.clear();
+
+	for (int entry = 0; entry < numEntries; entry++)
+	{
+		transitionMatrixObject.forwardTransitionMap[{entryRows[entry], entryCols[entry]}] = entryValues[entry];
+	}
+
+	return true;
+}
+
+/** Read the i'th record of the archive
+*/
+bool FilterArchiveReader::read(
+	int			i,			///< Index of the record in the archive
+	RTSRecord&	record)		///< Record to populate
+{
+	record.type = index[i].type;
+
+	switch (record.type)
+	{
+		case E_SerialObject::TRANSITION_MATRIX:	return read(i, record.transitionMatrixObject);
+		case E_SerialObject::FILTER_MINUS:		//fallthrough
+		case E_SerialObject::FILTER_PLUS:		return read(i, record.kfState);
+		default:
+		{
+			std::cout << std::endl << "Error: Unexpected algebra file object type";
+			return false;
+		}
+	}
+}
+
+/** Append an index of all records to the end of an archive, so that later readers need not walk through it
+*/
+void finaliseFilterArchive(
+	string		filename)	///< Path to archive file
+{
+	vector<ArchiveIndexEntry> index;
+	{
+		FilterArchiveReader reader;
+		bool pass = reader.open(filename);
+		if	( pass == false
+			||reader.finalised
+			||reader.index.empty())
+		{
+			return;
+		}
+
+		index = reader.index;
+	}
+
+	string payload;
+	putValue(payload, (int64_t) index.size());
+
+	for (auto& entry : index)
+	{
+		putValue(payload, (int64_t) entry.offset);
+		putValue(payload, (int32_t) entry.type);
+		putValue(payload, (int64_t) entry.time.time);
+	}
+
+	writeArchiveRecord(E_SerialObject::ARCHIVE_INDEX, GTime::noTime(), payload, filename);
+}
+
+map<string, RTSRingBuffer>	rtsRingBufferMap;
+std::mutex					rtsRingBufferMutex;
+
+/** Returns the in-memory history of a filter that is smoothed with a finite lag, or nullptr if its history is kept in the forward archive
+*/
+RTSRingBuffer* getRTSRingBuffer(
+	KFState&	kfState)	///< Filter to get the history of
+{
+	if (kfState.rts_lag <= 0)
+	{
+		return nullptr;
+	}
+
+	//filters for different stations may be recording concurrently, only the map itself needs protection
+	std::lock_guard<std::mutex> guard(rtsRingBufferMutex);
+
+	return &rtsRingBufferMap[kfState.rts_forward_filename];
+}
+
+/** Adds a record to the in-memory history of a filter, discarding the oldest epochs once more than rts_lag are held
+*/
+void pushRTSRecord(
+	KFState&		kfState,		///< Filter the record belongs to
+	RTSRingBuffer&	ringBuffer,		///< History to add the record to
+	RTSRecord&&		record)			///< Record to add
+{
+	if (kfState.rts_spill)
+	{
+		//only one write is outstanding at a time, so the archive remains in order
+		if (ringBuffer.spill.valid())
+		{
+			ringBuffer.spill.wait();
+		}
+
+		ringBuffer.spill = std::async(std::launch::async, [spillRecord = record, filename = kfState.rts_forward_filename]() mutable
+		{
+			if (spillRecord.type == +E_SerialObject::TRANSITION_MATRIX)	spitFilterToFile(spillRecord.transitionMatrixObject,	spillRecord.type, filename);
+			else														spitFilterToFile(spillRecord.kfState,					spillRecord.type, filename);
+		});
+	}
+
+	if (record.type == +E_SerialObject::FILTER_PLUS)
+	{
+		ringBuffer.plusCount++;
+	}
+
+	ringBuffer.records.push_back(std::move(record));
+
+	if (ringBuffer.plusCount <= kfState.rts_lag)
+	{
+		return;
+	}
+
+	//drop whole epochs so that the oldest record held is the FILTER_PLUS of the oldest epoch to be smoothed
+	while (ringBuffer.plusCount > kfState.rts_lag)
+	{
+		if (ringBuffer.records.front().type == +E_SerialObject::FILTER_PLUS)
+		{
+			ringBuffer.plusCount--;
+		}
+
+		ringBuffer.records.pop_front();
+	}
+
+	while (ringBuffer.records.front().type != +E_SerialObject::FILTER_PLUS)
+	{
+		ringBuffer.records.pop_front();
+	}
+}
+
+/** Records the state of a filter for RTS smoothing.
+* Filters with a finite lag keep their history in memory, others append it to the forward archive
 */
-E_SerialObject getFilterTypeFromFile(
-	long int& startPos,	///< Position of object
-	string filename)	///< Path to archive file
+void spitFilterToRTS(
+	KFState&		kfState,	///< Filter to record
+	E_SerialObject	type)		///< Type of object (FILTER_MINUS or FILTER_PLUS)
 {
-	std::fstream fileStream(filename, std::ifstream::binary | std::ifstream::in);
-
-	if (!fileStream)
+	RTSRingBuffer* ringBuffer_ptr = getRTSRingBuffer(kfState);
+	if (ringBuffer_ptr == nullptr)
 	{
-		return E_SerialObject::NONE;
+		spitFilterToFile(kfState, type, kfState.rts_forward_filename);
+		return;
 	}
 
-	binary_iarchive serial(fileStream, 1); //no header
-
-	long int itemDelta;
+	RTSRecord record;
+	record.type					= type;
+	record.kfState.time			= kfState.time;
+	record.kfState.x			= kfState.x;
+	record.kfState.P			= kfState.P;
+	record.kfState.kfIndexMap	= kfState.kfIndexMap;
 
-	fileStream.seekg (0, fileStream.end);
-	long int fileSize = fileStream.tellg();
-
-	if (startPos < 0)	{	fileStream.seekg(			-sizeof(itemDelta),	fileStream.end);	}
-	else				{	fileStream.seekg(startPos	-sizeof(itemDelta),	fileStream.beg);	}
+	pushRTSRecord(kfState, *ringBuffer_ptr, std::move(record));
+}
 
-	long int currentPosition = fileStream.tellg();
-	if	( (currentPosition >= fileSize)
-		||(currentPosition <  0))
+/** Records the state transition matrix of a filter for RTS smoothing
+*/
+void spitFilterToRTS(
+	KFState&				kfState,					///< Filter the transition belongs to
+	TransitionMatrixObject&	transitionMatrixObject)		///< Transition matrix to record
+{
+	RTSRingBuffer* ringBuffer_ptr = getRTSRingBuffer(kfState);
+	if (ringBuffer_ptr == nullptr)
 	{
-		return E_SerialObject::NONE;
+		spitFilterToFile(transitionMatrixObject, E_SerialObject::TRANSITION_MATRIX, kfState.rts_forward_filename);
+		return;
 	}
 
-	serialize(serial, itemDelta);
-
-	long int itemPosition = currentPosition - itemDelta;
-
-	fileStream.seekg(itemPosition, fileStream.beg);
-
-	int type_int;
-	serialize(serial, type_int);
-	E_SerialObject type = E_SerialObject::_from_integral(type_int);
+	RTSRecord record;
+	record.type						= E_SerialObject::TRANSITION_MATRIX;
+	record.transitionMatrixObject	= transitionMatrixObject;
 
-	return type;
+	pushRTSRecord(kfState, *ringBuffer_ptr, std::move(record));
 }
 
 /** Initialises the outputs for input/output of filter states during (re)processing
@@ -78,102 +952,567 @@ void initFilterTrace(
 	//remove logtime from forward file.
 	replaceString(kfState.rts_forward_filename, "<LOGTIME>", "");
 
+	RTSRingBuffer* ringBuffer_ptr = getRTSRingBuffer(kfState);
+	if (ringBuffer_ptr)
+	{
+		if (ringBuffer_ptr->spill.valid())
+		{
+			ringBuffer_ptr->spill.wait();
+		}
+
+		ringBuffer_ptr->records.clear();
+		ringBuffer_ptr->plusCount = 0;
+	}
+
 	std::ofstream ofs1(kfState.rts_forward_filename,			std::ofstream::out | std::ofstream::trunc);
 }
 
 
-void outputPersistanceNav()
+
+/** Kinds of SSR corrections in PERSIST_SSR records
+*/
+BETTER_ENUM(E_PersistSSR,	int,
+			CODE_BIAS,
+			PHASE_BIAS,
+			CLOCK,
+			EPHEMERIS,
+			HR_CLOCK,
+			URA
+)
+
+/** Record of what has been written to the persistance files, so that journal entries only contain changes
+*/
+struct PersistanceState
 {
-	string navFilename = acsConfig.persistance_filename + "_nav";
+	bool						started			= false;	///< Files have been reset or loaded for this run
+	long int					sequence		= 0;		///< Sequence number of the most recent epoch persisted
+	int							journalEpochs	= 0;		///< Number of epochs in the journal since the last snapshot
+	map<int, long int>			ephAddedMap;				///< Number of ephemerides added to the store of each satellite when it was last persisted
+	map<pair<int, int>, GTime>	ssrTimeMap;					///< Time of the newest correction persisted for each satellite and kind of SSR
+};
 
-	std::fstream fileStream(navFilename, std::ifstream::binary | std::ifstream::out | std::ifstream::app);
+PersistanceState persistanceState;
 
-	if (!fileStream)
+/** Records of persistance files that are current, in the order they should be applied
+*/
+struct PersistedRecords
+{
+	vector<pair<FilterArchiveReader*, int>>			navRecords;		///< All ephemeris and SSR records
+	map<string, pair<FilterArchiveReader*, int>>	filterRecords;	///< Most recent record of each filter
+	long int										sequence = 0;	///< Sequence number of the last complete epoch
+};
+
+template<typename TYPE>
+void putSSR(
+	string&		payload,		///< Payload to append to
+	const TYPE&	ssr)			///< Correction to append
+{
+	putValue(payload, ssr);
+}
+
+template<typename TYPE>
+bool getSSR(
+	PayloadCursor&	cursor,		///< Cursor to read from
+	TYPE&			ssr)		///< Correction to populate
+{
+	return cursor.get(ssr);
+}
+
+template<typename KEY, typename TYPE>
+void putMap(
+	string&					payload,	///< Payload to append to
+	const map<KEY, TYPE>&	mapItem)	///< Map of plain values to append
+{
+	putValue(payload, (int32_t) mapItem.size());
+
+	for (auto& [key, value] : mapItem)
 	{
-		std::cout << std::endl << "Error opening persistance file " << navFilename <<  " for writing";
-		return;
+		putValue(payload, (int32_t) key);
+		putValue(payload, value);
+	}
+}
+
+template<typename TYPE>
+bool getMap(
+	PayloadCursor&			cursor,		///< Cursor to read from
+	map<E_ObsCode, TYPE>&	mapItem)	///< Map to populate
+{
+	int32_t num = 0;
+	bool pass = cursor.get(num);
+
+	for (int i = 0; i < num && pass; i++)
+	{
+		int32_t	key = 0;
+		TYPE	value;
+
+		pass	= cursor.get(key)
+				&&cursor.get(value)
+				&&E_ObsCode::_is_valid(key);
+
+		if (pass == false)
+		{
+			break;
+		}
+
+		mapItem[E_ObsCode::_from_integral(key)] = value;
 	}
 
-	binary_oarchive serial(fileStream, 1);	//no header
+	return pass;
+}
+
+void putSSR(
+	string&			payload,
+	const SSRBias&	ssr)
+{
+	putValue(payload, ssr.ssrMeta);
+	putValue(payload, ssr.t0);
+	putValue(payload, ssr.udi);
+	putValue(payload, ssr.iod);
+	putMap	(payload, ssr.bias);
+	putMap	(payload, ssr.var);
+}
 
-	serialize(serial, nav);
+bool getSSR(
+	PayloadCursor&	cursor,
+	SSRBias&		ssr)
+{
+	return	( cursor.get(ssr.ssrMeta)
+			&&cursor.get(ssr.t0)
+			&&cursor.get(ssr.udi)
+			&&cursor.get(ssr.iod)
+			&&getMap	(cursor, ssr.bias)
+			&&getMap	(cursor, ssr.var));
 }
 
-void inputPersistanceNav()
+void putSSR(
+	string&				payload,
+	const SSRCodeBias&	ssr)
 {
-	string navFilename = acsConfig.persistance_filename + "_nav";
+	putSSR(payload, (const SSRBias&) ssr);
+}
 
-	std::fstream fileStream(navFilename, std::ifstream::binary | std::ifstream::in);
+bool getSSR(
+	PayloadCursor&	cursor,
+	SSRCodeBias&	ssr)
+{
+	return getSSR(cursor, (SSRBias&) ssr);
+}
 
-	if (!fileStream)
+void putSSR(
+	string&				payload,
+	const SSRPhasBias&	ssr)
+{
+	putSSR	(payload, (const SSRBias&) ssr);
+	putValue(payload, ssr.ssrPhase);
+	putMap	(payload, ssr.ssrPhaseChs);
+}
+
+bool getSSR(
+	PayloadCursor&	cursor,
+	SSRPhasBias&	ssr)
+{
+	return	( getSSR	(cursor, (SSRBias&) ssr)
+			&&cursor.get(ssr.ssrPhase)
+			&&getMap	(cursor, ssr.ssrPhaseChs));
+}
+
+/** Append the corrections of one kind for a satellite that are newer than those already persisted
+*/
+template<typename TYPE>
+void putSSREntries(
+	string&									entries,		///< Encoded entries to append to
+	int64_t&								numEntries,		///< Number of entries encoded
+	int										sat,			///< Satellite the corrections belong to
+	E_PersistSSR							kind,			///< Kind of correction
+	SSRStore<TYPE>&							ssrStore,		///< Corrections to append
+	bool									all)			///< Append all corrections, not only those that are new
+{
+	if (ssrStore.empty())
 	{
-		std::cout << std::endl << "Error opening persistance file " << navFilename <<  " for input";
 		return;
 	}
 
-	binary_iarchive serial(fileStream, 1); //no header
+	auto it = persistanceState.ssrTimeMap.find({sat, kind});
+
+	//newest first, stopping at those already persisted
+	for (auto entryIt = ssrStore.end(); entryIt != ssrStore.begin(); )
+	{
+		entryIt--;
+		auto& [time, ssr] = *entryIt;
+
+		if	( all == false
+			&&it != persistanceState.ssrTimeMap.end()
+			&&(time > it->second) == false)
+		{
+			break;
+		}
+
+		putValue(entries, (int32_t) sat);
+		putValue(entries, (int32_t) kind);
+		putValue(entries, time);
+		putSSR	(entries, ssr);
+
+		numEntries++;
+	}
+
+	persistanceState.ssrTimeMap[{sat, kind}] = std::prev(ssrStore.end())->first;
+}
+
+/** Read a persisted correction and insert it into its store
+*/
+template<typename TYPE>
+bool getSSREntry(
+	PayloadCursor&		cursor,		///< Cursor to read the correction from
+	GTime				time,		///< Time the correction is indexed by
+	SSRStore<TYPE>&		ssrStore)	///< Store to insert the correction into
+{
+	TYPE ssr;
+	bool pass = getSSR(cursor, ssr);
+	if (pass)
+	{
+		ssrStore.insert(time, ssr);
+	}
 
-	serialize(serial, nav);
+	return pass;
 }
 
-void outputPersistanceStates(
-	map<string, Station>&	stationMap,
-	KFState&				netKFState)
+/** Write the ephemerides and SSR corrections that have not yet been persisted
+*/
+void writePersistNav(
+	std::ostream&	fileStream,		///< Stream to write records to
+	GTime			time,			///< Time of the epoch
+	bool			all)			///< Write all navigation data, not only that which is new
 {
-	string stateFilename	= acsConfig.persistance_filename + "_states";
+	{
+		vector<Eph*> newEphs;
+
+		for (auto& [sat, ephStore] : nav.ephMap)
+		{
+			long int& numPersisted = persistanceState.ephAddedMap[sat];
+			if (all)
+			{
+				numPersisted = 0;
+			}
+
+			for (auto& [toe, entry] : ephStore.entryMap)
+			{
+				if (entry.added >= numPersisted)
+				{
+					newEphs.push_back(&entry.eph);
+				}
+			}
 
-	std::fstream fileStream(stateFilename, std::ifstream::binary | std::ifstream::out | std::ifstream::app);
+			numPersisted = ephStore.numAdded;
+		}
 
-	if (!fileStream)
+		if (newEphs.empty() == false)
+		{
+			string payload;
+			putValue(payload, (int64_t) newEphs.size());
+
+			for (auto& eph_ptr : newEphs)
+			{
+				putValue(payload, *eph_ptr);
+			}
+
+			writeArchiveRecord(E_SerialObject::PERSIST_EPHEMERIS, time, payload, fileStream);
+		}
+	}
+
+	{
+		string	entries;
+		int64_t	numEntries = 0;
+
+		for (auto& [sat, satNav] : nav.satNavMap)
+		{
+			auto& ssr = satNav.ssr;
+
+			putSSREntries(entries, numEntries, sat, E_PersistSSR::CODE_BIAS,	ssr.ssrCodeBias_map,	all);
+			putSSREntries(entries, numEntries, sat, E_PersistSSR::PHASE_BIAS,	ssr.ssrPhasBias_map,	all);
+			putSSREntries(entries, numEntries, sat, E_PersistSSR::CLOCK,		ssr.ssrClk_map,			all);
+			putSSREntries(entries, numEntries, sat, E_PersistSSR::EPHEMERIS,	ssr.ssrEph_map,			all);
+			putSSREntries(entries, numEntries, sat, E_PersistSSR::HR_CLOCK,		ssr.ssrHRClk_map,		all);
+			putSSREntries(entries, numEntries, sat, E_PersistSSR::URA,			ssr.ssrUra_map,			all);
+		}
+
+		if (numEntries > 0)
+		{
+			string payload;
+			putValue(payload, numEntries);
+			payload += entries;
+
+			writeArchiveRecord(E_SerialObject::PERSIST_SSR, time, payload, fileStream);
+		}
+	}
+}
+
+/** Write the state of a filter to a persistance file
+*/
+void writePersistFilter(
+	std::ostream&	fileStream,		///< Stream to write record to
+	const string&	id,				///< Id of the filter
+	KFState&		kfState)		///< Filter to write
+{
+	string payload;
+	putValue	(payload, (uint16_t) id.size());
+	putValues	(payload, id.data(), id.size());
+	putPadding	(payload);
+
+	encodeFilterPayload(kfState, payload);
+
+	writeArchiveRecord(E_SerialObject::PERSIST_FILTER, kfState.time, payload, fileStream);
+}
+
+/** Write the record that marks the end of a complete epoch in a persistance file
+*/
+void writePersistEpoch(
+	std::ostream&	fileStream,		///< Stream to write record to
+	GTime			time,			///< Time of the epoch
+	long int		sequence)		///< Sequence number of the epoch
+{
+	string payload;
+	putValue(payload, (int64_t) sequence);
+
+	writeArchiveRecord(E_SerialObject::PERSIST_EPOCH, time, payload, fileStream);
+}
+
+/** Copy a record from a mapped archive to another without decoding it
+*/
+void copyArchiveRecord(
+	FilterArchiveReader&	reader,		///< Reader of the source archive
+	int						i,			///< Index of the record in the source archive
+	std::ostream&			fileStream)	///< Stream to copy the record to
+{
+	ArchiveRecordHeader header;
+	bool pass = getArchiveHeader(reader, reader.index[i].offset, header);
+	if (pass == false)
 	{
-		std::cout << std::endl << "Error opening persistance file " << stateFilename <<  " for writing";
 		return;
 	}
 
-	binary_oarchive serial(fileStream, 1);	//no header
+	long int recordBytes	= sizeof(header)
+							+ (header.storedBytes + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT
+							+ sizeof(int64_t);
 
-	serialize(serial, netKFState);
+	fileStream.write(reader.data + reader.index[i].offset, recordBytes);
+}
 
-	int stationMapSize = stationMap.size();
-	serialize(serial, stationMapSize);
+/** Collect the records of a persistance file that belong to complete epochs newer than those already collected
+*/
+void collectPersistedRecords(
+	FilterArchiveReader&	reader,				///< Reader of the persistance file
+	PersistedRecords&		persistedRecords)	///< Records to add to
+{
+	vector<int> pending;
 
-	for (auto& [id, station] : stationMap)
+	for (int i = 0; i < reader.index.size(); i++)
 	{
-		string tempId = id;
-		serialize(serial, tempId);
-		serialize(serial, station.rtk.pppState);
+		if (reader.index[i].type != +E_SerialObject::PERSIST_EPOCH)
+		{
+			pending.push_back(i);
+			continue;
+		}
+
+		PayloadCursor cursor;
+		int64_t sequence;
+
+		bool pass	= getArchivePayload(reader, reader.index[i].offset, cursor)
+					&&cursor.get(sequence);
+
+		if	( pass == false
+			||sequence <= persistedRecords.sequence)
+		{
+			//epochs that were already included in a snapshot when it was written
+			pending.clear();
+			continue;
+		}
+
+		for (auto& j : pending)
+		{
+			switch (reader.index[j].type)
+			{
+				case E_SerialObject::PERSIST_EPHEMERIS:	//fallthrough
+				case E_SerialObject::PERSIST_SSR:
+				{
+					persistedRecords.navRecords.push_back({&reader, j});
+					break;
+				}
+				case E_SerialObject::PERSIST_FILTER:
+				{
+					string id;
+					pass	= getArchivePayload(reader, reader.index[j].offset, cursor)
+							&&getPersistFilterId(cursor, id);
+
+					if (pass)
+					{
+						persistedRecords.filterRecords[id] = {&reader, j};
+					}
+					break;
+				}
+				default:
+				{
+					break;
+				}
+			}
+		}
+
+		pending.clear();
+		persistedRecords.sequence = sequence;
 	}
 }
 
-void inputPersistanceStates(
-	map<string, Station>&	stationMap,
-	KFState&				netKFState)
+/** Open the snapshot and journal of the persistance files, and collect their current records
+*/
+void openPersistance(
+	FilterArchiveReader&	snapshotReader,		///< Reader for the snapshot
+	FilterArchiveReader&	journalReader,		///< Reader for the journal
+	PersistedRecords&		persistedRecords)	///< Records to populate
 {
-	string stateFilename	= acsConfig.persistance_filename + "_states";
+	string snapshotFilename	= acsConfig.persistance_filename + "_snapshot";
+	string journalFilename	= acsConfig.persistance_filename + "_journal";
 
-	std::fstream fileStream(stateFilename, std::ifstream::binary | std::ifstream::in);
+	bool pass = snapshotReader.open(snapshotFilename, true);
+	if (pass)
+	{
+		collectPersistedRecords(snapshotReader, persistedRecords);
+	}
 
-	if (!fileStream)
+	pass = journalReader.open(journalFilename, true);
+	if (pass)
 	{
-		std::cout << std::endl << "Error opening persistance file " << stateFilename <<  " for input";
-		return;
+		collectPersistedRecords(journalReader, persistedRecords);
+	}
+}
+
+/** Apply an ephemeris or SSR record to the navigation object
+*/
+bool applyPersistNav(
+	FilterArchiveReader&	reader,		///< Reader of the persistance file
+	int						i)			///< Index of the record
+{
+	PayloadCursor cursor;
+	int64_t numEntries = 0;
+
+	bool pass	= getArchivePayload(reader, reader.index[i].offset, cursor)
+				&&cursor.get(numEntries);
+
+	if (reader.index[i].type == +E_SerialObject::PERSIST_EPHEMERIS)
+	{
+		for (int entry = 0; entry < numEntries && pass; entry++)
+		{
+			Eph eph;
+			pass = cursor.get(eph);
+			if (pass == false)
+			{
+				break;
+			}
+
+			auto& ephStore = nav.ephMap[eph.Sat];
+
+			Eph* found_ptr = ephStore.find(eph.iode, eph.toe, 0.5);
+			if (found_ptr == nullptr)
+			{
+				ephStore.add(eph);
+			}
+		}
+
+		return pass;
+	}
+
+	for (int entry = 0; entry < numEntries && pass; entry++)
+	{
+		int32_t	sat		= 0;
+		int32_t	kind	= 0;
+		GTime	time;
+
+		pass	= cursor.get(sat)
+				&&cursor.get(kind)
+				&&cursor.get(time);
+
+		if (pass == false)
+		{
+			break;
+		}
+
+		auto& ssr = nav.satNavMap[sat].ssr;
+
+		switch (kind)
+		{
+			case E_PersistSSR::CODE_BIAS:	pass = getSSREntry(cursor, time, ssr.ssrCodeBias_map);	break;
+			case E_PersistSSR::PHASE_BIAS:	pass = getSSREntry(cursor, time, ssr.ssrPhasBias_map);	break;
+			case E_PersistSSR::CLOCK:		pass = getSSREntry(cursor, time, ssr.ssrClk_map);		break;
+			case E_PersistSSR::EPHEMERIS:	pass = getSSREntry(cursor, time, ssr.ssrEph_map);		break;
+			case E_PersistSSR::HR_CLOCK:	pass = getSSREntry(cursor, time, ssr.ssrHRClk_map);		break;
+			case E_PersistSSR::URA:			pass = getSSREntry(cursor, time, ssr.ssrUra_map);		break;
+			default:						pass = false;												break;
+		}
+	}
+
+	return pass;
+}
+
+/** Load the navigation data from the latest persistance snapshot, and replay the journal of changes since
+*/
+void inputPersistanceNav()
+{
+	FilterArchiveReader	snapshotReader;
+	FilterArchiveReader	journalReader;
+	PersistedRecords	persistedRecords;
+
+	openPersistance(snapshotReader, journalReader, persistedRecords);
+
+	for (auto& [reader_ptr, i] : persistedRecords.navRecords)
+	{
+		bool pass = applyPersistNav(*reader_ptr, i);
+		if (pass == false)
+		{
+			std::cout << std::endl << "Error reading persistance navigation record";
+			break;
+		}
 	}
 
-	binary_iarchive serial(fileStream, 1); //no header
+	//mark everything loaded as persisted, so that the journal continues without repeating it
+	std::stringstream discard;
+	writePersistNav(discard, GTime::noTime(), true);
+
+	persistanceState.started	= true;
+	persistanceState.sequence	= persistedRecords.sequence;
+}
+
+/** Load the filter states from the latest persistance snapshot and journal, only the most recent record of each filter is decoded
+*/
+void inputPersistanceStates(
+	map<string, Station>&	stationMap,		///< Map of stations to load filters for
+	KFState&				netKFState)		///< Network filter to load
+{
+	FilterArchiveReader	snapshotReader;
+	FilterArchiveReader	journalReader;
+	PersistedRecords	persistedRecords;
+
+	openPersistance(snapshotReader, journalReader, persistedRecords);
 
+	for (auto& [id, record] : persistedRecords.filterRecords)
 	{
+		auto& [reader_ptr, i] = record;
+
 		KFState kfState;
-		serialize(serial, kfState);
+		bool pass = reader_ptr->read(i, kfState);
+		if (pass == false)
+		{
+			std::cout << std::endl << "Error reading persistance state for " << id;
+			continue;
+		}
 
-		KFState& destKFState = netKFState;
+		KFState& destKFState = id.empty() ? netKFState : stationMap[id].rtk.pppState;
 
 		destKFState.time		= kfState.time;
 		destKFState.x			= kfState.x;
 		destKFState.P			= kfState.P;
 		destKFState.kfIndexMap	= kfState.kfIndexMap;
 
-		//special case for netKFState - fix up the station pointers
+		if (id.empty())
 		{
+			//special case for netKFState - fix up the station pointers
 			map<KFKey, short int> newKFIndexMap;
 
 			for (auto& [kfKey, index] : destKFState.kfIndexMap)
@@ -190,26 +1529,116 @@ void inputPersistanceStates(
 			}
 			destKFState.kfIndexMap = newKFIndexMap;
 		}
+
+		destKFState.updateHandleIndices();
 	}
 
+	persistanceState.started	= true;
+	persistanceState.sequence	= std::max(persistanceState.sequence, persistedRecords.sequence);
+}
 
+/** Store the changes to the navigation data and filters of an epoch for restarting.
+* Changes are appended to a journal, which is periodically compacted into a snapshot containing only the current state
+*/
+void outputPersistance(
+	KFState&		netKFState,		///< Network filter to store
+	StationList&	stations,		///< Stations whose filters have changed this epoch
+	bool			snapshot)		///< Compact the journal into a new snapshot
+{
+	string snapshotFilename	= acsConfig.persistance_filename + "_snapshot";
+	string journalFilename	= acsConfig.persistance_filename + "_journal";
 
-	int stationMapSize;
-	serialize(serial, stationMapSize);
+	auto& state = persistanceState;
 
-	for (int i = 0; i < stationMapSize; i++)
+	if (state.started == false)
 	{
-		string tempId;
-		serialize(serial, tempId);
+		//not continuing from earlier files, start them afresh
+		std::ofstream snapshotStream	(snapshotFilename,	std::ofstream::binary | std::ofstream::trunc);
+		std::ofstream journalStream		(journalFilename,	std::ofstream::binary | std::ofstream::trunc);
 
-		KFState kfState;
-		serialize(serial, kfState);
+		state.started = true;
+	}
 
-		KFState& destKFState = stationMap[tempId].rtk.pppState;
+	state.sequence++;
 
-		destKFState.time		= kfState.time;
-		destKFState.x			= kfState.x;
-		destKFState.P			= kfState.P;
-		destKFState.kfIndexMap	= kfState.kfIndexMap;
+	map<string, KFState*> kfStatePtrMap;
+	if (netKFState.x.rows() > 0)
+	{
+		kfStatePtrMap[""] = &netKFState;
+	}
+
+	for (auto& rec_ptr : stations)
+	{
+		kfStatePtrMap[rec_ptr->id] = &rec_ptr->rtk.pppState;
+	}
+
+	GTime time = netKFState.time;
+
+	if	( snapshot == false
+		&&state.journalEpochs < acsConfig.persistance_snapshot_interval)
+	{
+		std::ofstream journalStream(journalFilename, std::ofstream::binary | std::ofstream::app);
+		if (!journalStream)
+		{
+			std::cout << std::endl << "Error opening persistance file " << journalFilename <<  " for writing";
+			return;
+		}
+
+		writePersistNav(journalStream, time, false);
+
+		for (auto& [id, kfState_ptr] : kfStatePtrMap)
+		{
+			writePersistFilter(journalStream, id, *kfState_ptr);
+		}
+
+		writePersistEpoch(journalStream, time, state.sequence);
+
+		state.journalEpochs++;
+		return;
+	}
+
+	//write a new snapshot beside the old one, so that there is always a complete snapshot on disk
+	string tempFilename = snapshotFilename + ".tmp";
+	{
+		std::ofstream snapshotStream(tempFilename, std::ofstream::binary | std::ofstream::trunc);
+		if (!snapshotStream)
+		{
+			std::cout << std::endl << "Error opening persistance file " << tempFilename <<  " for writing";
+			return;
+		}
+
+		writePersistNav(snapshotStream, time, true);
+
+		for (auto& [id, kfState_ptr] : kfStatePtrMap)
+		{
+			writePersistFilter(snapshotStream, id, *kfState_ptr);
+		}
+
+		//filters that have not changed this epoch are copied from the previous files as they are
+		FilterArchiveReader	snapshotReader;
+		FilterArchiveReader	journalReader;
+		PersistedRecords	persistedRecords;
+
+		openPersistance(snapshotReader, journalReader, persistedRecords);
+
+		for (auto& [id, record] : persistedRecords.filterRecords)
+		{
+			if (kfStatePtrMap.find(id) != kfStatePtrMap.end())
+			{
+				continue;
+			}
+
+			auto& [reader_ptr, i] = record;
+			copyArchiveRecord(*reader_ptr, i, snapshotStream);
+		}
+
+		writePersistEpoch(snapshotStream, time, state.sequence);
 	}
+
+	//journal entries are superseded by the snapshot's sequence number if the truncation below is interrupted
+	std::rename(tempFilename.c_str(), snapshotFilename.c_str());
+
+	std::ofstream journalStream(journalFilename, std::ofstream::binary | std::ofstream::trunc);
+
+	state.journalEpochs = 0;
 }
@@ -3,11 +3,18 @@
 #define __ALGEBRA_TRACE_HPP__
 
 #include <iostream>
+#include <fstream>
 #include <utility>
+#include <cstdint>
 #include <string>
+#include <future>
+#include <vector>
+#include <deque>
 #include <map>
 
 using std::string;
+using std::vector;
+using std::deque;
 using std::pair;
 using std::map;
 
@@ -29,7 +36,12 @@ BETTER_ENUM(E_SerialObject,		int,
 			FILTER_PLUS,
 			TRANSITION_MATRIX,
 			NAVIGATION_DATA,
-			STRING
+			STRING,
+			ARCHIVE_INDEX,
+			PERSIST_FILTER,
+			PERSIST_EPHEMERIS,
+			PERSIST_SSR,
+			PERSIST_EPOCH
 
 )
 
@@ -47,6 +59,157 @@ struct ProcessNoiseObject
 	int								cols;
 };
 
+/** Forward filter object retained in memory for lagged RTS smoothing
+*/
+struct RTSRecord
+{
+	E_SerialObject			type = E_SerialObject::NONE;
+	KFState					kfState;					///< Filter state for FILTER_MINUS and FILTER_PLUS records (only time, x, P, and kfIndexMap are populated)
+	TransitionMatrixObject	transitionMatrixObject;		///< Transition matrix for TRANSITION_MATRIX records
+};
+
+/** Bounded history of forward filter objects, holding only the most recent rts_lag epochs
+*/
+struct RTSRingBuffer
+{
+	deque<RTSRecord>	records;
+	int					plusCount = 0;		///< Number of FILTER_PLUS records currently held
+	std::future<void>	spill;				///< Pending asynchronous write of the most recent record to the forward archive
+};
+
+/** Filter archives are a sequence of self-contained records, each laid out as
+*	ArchiveRecordHeader
+*	payload (storedBytes, compressed if compression != 0), zero padded to ARCHIVE_ALIGNMENT
+*	int64_t total size of the record, so that archives may be walked backwards from their end
+*
+* Blocks of doubles are aligned to ARCHIVE_ALIGNMENT within the payload, so they can be used in place when the archive is mapped.
+*
+* FILTER_MINUS and FILTER_PLUS payloads:
+*	int64_t time, int32_t numStates, int32_t numKeys
+*	key table of numKeys entries: int16_t index, type, num, sys, prn, uint16_t strLength, char str[strLength]
+*	padding
+*	double x[numStates]
+*	double P[numStates * (numStates + 1) / 2], the lower triangle packed column by column
+*
+* TRANSITION_MATRIX payloads:
+*	int32_t rows, cols, numEntries
+*	int32_t row[numEntries], int32_t col[numEntries]
+*	padding
+*	double value[numEntries]
+*
+* ARCHIVE_INDEX payloads:
+*	int64_t numEntries
+*	numEntries of int64_t offset, int32_t type, int64_t time, for every record preceding the index
+*
+* Persistance files use the same records, and are written as a snapshot, and a journal of the changes since that snapshot.
+* Each epoch is completed by a PERSIST_EPOCH record, records following the last of these are incomplete and ignored.
+*
+* PERSIST_FILTER payloads:
+*	uint16_t idLength, char id[idLength] (empty for the network filter)
+*	padding
+*	FILTER_PLUS payload
+*
+* PERSIST_EPHEMERIS payloads:
+*	int64_t numEntries
+*	Eph eph[numEntries]
+*
+* PERSIST_SSR payloads:
+*	int64_t numEntries
+*	numEntries of int32_t sat, int32_t kind, GTime time, followed by the correction.
+*	Biases are written as their fixed fields followed by counts and pairs of their maps, other corrections are written directly
+*
+* PERSIST_EPOCH payloads:
+*	int64_t sequence number of the epoch
+*/
+const int ARCHIVE_ALIGNMENT = 8;
+
+struct ArchiveRecordHeader
+{
+	char		magic[4]		= {'K', 'F', 'A', 'R'};
+	uint8_t		version			= 1;
+	uint8_t		type			= E_SerialObject::NONE;
+	uint8_t		compression		= 0;		///< 0 for none, 1 for zlib
+	uint8_t		reserved		= 0;
+	int64_t		time			= 0;		///< Time of filter states, for indexing
+	uint64_t	storedBytes		= 0;		///< Size of the payload as stored
+	uint64_t	rawBytes		= 0;		///< Size of the payload before compression
+};
+
+/** Location of a record within a filter archive
+*/
+struct ArchiveIndexEntry
+{
+	long int		offset	= 0;
+	E_SerialObject	type	= E_SerialObject::NONE;
+	GTime			time	= GTime::noTime();
+};
+
+/** View of a FILTER_MINUS or FILTER_PLUS record in place in a mapped archive
+*/
+struct FilterRecordView
+{
+	GTime			time;
+	int				numStates	= 0;
+	int				numKeys		= 0;
+	const char*		keyTable	= nullptr;
+	const char*		keyTableEnd	= nullptr;
+	const double*	x			= nullptr;
+	const double*	packedP		= nullptr;		///< Lower triangle of P, packed column by column
+
+	Eigen::Map<const VectorXd> xMap() const
+	{
+		return Eigen::Map<const VectorXd>(x, numStates);
+	}
+
+	Eigen::Map<const VectorXd> lowerColumn(
+		int			col)
+		const;
+
+	bool copyTo(
+		KFState&	kfState)
+		const;
+};
+
+/** Random access reader for filter archives, using a read-only memory mapping of the file.
+* Uses the index record at the end of the archive if it has been finalised, otherwise indexes it once by walking backwards through its records
+*/
+struct FilterArchiveReader
+{
+	const char*					data		= nullptr;
+	size_t						size		= 0;
+	vector<ArchiveIndexEntry>	index;					///< Records in the archive, in the order they were written
+	bool						finalised	= false;	///< The last record in the archive is an index of all preceding records
+	string						scratch;				///< Decompressed payload of the most recently accessed compressed record
+
+	FilterArchiveReader() = default;
+	FilterArchiveReader(const FilterArchiveReader&) = delete;
+	FilterArchiveReader& operator=(const FilterArchiveReader&) = delete;
+
+	~FilterArchiveReader();
+
+	bool open(
+		string		filename,
+		bool		recover = false);
+
+	void close();
+
+	bool view(
+		int					i,
+		FilterRecordView&	view);
+
+	bool read(
+		int			i,
+		KFState&	kfState);
+
+	bool read(
+		int						i,
+		TransitionMatrixObject&	transitionMatrixObject);
+
+	bool read(
+		int			i,
+		RTSRecord&	record);
+};
+
 typedef map<pair<KFKey, KFKey>, double>	CovarAdjustObject;
 typedef map<KFKey, double>				StateAdjustObject;
 
@@ -229,84 +392,6 @@ using boost::serialization::serialize;
 using boost::archive::binary_oarchive;
 using boost::archive::binary_iarchive;
 
-/** Output filter state to a file for later reading
-*/
-template<class TYPE>
-void spitFilterToFile(
-	TYPE&			object,		///< Object to output
-	E_SerialObject	type,		///< Type of object
-	string			filename)	///< Path to file to output to
-{
-	std::fstream fileStream(filename, std::ifstream::binary | std::ifstream::out | std::ifstream::app);
-
-	if (!fileStream)
-	{
-		std::cout << std::endl << "Error opening algebra file " << filename <<  "for writing";
-		return;
-	}
-
-	binary_oarchive serial(fileStream, 1);	//no header
-
-	long int pos = fileStream.tellp();
-
-	int type_int = type;
-	serialize(serial, type_int);
-	serialize(serial, object);
-
-	long int end = fileStream.tellp();
-	long int delta = end - pos;
-	serialize(serial, delta);
-}
-
-/* Retrieve an object from an archive
-*/
-template<class TYPE>
-bool getFilterObjectFromFile(
-	E_SerialObject	expectedType,	///< The expected type of object, (determine using getFilterTypeFromFile() first)
-	TYPE&			object,			///< The pre-declared object to set the value of
-	long int&		startPos,		///< The position in the file of the object's record
-	string			filename)		///< The path to the archive file to read from
-{
-	std::fstream fileStream(filename, std::ifstream::binary | std::ifstream::in);
-
-	if (!fileStream)
-	{
-		std::cout << std::endl << "Error opening algebra file " << filename <<  "for reading";
-		return false;
-	}
-
-	binary_iarchive serial(fileStream, 1); //no header
-
-	long int itemDelta;
-
-	if (startPos < 0)	{	fileStream.seekg(			-sizeof(itemDelta),	fileStream.end);	}
-	else				{	fileStream.seekg(startPos	-sizeof(itemDelta),	fileStream.beg);	}
-
-	long int currentPosition = fileStream.tellg();
-
-	serialize(serial, itemDelta);
-
-	long int itemPosition = currentPosition - itemDelta;
-
-	fileStream.seekg(itemPosition, fileStream.beg);
-
-	int type_int;
-	serialize(serial, type_int);
-
-	E_SerialObject type = E_SerialObject::_from_integral(type_int);
-	if (type != expectedType)
-	{
-		std::cout << std::endl << "Error: Unexpected algebra file object type";
-		return false;
-	}
-
-	serialize(serial, object);
-
-	startPos = itemPosition;
-
-	return true;
-}
-
 void initFilterTrace(
 	KFState&	kfState,
 	string		traceFilename,
@@ -314,22 +399,46 @@ void initFilterTrace(
 	int			rts_lag		= -1);
 
 
-E_SerialObject getFilterTypeFromFile(
-	long int&	startPos,
+void spitFilterToFile(
+	KFState&		kfState,
+	E_SerialObject	type,
+	string			filename);
+
+void spitFilterToFile(
+	KFState&		kfState,
+	E_SerialObject	type,
+	std::ofstream&	fileStream);
+
+void spitFilterToFile(
+	TransitionMatrixObject&	transitionMatrixObject,
+	E_SerialObject			type,
+	string					filename);
+
+void finaliseFilterArchive(
 	string		filename);
 
+RTSRingBuffer* getRTSRingBuffer(
+	KFState&	kfState);
+
+void spitFilterToRTS(
+	KFState&		kfState,
+	E_SerialObject	type);
+
+void spitFilterToRTS(
+	KFState&				kfState,
+	TransitionMatrixObject&	transitionMatrixObject);
+
 #include "station.hpp"
 
 void inputPersistanceNav();
 
-void outputPersistanceNav();
-
 void inputPersistanceStates(
 	map<string, Station>&	stationMap,
 	KFState&				netKFState);
 
-void outputPersistanceStates(
-	map<string, Station>&	stationMap,
-	KFState&				netKFState);
+void outputPersistance(
+	KFState&		netKFState,
+	StationList&	stations,
+	bool			snapshot = false);
 
 #endif
@@ -5,9 +5,6 @@
 #include "biasSINEX.hpp"
 #include "enums.h"
 
-#define SSR_CBIA_VALID 3600.0
-#define SSR_PBIA_VALID 300.0
-
 
 map<E_Sys, E_ObsCode> defaultCodesL1 =
 {
@@ -542,33 +539,43 @@ void inpt_hard_bias(
 
 	if (opt.SSR_biases)
 	{
-		auto codeIt = satNav.ssr.ssrCodeBias_map.lower_bound(time);
-		if (codeIt != satNav.ssr.ssrCodeBias_map.end())
+		auto ssrCodeBias_ptr = satNav.ssr.ssrCodeBias_map.atTime(time);
+		if (ssrCodeBias_ptr)
 		{
-			auto& [t, ssrbias] = *codeIt;
+			auto& ssrbias = *ssrCodeBias_ptr;
 
 			if	(  opt.COD_biases
 				&& ssrbias.t0.time > 0
 				&& fabs(timediff(time, ssrbias.t0)) < SSR_CBIA_VALID
 				&& ssrbias.bias.find(obsCode) != ssrbias.bias.end())
 			{
-				bias[CODE] += -ssrbias.bias	[obsCode];
-				var [CODE] +=  ssrbias.var	[obsCode];
+				bias[CODE] += -ssrbias.bias.at(obsCode);
+
+				auto varIt = ssrbias.var.find(obsCode);
+				if (varIt != ssrbias.var.end())
+				{
+					var[CODE] += varIt->second;
+				}
 			}
 		}
 
-		auto phasIt = satNav.ssr.ssrPhasBias_map.lower_bound(time);
-		if (phasIt != satNav.ssr.ssrPhasBias_map.end())
+		auto ssrPhasBias_ptr = satNav.ssr.ssrPhasBias_map.atTime(time);
+		if (ssrPhasBias_ptr)
 		{
-			auto& [t, ssrbias] = *phasIt;
+			auto& ssrbias = *ssrPhasBias_ptr;
 
 			if	(  opt.PHS_biases
 				&& ssrbias.t0.time > 0
 				&& fabs(timediff(time, ssrbias.t0)) < SSR_PBIA_VALID
 				&& ssrbias.bias.find(obsCode) != ssrbias.bias.end())
 			{
-				bias[PHAS] += -ssrbias.bias	[obsCode];
-				var [PHAS] +=  ssrbias.var	[obsCode];
+				bias[PHAS] += -ssrbias.bias.at(obsCode);
+
+				auto varIt = ssrbias.var.find(obsCode);
+				if (varIt != ssrbias.var.end())
+				{
+					var[PHAS] += varIt->second;
+				}
 			}
 		}
 	}
@@ -608,8 +615,14 @@ void inpt_hard_bias(
 		tracepdeex(lv, trace, "\nReading DSB bias for sat %s, code %d ...", obs.Sat.id().c_str(), obsCode._to_string());
 
 		auto sys = obs.Sat.sys;
-		auto defaultCodeL1 = defaultCodesL1[sys];
-		auto defaultCodeL2 = defaultCodesL2[sys];
+
+		//use find, these maps are shared by stations processed in parallel
+		E_ObsCode defaultCodeL1 = E_ObsCode::NONE;
+		E_ObsCode defaultCodeL2 = E_ObsCode::NONE;
+		auto it1 = defaultCodesL1.find(sys);
+		auto it2 = defaultCodesL2.find(sys);
+		if (it1 != defaultCodesL1.end())	defaultCodeL1 = it1->second;
+		if (it2 != defaultCodesL2.end())	defaultCodeL2 = it2->second;
 		double lam1 = satNav.lamMap[ftypes[defaultCodeL1]];
 		double lam2 = satNav.lamMap[ftypes[defaultCodeL2]];		//todo aaron remove later (LCs)
 
@@ -640,7 +653,16 @@ void inpt_hard_bias(
 			//biases not valid, try to generate
 			auto ft = ftypes[obsCode];
 
-			auto& rbias = stationRBiasMap[obs.mount][sys];
+			array<double, 3> rbias = {};
+			auto recIt = stationRBiasMap.find(obs.mount);
+			if (recIt != stationRBiasMap.end())
+			{
+				auto sysIt = recIt->second.find(sys);
+				if (sysIt != recIt->second.end())
+				{
+					rbias = sysIt->second;
+				}
+			}
 
 			tracepdeex(lv, trace, "DSB bias note found, looking for RINEX DCB ... ");
 
@@ -105,6 +105,10 @@ using std::map;
 #define MAXDBDSTOE  3600.0              /* max time difference to ephem Toe (s) for BDS */
 #define MAXDTOE_GLO 1800.0              /* max time difference to GLO Toe (s) */
 #define MAXDTOE_SBS 360.0               /* max time difference to SBAS Toe (s) */
+#define MAXAGESSR   90.0                /* max age of ssr orbit and clock (s) */
+#define MAXAGESSR_HRCLK 10.0            /* max age of ssr high-rate clock (s) */
+#define SSR_CBIA_VALID 3600.0           /* max age of ssr code bias (s) */
+#define SSR_PBIA_VALID 300.0            /* max age of ssr phase bias (s) */
 
 #define MAXLEAPS    64                  /* max number of leap seconds table */
 
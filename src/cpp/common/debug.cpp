@@ -2,7 +2,9 @@
 #pragma GCC optimize ("O0")
 
 #include <iostream>
+#include <iomanip>
 #include <random>
+#include <chrono>
 
 
 #include "minimumConstraints.hpp"
@@ -1153,6 +1155,294 @@ void biastest()
 	printf("\n%f\n", bias[0]);
 }
 
+/** Create a filter with a network-like layout of states for benchmarking.
+* Mostly ambiguities, with some clocks that have rates, and some Gauss-Markov troposphere states.
+*/
+KFState syntheticNetworkState(
+	int		numStates)
+{
+	GTime gtime;
+	gtime++;
+	KFState kfState;
+
+	kfState.initFilterEpoch();
+
+	InitialState init		= {0,	SQR(10),	SQR(0.01)};
+	InitialState rateInit	= {0,	SQR(1),		SQR(0.001)};
+
+	for (int i = 0; kfState.stateTransitionMap.size() < numStates; i++)
+	{
+		string rec = std::to_string(i / 100);
+
+		switch (i % 20)
+		{
+			case 0:
+			{
+				KFKey clockKey		= {KF::REC_SYS_BIAS,		{},	rec,	(short) i};
+				KFKey clockRateKey	= {KF::REC_SYS_BIAS_RATE,	{},	rec,	(short) i};
+				kfState.addKFState		(clockKey,					init);
+				kfState.setKFTransRate	(clockKey, clockRateKey, 1,	rateInit);
+				break;
+			}
+			case 1:
+			{
+				KFKey tropKey		= {KF::TROP_GM,				{},	rec,	(short) i};
+				kfState.addKFState			(tropKey,		init);
+				kfState.setKFGaussMarkovTau	(tropKey,		3600);
+				break;
+			}
+			default:
+			{
+				KFKey ambKey		= {KF::AMBIGUITY,			{},	rec,	(short) i};
+				kfState.addKFState		(ambKey,	init);
+				break;
+			}
+		}
+	}
+
+	kfState.stateTransition(std::cout, gtime);
+
+	//give the covariance some (positive definite) structure, leaving the ONE element alone
+	int n = kfState.x.rows() - 1;
+	MatrixXd B = MatrixXd::Random(n, 20);
+
+	kfState.x.tail(n)					= VectorXd::Random(n);
+	kfState.P.bottomRightCorner(n, n)	= B * B.transpose() + 10 * MatrixXd::Identity(n, n);
+	kfState.P							= (kfState.P + kfState.P.transpose()).eval() / 2;
+
+	return kfState;
+}
+
+/** Compare the dense and sparse state transition products for speed and equality
+*/
+void benchmarkStateTransition()
+{
+	for (int numStates : {250, 500, 1000, 2000, 4000})
+	{
+		KFState kfStateSparse	= syntheticNetworkState(numStates);
+		KFState kfStateDense	= kfStateSparse;
+
+		kfStateDense.denseTransition = true;
+
+		std::map<string, double> times;
+		for (auto kfState_ptr : {&kfStateDense, &kfStateSparse})
+		{
+			auto& kfState = *kfState_ptr;
+
+			GTime gtime = kfState.time;
+			gtime.time += 30;
+
+			//churn a few states as would happen with cycle slips, removed ambiguities, and new satellites
+			kfState.initFilterEpoch();
+			for (int i = 2; i < kfState.x.rows(); i += 97)
+			{
+				KFKey ambKey = {KF::AMBIGUITY, {}, std::to_string(i / 100), (short) i};
+				kfState.resetKFValue(ambKey, {0, SQR(10), 0});
+			}
+			for (int i = 3; i < kfState.x.rows(); i += 89)
+			{
+				KFKey ambKey = {KF::AMBIGUITY, {}, std::to_string(i / 100), (short) i};
+				kfState.removeState(ambKey);
+			}
+			for (int i = 0; i < kfState.x.rows(); i += 131)
+			{
+				KFKey ambKey = {KF::AMBIGUITY, {}, "new", (short) i};
+				kfState.addKFState(ambKey, {0, SQR(10), 0});
+			}
+
+			auto start = std::chrono::steady_clock::now();
+
+			kfState.stateTransition(std::cout, gtime);
+
+			auto stop = std::chrono::steady_clock::now();
+
+			times[kfState.denseTransition ? "dense" : "sparse"] = std::chrono::duration<double>(stop - start).count();
+		}
+
+		bool xEqual = (kfStateDense.x.array() == kfStateSparse.x.array()).all();
+		bool PEqual = (kfStateDense.P.array() == kfStateSparse.P.array()).all();
+
+		std::cout << std::endl
+		<< "States: "		<< std::setw(5)	<< numStates
+		<< "  dense: "		<< std::setw(10) << times["dense"]
+		<< "s  sparse: "	<< std::setw(10) << times["sparse"]
+		<< "s  x equal: "	<< xEqual
+		<< "  P equal: "	<< PEqual
+		<< "  max P diff: "	<< (kfStateDense.P - kfStateSparse.P).cwiseAbs().maxCoeff();
+	}
+
+	std::cout << std::endl;
+}
+
+/** Compare batch, chunked and UD measurement updates for speed and equality
+*/
+void benchmarkMeasChunking()
+{
+	for (int numStates : {500, 1000, 2000})
+	{
+		KFState kfStateBase = syntheticNetworkState(numStates);
+
+		kfStateBase.max_prefit_remv	= 0;
+		kfStateBase.max_filter_iter	= 1;
+
+		int n			= kfStateBase.x.rows();
+		int numMeas		= 2 * numStates;
+
+		//each measurement touches a few states from one receiver, like code and phase measurements do
+		KFMeas kfMeas;
+		MatrixXd A = MatrixXd::Zero(numMeas, n);
+		kfMeas.R = VectorXd::Ones(numMeas);
+		kfMeas.obsKeys.resize(numMeas);
+
+		for (int meas = 0; meas < numMeas; meas++)
+		{
+			int recStart = 1 + (meas % (n / 100)) * 100;
+
+			for (int j = 0; j < 12; j++)
+			{
+				int index = recStart + rand() % std::min(100, n - recStart);
+				A(meas, index) = (rand() % 1000) / 500.0 - 1;
+			}
+		}
+
+		kfMeas.A = A.sparseView();
+
+		kfMeas.V = kfMeas.A * VectorXd::Random(n) + 0.1 * VectorXd::Random(numMeas);
+
+		map<string, KFState> results;
+		map<string, double> times;
+
+		for (auto [name, inverter, chunkSize] :	{	std::make_tuple("LLT",			(int) E_Inverter::LLT,		0),
+													std::make_tuple("INV",			(int) E_Inverter::INV,		0),
+													std::make_tuple("CHUNKED 16",	(int) E_Inverter::CHUNKED,	16),
+													std::make_tuple("CHUNKED 64",	(int) E_Inverter::CHUNKED,	64),
+													std::make_tuple("CHUNKED 256",	(int) E_Inverter::CHUNKED,	256),
+													std::make_tuple("UD",			(int) E_Inverter::UD,		0)		})
+		{
+			KFState	kfState	= kfStateBase;
+			KFMeas	meas	= kfMeas;
+
+			kfState.inverter	= inverter;
+			kfState.chunk_size	= chunkSize;
+
+			std::ofstream nullStream;
+
+			auto start = std::chrono::steady_clock::now();
+
+			kfState.filterKalman(nullStream, meas, true);
+
+			auto stop = std::chrono::steady_clock::now();
+
+			times	[name] = std::chrono::duration<double>(stop - start).count();
+			results	[name] = kfState;
+		}
+
+		std::cout << std::endl << "States: " << n << "  Measurements: " << numMeas;
+
+		for (auto& [name, kfState] : results)
+		{
+			std::cout << std::endl
+			<< std::setw(12)	<< name
+			<< ": "				<< std::setw(10) << times[name]
+			<< "s  max x diff: "<< std::setw(12) << (kfState.x - results["LLT"].x).cwiseAbs().maxCoeff()
+			<< "  max P diff: "	<< std::setw(12) << (kfState.P - results["LLT"].P).cwiseAbs().maxCoeff();
+		}
+		std::cout << std::endl;
+	}
+}
+
+/** Deweight a rejected measurement, as the filters' reject callbacks do
+*/
+bool benchmarkDeweight(
+	Trace&		trace,
+	KFState&	kfState,
+	KFMeas&		kfMeas,
+	int			index)
+{
+	kfMeas.R(index) *= 10000;
+
+	return true;
+}
+
+/** Compare refiltering with incremental updates of the innovation covariance factorisation when outliers are rejected
+*/
+void benchmarkOutlierRejection()
+{
+	for (int numStates : {500, 1000, 2000})
+	{
+		KFState kfStateBase = syntheticNetworkState(numStates);
+
+		kfStateBase.max_prefit_remv	= 0;
+		kfStateBase.max_filter_iter	= 12;
+		kfStateBase.inverter		= E_Inverter::LLT;
+		kfStateBase.rejectCallbacks.push_back(benchmarkDeweight);
+
+		int n			= kfStateBase.x.rows();
+		int numMeas		= numStates;
+
+		KFMeas kfMeas;
+		MatrixXd A = MatrixXd::Zero(numMeas, n);
+		kfMeas.R = VectorXd::Constant(numMeas, 0.01);
+		kfMeas.obsKeys.resize(numMeas);
+
+		for (int meas = 0; meas < numMeas; meas++)
+		{
+			int recStart = 1 + (meas % (n / 100)) * 100;
+
+			for (int j = 0; j < 12; j++)
+			{
+				int index = recStart + rand() % std::min(100, n - recStart);
+				A(meas, index) = (rand() % 1000) / 500.0 - 1;
+			}
+		}
+
+		kfMeas.A = A.sparseView();
+
+		kfMeas.V = 0.01 * VectorXd::Random(numMeas);
+
+		//gross errors that will each need an iteration to reject
+		for (int i = 0; i < 10; i++)
+		{
+			kfMeas.V(rand() % numMeas) += 50 + i;
+		}
+
+		map<string, KFState> results;
+		map<string, double> times;
+
+		for (auto [name, incremental] :	{	std::make_tuple("REFILTER",		false),
+											std::make_tuple("INCREMENTAL",	true)	})
+		{
+			KFState	kfState	= kfStateBase;
+			KFMeas	meas	= kfMeas;
+
+			kfState.incremental_rejection = incremental;
+
+			std::ofstream nullStream;
+
+			auto start = std::chrono::steady_clock::now();
+
+			kfState.filterKalman(nullStream, meas, true);
+
+			auto stop = std::chrono::steady_clock::now();
+
+			times	[name] = std::chrono::duration<double>(stop - start).count();
+			results	[name] = kfState;
+		}
+
+		std::cout << std::endl << "States: " << n << "  Measurements: " << numMeas;
+
+		for (auto& [name, kfState] : results)
+		{
+			std::cout << std::endl
+			<< std::setw(12)	<< name
+			<< ": "				<< std::setw(10) << times[name]
+			<< "s  max x diff: "<< std::setw(12) << (kfState.x - results["REFILTER"].x).cwiseAbs().maxCoeff()
+			<< "  max P diff: "	<< std::setw(12) << (kfState.P - results["REFILTER"].P).cwiseAbs().maxCoeff();
+		}
+		std::cout << std::endl;
+	}
+}
+
 void doDebugs()
 {
 // 	biastest();
@@ -1165,4 +1455,7 @@ void doDebugs()
 //	newFilter();
 //  	testClockParams();
 // 	isgmain();
+// 	benchmarkStateTransition();
+// 	benchmarkMeasChunking();
+// 	benchmarkOutlierRejection();
 }
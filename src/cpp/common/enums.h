@@ -185,7 +185,24 @@ BETTER_ENUM(E_FilterMode,		int,
 BETTER_ENUM(E_Inverter,			int,
 			LLT,
 			LDLT,
-			INV)
+			INV,
+			CHUNKED,
+			UD)
+
+BETTER_ENUM(E_Stage,			int,
+			STATIONS,
+			STATE_TRANSITION,
+			FILTER_UPDATE,
+			LEAST_SQUARES,
+			AMBIGUITY_RESOLUTION,
+			RTS,
+			PRODUCTS)
+
+BETTER_ENUM(E_TraceCommand,	short int,
+			WRITE,
+			CREATE,
+			CLOSE,
+			FLUSH)
 
 
 BETTER_ENUM(E_ObsCode, int,
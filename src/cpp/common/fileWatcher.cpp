@@ -0,0 +1,318 @@
+
+#include <boost/log/trivial.hpp>
+#include <boost/filesystem.hpp>
+
+#ifdef __linux__
+#	include <sys/inotify.h>
+#	include <sys/vfs.h>
+#	include <unistd.h>
+#	include <poll.h>
+#endif
+
+#include "fileWatcher.hpp"
+
+FileWatcher fileWatcher;
+
+/** Events that may indicate a changed or replaced input file
+*/
+#ifdef __linux__
+const uint32_t watchEvents	= IN_CLOSE_WRITE
+							| IN_MOVED_TO
+							| IN_MOVED_FROM
+							| IN_CREATE
+							| IN_DELETE
+							| IN_ATTRIB
+							| IN_DELETE_SELF
+							| IN_MOVE_SELF;
+#endif
+
+/** Magic numbers of filesystems on which files may be changed by other hosts, or by user space processes that don't generate notifications
+*/
+#ifdef __linux__
+const unordered_set<uint32_t> remoteFilesystems =
+{
+	0x6969,			//NFS
+	0x517B,			//SMB
+	0xFF534D42,		//CIFS
+	0xFE534D42,		//SMB2
+	0x564C,			//NCP
+	0x5346414F,		//AFS
+	0x73757245,		//CODA
+	0x01021997,		//9P
+	0x00C36400,		//CEPH
+	0x0BD00BD0,		//LUSTRE
+	0x01161970,		//GFS2
+	0x7461636F,		//OCFS2
+	0x65735546		//FUSE (sshfs etc)
+};
+#endif
+
+/** Normalised absolute path used to match files against the names in notification events
+*/
+string FileWatcher::watchedPath(
+	const	string&	filename)		///< Filename as given in the configuration
+{
+	auto it = pathMap.find(filename);
+	if (it != pathMap.end())
+	{
+		return it->second;
+	}
+
+	string path = boost::filesystem::absolute(filename).lexically_normal().string();
+
+	pathMap[filename] = path;
+
+	return path;
+}
+
+FileWatcher::~FileWatcher()
+{
+	shutdown();
+}
+
+/** Start the notification thread, returns false if notifications are not available
+*/
+bool FileWatcher::start()
+{
+	if (active)
+	{
+		return true;
+	}
+
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd < 0)
+	{
+		BOOST_LOG_TRIVIAL(warning)
+		<< "Input file change notification unavailable, input files will be polled each epoch";
+
+		enabled = false;
+		return false;
+	}
+
+	stop	= false;
+	active	= true;
+
+	watchThread = std::thread(&FileWatcher::run, this);
+
+	return true;
+#else
+	enabled = false;
+	return false;
+#endif
+}
+
+/** Stop the notification thread and release all watches
+*/
+void FileWatcher::shutdown()
+{
+	if (active == false)
+	{
+		return;
+	}
+
+	stop = true;
+	if (watchThread.joinable())
+	{
+		watchThread.join();
+	}
+
+#ifdef __linux__
+	close(inotifyFd);
+#endif
+
+	inotifyFd	= -1;
+	active		= false;
+
+	std::lock_guard<std::mutex> guard(watchMutex);
+
+	directoryMap.		clear();
+	watchedFiles.		clear();
+	pendingFiles.		clear();
+	unwatchableFiles.	clear();
+}
+
+/** Add a file to the set of watched files, watching its parent directory so that replaced files are also detected
+*/
+bool FileWatcher::watch(
+	const	string&	path)		///< Normalised path of file to watch
+{
+#ifdef __linux__
+	string directory = boost::filesystem::path(path).parent_path().string();
+
+	struct statfs fsInfo;
+	if	( statfs(directory.c_str(), &fsInfo) == 0
+		&&remoteFilesystems.count((uint32_t) fsInfo.f_type))
+	{
+		BOOST_LOG_TRIVIAL(info)
+		<< directory << " is on a network filesystem, files there will be polled each epoch";
+
+		return false;
+	}
+
+	int wd = inotify_add_watch(inotifyFd, directory.c_str(), watchEvents);
+	if (wd < 0)
+	{
+		BOOST_LOG_TRIVIAL(warning)
+		<< "Unable to watch " << directory << " for changes, files there will be polled each epoch";
+
+		return false;
+	}
+
+	directoryMap[wd] = directory;
+	watchedFiles.insert(path);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/** Background loop converting notification events into pending files
+*/
+void FileWatcher::run()
+{
+#ifdef __linux__
+	alignas(struct inotify_event) char buffer[16384];
+
+	while (stop == false)
+	{
+		pollfd pfd = {inotifyFd, POLLIN, 0};
+
+		int ready = poll(&pfd, 1, 200);
+		if (ready <= 0)
+		{
+			continue;
+		}
+
+		while (true)
+		{
+			ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+			if (length <= 0)
+			{
+				break;
+			}
+
+			std::lock_guard<std::mutex> guard(watchMutex);
+
+			for (char* ptr = buffer; ptr < buffer + length; )
+			{
+				auto& event = *(struct inotify_event*) ptr;
+				ptr += sizeof(struct inotify_event) + event.len;
+
+				if (event.mask & IN_Q_OVERFLOW)
+				{
+					//events were lost, have every file checked
+					pendingFiles = watchedFiles;
+					continue;
+				}
+
+				auto it = directoryMap.find(event.wd);
+				if (it == directoryMap.end())
+				{
+					continue;
+				}
+
+				string directory = it->second;
+
+				if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+				{
+					//the directory itself has gone, forget its files so they are polled and rewatched when next queried
+					for (auto fileIt = watchedFiles.begin(); fileIt != watchedFiles.end(); )
+					{
+						if (boost::filesystem::path(*fileIt).parent_path().string() == directory)
+						{
+							pendingFiles.erase(*fileIt);
+							fileIt = watchedFiles.erase(fileIt);
+						}
+						else
+						{
+							fileIt++;
+						}
+					}
+
+					if (event.mask & IN_IGNORED)
+					{
+						directoryMap.erase(it);
+					}
+					continue;
+				}
+
+				if (event.len == 0)
+				{
+					continue;
+				}
+
+				string path = directory + "/" + event.name;
+				if (watchedFiles.count(path))
+				{
+					pendingFiles.insert(path);
+				}
+			}
+		}
+	}
+#endif
+}
+
+/** Check whether a file may have changed since it was last consumed, without consuming the change.
+* Files that are not yet watched are reported as pending.
+*/
+bool FileWatcher::pending(
+	const	string&	filename)	///< Filename to check
+{
+	if	( enabled	== false
+		||active	== false)
+	{
+		return true;
+	}
+
+	std::lock_guard<std::mutex> guard(watchMutex);
+
+	string path = watchedPath(filename);
+
+	if (watchedFiles.count(path) == 0)
+	{
+		return true;
+	}
+
+	return pendingFiles.count(path) > 0;
+}
+
+/** Check whether a file may have changed since it was last consumed, and consume the change.
+* The first query of a file begins watching it and reports a change, so that it is loaded initially.
+* Callers should still verify the file (eg by modification time) as events are reported conservatively.
+*/
+bool FileWatcher::changed(
+	const	string&	filename)	///< Filename to check
+{
+	if (enabled == false)
+	{
+		return true;
+	}
+
+	if	( active	== false
+		&&start()	== false)
+	{
+		return true;
+	}
+
+	std::lock_guard<std::mutex> guard(watchMutex);
+
+	string path = watchedPath(filename);
+
+	if (watchedFiles.count(path) == 0)
+	{
+		if (unwatchableFiles.count(path) == 0)
+		{
+			bool pass = watch(path);
+			if (pass == false)
+			{
+				unwatchableFiles.insert(path);
+			}
+		}
+
+		return true;
+	}
+
+	return pendingFiles.erase(path) > 0;
+}
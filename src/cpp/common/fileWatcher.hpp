@@ -0,0 +1,64 @@
+#ifndef __FILE_WATCHER_HPP__
+#define __FILE_WATCHER_HPP__
+
+
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+using std::unordered_map;
+using std::unordered_set;
+using std::string;
+
+
+/** Change notification for input files.
+* The directories containing watched files are monitored by a background thread using inotify,
+* so that the main loop only needs to stat and reload files which have actually been written, moved or removed.
+* Files are watched from the first time they are queried, and are always reported as changed on that first query.
+* If notification is unavailable (or disabled) every query reports a possible change, and callers fall back to polling.
+* Notifications are not generated for changes made by other hosts, so files on network filesystems are always polled.
+*/
+struct FileWatcher
+{
+	bool							enabled			= true;		///< Use change notification when available
+	bool							active			= false;	///< Notification thread is running
+
+	int								inotifyFd		= -1;
+	std::atomic<bool>				stop			= false;
+	std::thread						watchThread;
+	std::mutex						watchMutex;
+
+	unordered_map<int, string>		directoryMap;				///< Watched directories, indexed by watch descriptor
+	unordered_set<string>			watchedFiles;				///< Files whose changes are being tracked
+	unordered_set<string>			pendingFiles;				///< Watched files with events that have not been consumed
+	unordered_set<string>			unwatchableFiles;			///< Files that could not be watched, and are always polled
+	unordered_map<string, string>	pathMap;					///< Normalised paths, indexed by configured filename
+
+	~FileWatcher();
+
+	bool	pending(
+		const	string&	filename);
+
+	bool	changed(
+		const	string&	filename);
+
+	void	shutdown();
+
+protected:
+	bool	start();
+
+	string	watchedPath(
+		const	string&	filename);
+
+	bool	watch(
+		const	string&	filename);
+
+	void	run();
+};
+
+extern FileWatcher fileWatcher;
+
+#endif
@@ -4,19 +4,24 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/binary_object.hpp>
+#include <boost/serialization/split_member.hpp>
 #include <boost/serialization/list.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/unordered_map.hpp>
 
 #include <unordered_map>
 #include <unordered_set>
+#include <algorithm>
 #include <string>
+#include <mutex>
+#include <vector>
 #include <list>
 #include <map>
 
 using std::unordered_set;
 using std::unordered_map;
 using std::string;
+using std::vector;
 using std::list;
 using std::map;
 
@@ -188,11 +193,286 @@ struct Seph
 	}
 };
 
-typedef list<Geph>			GephList;	//todo aaron, change these to maps too
-typedef list<Seph>			SephList;
 typedef map<GTime, Peph>	PephList;
 typedef list<Pclk>			PclkList;
-typedef list<Eph>			EphList;
+
+inline GTime	ephTime(const Eph&	eph)	{	return eph.toe;		}
+inline GTime	ephTime(const Geph&	geph)	{	return geph.toe;	}
+inline GTime	ephTime(const Seph&	seph)	{	return seph.t0;		}
+
+inline int		ephIode(const Eph&	eph)	{	return eph.iode;	}
+inline int		ephIode(const Geph&	geph)	{	return geph.iode;	}
+inline int		ephIode(const Seph&	seph)	{	return -1;			}
+
+/** Broadcast ephemerides of a single satellite, sorted by their reference time.
+* Selection by time is logarithmic in the number of ephemerides held, and ephemerides may also be found by their issue of data.
+* Ephemerides with equal reference times are kept in the order they were added.
+* Pointers to ephemerides remain valid until they are pruned.
+*/
+template<class EPH>
+struct EphStore
+{
+	/** Ephemeris and the order in which it was added to the store
+	*/
+	struct Entry
+	{
+		EPH			eph;
+		long int	added;		///< Sequence number of the addition, for finding ephemerides added since some point
+	};
+
+	typedef std::multimap<GTime, Entry>	EntryMap;
+
+	EntryMap											entryMap;		///< Ephemerides indexed by reference time
+	std::unordered_multimap<int, typename EntryMap::iterator>	iodeMap;		///< Ephemerides indexed by issue of data
+	long int											numAdded	= 0;
+
+	EphStore()							= default;
+	EphStore(EphStore&&)				= default;
+	EphStore& operator=(EphStore&&)		= default;
+
+	EphStore(
+		const EphStore&	other)
+	{
+		*this = other;
+	}
+
+	/** Copy the ephemerides of another store, the index must refer to this store's entries rather than the other's
+	*/
+	EphStore& operator=(
+		const EphStore&	other)
+	{
+		entryMap	= other.entryMap;
+		numAdded	= other.numAdded;
+
+		iodeMap.clear();
+		for (auto it = entryMap.begin(); it != entryMap.end(); it++)
+		{
+			int iode = ephIode(it->second.eph);
+			if (iode >= 0)
+			{
+				iodeMap.insert({iode, it});
+			}
+		}
+
+		return *this;
+	}
+
+	/** Add an ephemeris to the store, duplicates are not checked for
+	*/
+	EPH*	add(
+		const EPH&	eph)		///< Ephemeris to add
+	{
+		auto it = entryMap.insert({ephTime(eph), {eph, numAdded++}});
+
+		int iode = ephIode(eph);
+		if (iode >= 0)
+		{
+			iodeMap.insert({iode, it});
+		}
+
+		return &it->second.eph;
+	}
+
+	/** Find the first added ephemeris with an issue of data, and a reference time within a limit of a time.
+	*/
+	EPH*	find(
+		int		iode,			///< Issue of data to find
+		GTime	time,			///< Time to compare reference times with
+		double	tmax)			///< Maximum difference between the reference time and time (s)
+	{
+		Entry*	first	= nullptr;
+
+		auto [begin, end] = iodeMap.equal_range(iode);
+		for (auto it = begin; it != end; it++)
+		{
+			auto& [toe, entry] = *it->second;
+
+			if (fabs(timediff(toe, time)) > tmax)
+			{
+				continue;
+			}
+
+			if	( first == nullptr
+				||entry.added < first->added)
+			{
+				first = &entry;
+			}
+		}
+
+		if (first == nullptr)
+		{
+			return nullptr;
+		}
+
+		return &first->eph;
+	}
+
+	/** Find the ephemeris with the latest reference time that is within a window of a time.
+	* Of ephemerides with equal reference times, the first added is returned.
+	*/
+	EPH*	latest(
+		GTime	time,			///< Time at the centre of the window
+		double	tmax)			///< Half width of the window (s)
+	{
+		auto it = entryMap.upper_bound(time + tmax);
+		if (it == entryMap.begin())
+		{
+			return nullptr;
+		}
+
+		it--;
+		if (fabs(timediff(it->first, time)) > tmax)
+		{
+			return nullptr;
+		}
+
+		it = entryMap.lower_bound(it->first);
+
+		return &it->second.eph;
+	}
+
+	/** Find the ephemeris with the reference time closest to a time, within a limit.
+	* Of ephemerides at equal distances, the last in time (and the last added) is returned.
+	*/
+	EPH*	closest(
+		GTime	time,			///< Time to compare reference times with
+		double	tmax)			///< Maximum difference between the reference time and time (s)
+	{
+		auto after = entryMap.upper_bound(time);
+
+		auto before = after;
+		if (before != entryMap.begin())
+		{
+			before--;
+			before = std::prev(entryMap.upper_bound(before->first));
+		}
+		else
+		{
+			before = entryMap.end();
+		}
+
+		if (after != entryMap.end())
+		{
+			after = std::prev(entryMap.upper_bound(after->first));
+		}
+
+		EPH*	closest	= nullptr;
+		double	tmin	= tmax;
+
+		for (auto it : {before, after})
+		{
+			if (it == entryMap.end())
+			{
+				continue;
+			}
+
+			double t = fabs(timediff(it->first, time));
+			if (t <= tmin)
+			{
+				closest	= &it->second.eph;
+				tmin	= t;
+			}
+		}
+
+		return closest;
+	}
+
+	/** Remove ephemerides with reference times before a time
+	*/
+	void	prune(
+		GTime	oldest)			///< Oldest reference time to keep
+	{
+		auto stop = entryMap.lower_bound(oldest);
+		if (stop == entryMap.begin())
+		{
+			return;
+		}
+
+		for (auto it = iodeMap.begin(); it != iodeMap.end(); )
+		{
+			if (it->second->first < oldest)		it = iodeMap.erase(it);
+			else								it++;
+		}
+
+		entryMap.erase(entryMap.begin(), stop);
+	}
+
+	size_t	size()	const	{	return entryMap.size();		}
+	bool	empty()	const	{	return entryMap.empty();	}
+
+	template<class ARCHIVE>
+	void save(ARCHIVE& ar, const unsigned int& version) const
+	{
+		list<EPH> ephList;
+		for (auto& [time, entry] : entryMap)
+		{
+			ephList.push_back(entry.eph);
+		}
+
+		ar & ephList;
+	}
+
+	template<class ARCHIVE>
+	void load(ARCHIVE& ar, const unsigned int& version)
+	{
+		list<EPH> ephList;
+		ar & ephList;
+
+		for (auto& eph : ephList)
+		{
+			add(eph);
+		}
+	}
+
+	BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+/** Precise orbit samples of a single satellite in contiguous arrays.
+* Built from the PephList of the satellite so that interpolation windows can be found without walking the map.
+*/
+struct PephSeries
+{
+	GTime				start;				///< Time of the first sample
+	GTime				stop;				///< Time of the last sample
+	double				spacing		= 0;	///< Interval between samples (s), zero if they are not uniformly spaced
+	size_t				sourceSize	= 0;	///< Number of entries in the PephList the series was built from
+
+	vector<double>		t;					///< Sample times relative to start (s)
+	vector<Vector3d>	pos;
+	vector<Vector3d>	posStd;
+	vector<double>		clk;
+	vector<double>		clkStd;
+
+	int		lowerBound(
+		double	time)	const;
+};
+
+/** Precise clock samples of a single satellite or receiver in contiguous arrays.
+*/
+struct PclkSeries
+{
+	GTime				start;				///< Time of the first sample
+	GTime				stop;				///< Time of the last sample
+	double				spacing		= 0;	///< Interval between samples (s), zero if they are not uniformly spaced
+	size_t				sourceSize	= 0;	///< Number of entries in the PclkList the series was built from
+
+	vector<double>		t;					///< Sample times relative to start (s)
+	vector<double>		clk;
+	vector<double>		std;
+
+	int		lowerBound(
+		double	time)	const;
+};
+
+/** Read only copy of the precise products, arranged for interpolation.
+* Rebuilt between epochs whenever precise products are loaded, and shared by all threads during processing.
+* Entries that no longer match their source lists are ignored, and the lists are used directly.
+*/
+struct PreciseCache
+{
+	unordered_map<int,		PephSeries>	pephSeriesMap;
+	unordered_map<string,	PclkSeries>	pclkSeriesMap;
+};
 
 struct tec_t
 {
@@ -349,15 +629,137 @@ struct SSREphOut : SSREph
 	bool		canExport			= false;
 };	
 
+inline double	ssrValidity(const SSRCodeBias&)		{	return SSR_CBIA_VALID;		}
+inline double	ssrValidity(const SSRPhasBias&)		{	return SSR_PBIA_VALID;		}
+inline double	ssrValidity(const SSRClk&)			{	return MAXAGESSR;			}
+inline double	ssrValidity(const SSREph&)			{	return MAXAGESSR;			}
+inline double	ssrValidity(const SSRHRClk&)		{	return MAXAGESSR_HRCLK;		}
+inline double	ssrValidity(const SSRUra&)			{	return MAXAGESSR;			}
+
+/** SSR corrections of one kind for a single satellite, sorted by time in a contiguous array.
+* Corrections are only used for a limited time after their reference time (their validity),
+* so each kind retains twice its validity, or twice its update interval if that is longer, behind the newest correction.
+* The newest correction is always retained.
+* Expired corrections are skipped as new ones are inserted, and removed in bulk once they make up half of the array.
+*/
+template<class TYPE>
+struct SSRStore
+{
+	typedef std::pair<GTime, TYPE>					Entry;
+	typedef typename vector<Entry>::const_iterator	Iterator;
+
+	vector<Entry>	entries;			///< Corrections indexed by time, oldest first
+	size_t			head		= 0;	///< Index of the oldest correction that has not expired
+
+	/** Insert a correction, replacing any with the same time
+	*/
+	void	insert(
+		GTime		time,				///< Time to index the correction by
+		const TYPE&	ssr)				///< Correction to insert
+	{
+		if	( entries.size() == head
+			||entries.back().first < time)
+		{
+			//usual case, corrections arrive in order
+			entries.push_back({time, ssr});
+		}
+		else
+		{
+			auto it = std::lower_bound(entries.begin() + head, entries.end(), time, [](const Entry& entry, const GTime& time)
+			{
+				return entry.first < time;
+			});
+
+			if	( it != entries.end()
+				&&it->first == time)	it->second = ssr;
+			else						entries.insert(it, {time, ssr});
+		}
+
+		expire();
+	}
+
+	/** Skip the corrections that can no longer be used, and release them once enough have accumulated
+	*/
+	void	expire()
+	{
+		auto& [newestTime, newest] = entries.back();
+
+		double	retention	= 2 * std::max(ssrValidity(newest), newest.udi);
+		GTime	oldest		= newestTime - retention;
+
+		while	( head + 1 < entries.size()
+				&&entries[head].first < oldest)
+		{
+			head++;
+		}
+
+		if	( head > 16
+			&&head * 2 > entries.size())
+		{
+			entries.erase(entries.begin(), entries.begin() + head);
+			head = 0;
+		}
+	}
+
+	/** Get the newest correction with a time that is not after a time, or nullptr if there is none
+	*/
+	const TYPE*	atTime(
+		GTime	time)			///< Time to find correction for
+		const
+	{
+		if (entries.size() == head)
+		{
+			return nullptr;
+		}
+
+		//usual case, the newest correction is required
+		if ((entries.back().first > time) == false)
+		{
+			return &entries.back().second;
+		}
+
+		auto it = std::upper_bound(entries.begin() + head, entries.end(), time, [](const GTime& time, const Entry& entry)
+		{
+			return time < entry.first;
+		});
+
+		if (it == entries.begin() + head)
+		{
+			return nullptr;
+		}
+
+		it--;
+
+		return &it->second;
+	}
+
+	/** Get the newest correction, or nullptr if there is none
+	*/
+	const TYPE*	newest()	const
+	{
+		if (entries.size() == head)
+		{
+			return nullptr;
+		}
+
+		return &entries.back().second;
+	}
+
+	Iterator	begin()	const	{	return entries.begin() + head;	}
+	Iterator	end()	const	{	return entries.end();			}
+	size_t		size()	const	{	return entries.size() - head;	}
+	bool		empty()	const	{	return entries.size() == head;	}
+};
+
 /* SSR correction type */
 struct ssr_t
 {
-	map<GTime, SSRCodeBias,	std::greater<GTime>>	ssrCodeBias_map;
-	map<GTime, SSRPhasBias,	std::greater<GTime>>	ssrPhasBias_map;
-	map<GTime, SSRClk,		std::greater<GTime>>	ssrClk_map;
-	map<GTime, SSREph,		std::greater<GTime>>	ssrEph_map;
-	map<GTime, SSRHRClk,	std::greater<GTime>>	ssrHRClk_map;
-	map<GTime, SSRUra,		std::greater<GTime>>	ssrUra_map;
+	SSRStore<SSRCodeBias>	ssrCodeBias_map;
+	SSRStore<SSRPhasBias>	ssrPhasBias_map;
+	SSRStore<SSRClk>		ssrClk_map;
+	SSRStore<SSREph>		ssrEph_map;
+	SSRStore<SSRHRClk>		ssrHRClk_map;
+	SSRStore<SSRUra>		ssrUra_map;
 
 	int refd_;					///< sat ref datum (0:ITRF,1:regional)
 	unsigned char update_;		///<update flag (0:no update,1:update)
@@ -396,9 +798,9 @@ struct nav_t
 
 	map<string, map<GTime, pcvacs_t,	std::greater<GTime>>>	pcvMap;
 	
-	unordered_map<int, EphList> 		ephMap;        /* GPS/QZS/GAL ephemeris */
-	unordered_map<int, GephList>		gephMap;       /* GLONASS ephemeris */
-	unordered_map<int, SephList> 		sephMap;       /* SBAS ephemeris */
+	unordered_map<int, EphStore<Eph>>	ephMap;        /* GPS/QZS/GAL ephemeris */
+	unordered_map<int, EphStore<Geph>>	gephMap;       /* GLONASS ephemeris */
+	unordered_map<int, EphStore<Seph>>	sephMap;       /* SBAS ephemeris */
 	unordered_map<int, PephList> 		pephMap;       /* precise ephemeris */
 	unordered_map<string, PclkList> 	pclkMap;       /* precise clock */
 	unordered_map<int, SatNav>			satNavMap;
@@ -421,6 +823,8 @@ struct nav_t
 
 	orbpod_t orbpod = {};
 
+	PreciseCache	preciseCache;		///< Precise ephemerides and clocks arranged for fast interpolation, see buildPreciseCache()
+
 
 	template<class ARCHIVE>
 	void serialize(ARCHIVE& ar, const unsigned int& version)
@@ -454,6 +858,97 @@ void satposs(
 	nav_t&		nav,
 	int			ephopt);
 
+/** Satellite state calculated by satpos at one node of the transmission time grid
+*/
+struct SatStateNode
+{
+	bool		pass		= false;
+	Vector3d	rSat		= Vector3d::Zero();
+	Vector3d	satVel		= Vector3d::Zero();
+	double		dtSat[2]	= {};
+	double		var			= 0;
+	int			svh			= 0;
+	int			iode		= -1;				///< Issue of data of the ephemeris used, if one was selected
+};
+
+/** Key for a node of the transmission time grid
+*/
+struct SatStateKey
+{
+	GTime		teph;
+	int			Sat;
+	int			ephopt;
+	int			iode;							///< Issue of data requested by the observation, -1 for any
+	long int	node;
+
+	bool operator ==(const SatStateKey& other) const
+	{
+		return	teph	== other.teph
+			&&	Sat		== other.Sat
+			&&	ephopt	== other.ephopt
+			&&	iode	== other.iode
+			&&	node	== other.node;
+	}
+};
+
+struct SatStateKeyHash
+{
+	size_t operator()(const SatStateKey& key) const
+	{
+		size_t hash = key.node;
+		hash = hash * 31 + key.Sat;
+		hash = hash * 31 + key.ephopt;
+		hash = hash * 31 + key.iode;
+		hash = hash * 31 + key.teph.time;
+		return hash;
+	}
+};
+
+/** Satellite positions, velocities, clocks and variances shared by all stations within an epoch.
+* Each satellite is evaluated once at nodes of a fine grid of transmission times, as they are first needed by any station.
+* Stations interpolate between the nodes either side of their own transmission time.
+* Safe to use from the parallel station loop, the contents should be cleared between epochs,
+* and nodes of a satellite must be invalidated whenever its ephemerides, corrections, or precise products change.
+*/
+struct SatStateCache
+{
+	static const int	nodesPerSecond	= 200;		///< Grid spacing is the reciprocal of this
+	static const int	numShards		= 64;
+
+	struct Shard
+	{
+		std::mutex													mutex;
+		unordered_map<SatStateKey, SatStateNode, SatStateKeyHash>	nodeMap;
+	};
+
+	Shard	shards[numShards];
+
+	void	clear();
+
+	void	invalidate(
+		SatSys		Sat);
+
+	int		satpos(
+		Trace&		trace,
+		GTime		time,
+		GTime		teph,
+		Obs&		obs,
+		int			ephopt,
+		nav_t&		nav);
+
+protected:
+	SatStateNode	getNode(
+		Trace&		trace,
+		long int	node,
+		GTime		teph,
+		Obs&		obs,
+		int			ephopt,
+		nav_t&		nav);
+};
+
+extern SatStateCache satStateCache;
+
+void	pruneEphemerides(GTime oldest, nav_t& nav);
 Eph*	seleph	(GTime time, SatSys Sat, int iode, nav_t& nav);
 Geph*	selgeph	(GTime time, SatSys Sat, int iode, nav_t& nav);
 int		ephclk	(GTime time, GTime teph, Obs& obs, double& dts);
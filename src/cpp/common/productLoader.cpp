@@ -0,0 +1,661 @@
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+
+#ifdef __linux__
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#	include <fcntl.h>
+#endif
+
+#include <boost/log/trivial.hpp>
+
+#include "omp.h"
+
+#include "productLoader.hpp"
+#include "threadBudget.hpp"
+#include "preceph.hpp"
+#include "constants.h"
+#include "rinex.hpp"
+#include "gTime.hpp"
+
+
+MappedFile::~MappedFile()
+{
+#ifdef __linux__
+	if (mapping)
+	{
+		munmap(mapping, size);
+	}
+#endif
+}
+
+/** Map the contents of a file into memory, reading it into a buffer if it cannot be mapped
+*/
+bool MappedFile::open(
+	const string&	filename)	///< File to open
+{
+#ifdef __linux__
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd >= 0)
+	{
+		struct stat fileStat;
+		if	( fstat(fd, &fileStat) == 0
+			&&fileStat.st_size > 0)
+		{
+			void* region = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (region != MAP_FAILED)
+			{
+				madvise(region, fileStat.st_size, MADV_SEQUENTIAL);
+
+				mapping	= region;
+				data	= (const char*) region;
+				size	= fileStat.st_size;
+			}
+		}
+
+		close(fd);
+
+		if (mapping)
+		{
+			return true;
+		}
+	}
+#endif
+
+	std::ifstream fileStream(filename, std::ios::binary);
+	if (!fileStream)
+	{
+		return false;
+	}
+
+	std::ostringstream contents;
+	contents << fileStream.rdbuf();
+
+	buffer	= contents.str();
+	data	= buffer.data();
+	size	= buffer.size();
+
+	return true;
+}
+
+/** Single line of a product file, without its newline
+*/
+struct LineView
+{
+	const char*	buff;
+	size_t		length;
+
+	char operator[](
+		size_t	i)
+	const
+	{
+		return i < length ? buff[i] : '\0';
+	}
+
+	bool startsWith(
+		const char*	prefix)
+	const
+	{
+		size_t n = strlen(prefix);
+		return length >= n
+			&& memcmp(buff, prefix, n) == 0;
+	}
+};
+
+/** Call a function with each line of a block of text, stopping early if it returns false
+*/
+template<typename FUNC>
+void forEachLine(
+	const char*	data,		///< Start of text
+	size_t		size,		///< Length of text
+	FUNC		func)		///< Function to call with each line
+{
+	const char* end = data + size;
+
+	for (const char* line = data; line < end; )
+	{
+		const char* eol = (const char*) memchr(line, '\n', end - line);
+		if (eol == nullptr)
+		{
+			eol = end;
+		}
+
+		bool more = func(LineView{line, (size_t) (eol - line)});
+		if (more == false)
+		{
+			return;
+		}
+
+		line = eol + 1;
+	}
+}
+
+/** Parse a single number starting at p, in the same manner as sscanf("%lf")
+*/
+bool parseNumber(
+	const char*&	p,		///< [in/out]	Start of text, moved past the number
+	const char*		end,	///< End of text that may be parsed
+	double&			value)	///< Parsed value
+{
+	while	( p < end
+			&&isspace((unsigned char) *p))
+	{
+		p++;
+	}
+
+	if	( p + 1 < end
+		&&p[0] == '+'
+		&&p[1] != '-')
+	{
+		//from_chars does not accept a leading plus
+		p++;
+	}
+
+	auto [ptr, ec] = std::from_chars(p, end, value);
+	if (ec != std::errc())
+	{
+		return false;
+	}
+
+	p = ptr;
+	return true;
+}
+
+/** Number from a fixed width field of a line, equivalent to str2num()
+*/
+double fieldNumber(
+	const LineView&	line,	///< Line to read from
+	size_t			offset,	///< Start of field
+	size_t			width)	///< Width of field
+{
+	if (offset > line.length)
+	{
+		return 0;
+	}
+
+	const char* p	= line.buff + offset;
+	const char* end	= line.buff + std::min(line.length, offset + width);
+
+	double value;
+
+	if	( memchr(p, 'D', end - p)
+		||memchr(p, 'd', end - p))
+	{
+		//fortran exponents are rare, convert them in a copy
+		char str[256];
+		size_t n = std::min((size_t) (end - p), sizeof(str));
+		for (size_t i = 0; i < n; i++)
+		{
+			str[i] = (p[i] == 'd' || p[i] == 'D') ? 'E' : p[i];
+		}
+
+		const char* q = str;
+		return parseNumber(q, str + n, value) ? value : 0;
+	}
+
+	return parseNumber(p, end, value) ? value : 0;
+}
+
+/** Time from a fixed width field of a line, equivalent to str2time()
+*/
+bool fieldTime(
+	const LineView&	line,	///< Line to read from
+	size_t			offset,	///< Start of field
+	size_t			width,	///< Width of field
+	GTime&			time)	///< Parsed time
+{
+	if (offset > line.length)
+	{
+		return false;
+	}
+
+	const char* p	= line.buff + offset;
+	const char* end	= line.buff + std::min(line.length, offset + width);
+
+	double ep[6];
+	for (int i = 0; i < 6; i++)
+	{
+		bool pass = parseNumber(p, end, ep[i]);
+		if (pass == false)
+		{
+			return false;
+		}
+	}
+
+	if	(ep[0] < 100)
+		ep[0] += ep[0] < 80 ? 2000 : 1900;
+
+	time = epoch2time(ep);
+
+	return true;
+}
+
+/** Parse the contents of an sp3 file, appending valid records to a list in the order they appear.
+* This follows readsp3() exactly, so that results are identical for all files it accepts.
+*/
+void parseSp3(
+	const string&		filename,	///< Name of the file, for messages
+	const MappedFile&	file,		///< Contents of the file
+	int					index,		///< File number
+	vector<Peph>&		pephList)	///< List to append records to
+{
+	GTime	time		= {};
+	double	bfact[2]	= {};
+	char	tsys[4]		= "";
+
+	int hashCount	= 0;
+	int cCount		= 0;
+	int fCount		= 0;
+	bool done		= false;
+
+	pephList.reserve(file.size / 81);
+
+	forEachLine(file.data, file.size, [&](const LineView& line)
+	{
+		if (line[0] == '*')
+		{
+			//epoch line
+			bool pass = fieldTime(line, 3, 28, time);
+			if (pass == false)
+			{
+				BOOST_LOG_TRIVIAL(error)
+				<< "Invalid epoch line in sp3 file " << filename << " : " << string(line.buff, line.length);
+
+				done = true;
+				return false;
+			}
+
+			if (strcmp(tsys, "UTC") == 0)
+			{
+				time = utc2gpst(time);
+			}
+
+			return true;
+		}
+
+		if (line[0] == 'P')
+		{
+			//position line
+			E_Sys	sys	= code2sys(line[1]);
+			int		prn	= (int) fieldNumber(line, 2, 2);
+
+			if		(sys == +E_Sys::SBS)	prn += 100;
+			else if (sys == +E_Sys::QZS)	prn += 192;
+
+			SatSys Sat;
+			Sat.sys = sys;
+			Sat.prn = prn;
+			if (!Sat)
+				return true;
+
+			Peph peph	= {};
+			peph.time	= time;
+			peph.index	= index;
+			peph.Sat	= Sat;
+			bool valid	= false;
+
+			for (int j = 0; j < 3; j++)
+			{
+				double val = fieldNumber(line, 4	+ j * 14,	14);
+				double std = fieldNumber(line, 61	+ j * 3,	2);
+
+				if	( val != 0
+					&&fabs(val - 999999.999999) >= 1E-6)
+				{
+					peph.Pos[j] = val * 1000;
+					valid = true;
+				}
+
+				if	( bfact[0]	> 0
+					&&std		> 0)
+				{
+					peph.PosStd[j] = pow(bfact[0], std) * 1E-3;
+				}
+			}
+
+			double val = fieldNumber(line, 46,	14);
+			double std = fieldNumber(line, 70,	3);
+
+			if	( val != 0
+				&&fabs(val - 999999.999999) >= 1E-6)
+			{
+				peph.Clk = val * 1E-6;
+				valid = true;
+			}
+
+			if	( bfact[1]	> 0
+				&&std		> 0)
+			{
+				peph.ClkStd = pow(bfact[1], std) * 1E-12;
+			}
+
+			if (valid)
+			{
+				pephList.push_back(peph);
+			}
+
+			return true;
+		}
+
+		if (line[0] == '#')
+		{
+			hashCount++;
+
+			if (hashCount == 1)
+			{
+				//first line is time and type
+				bool pass = fieldTime(line, 3, 28, time);
+				if (pass == false)
+				{
+					done = true;
+					return false;
+				}
+
+				return true;
+			}
+		}
+
+		if (line.startsWith("%c"))
+		{
+			cCount++;
+
+			if (cCount == 1)
+			{
+				int i = 0;
+				for (; i < 3 && line[9 + i] != '\0'; i++)
+				{
+					tsys[i] = line[9 + i];
+				}
+				tsys[i] = '\0';
+			}
+			return true;
+		}
+
+		if (line.startsWith("%f"))
+		{
+			fCount++;
+
+			if (fCount == 1)
+			{
+				bfact[0] = fieldNumber(line, 3,	10);
+				bfact[1] = fieldNumber(line, 14,	12);
+			}
+			return true;
+		}
+
+		if (line.startsWith("EOF"))
+		{
+			//all done
+			done = true;
+			return false;
+		}
+
+		return true;
+	});
+
+	if (done == false)
+	{
+		BOOST_LOG_TRIVIAL(warning)
+		<< "Didnt find eof in sp3 file " << filename;
+	}
+}
+
+/** Read a set of sp3 files, returning the combined precise ephemerides of all satellites.
+* Files are mapped and parsed concurrently, then the records of each satellite are sorted and loaded into its list in one pass.
+* Where files overlap, the record from the file listed last is used, as when the files are read in turn with readsp3().
+*/
+unordered_map<int, PephList> readSp3Files(
+	const vector<string>&	files)	///< Files to read, in order of precedence
+{
+	//keep track of file numbers
+	static int fileCount = 0;
+	int firstIndex = fileCount + 1;
+	fileCount += files.size();
+
+	vector<vector<Peph>> fileRecords(files.size());
+
+	int threads = ThreadBudget::stageThreads(E_Stage::PRODUCTS);
+
+#	pragma omp parallel for num_threads(threads) schedule(dynamic)
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		auto& filename = files[i];
+
+		MappedFile file;
+		bool pass = file.open(filename);
+		if (pass == false)
+		{
+			BOOST_LOG_TRIVIAL(error)
+			<< "Sp3 file open error " << filename;
+
+			continue;
+		}
+
+		parseSp3(filename, file, firstIndex + i, fileRecords[i]);
+	}
+
+	//gather the records of each satellite, in order of files and then lines
+	unordered_map<int, vector<Peph>> satRecords;
+	for (auto& records : fileRecords)
+	{
+		for (auto& peph : records)
+		{
+			satRecords[peph.Sat].push_back(peph);
+		}
+
+		records = vector<Peph>();
+	}
+
+	unordered_map<int, PephList> pephMap;
+	vector<std::pair<vector<Peph>*, PephList*>> jobs;
+	for (auto& [Sat, records] : satRecords)
+	{
+		jobs.push_back({&records, &pephMap[Sat]});
+	}
+
+#	pragma omp parallel for num_threads(threads) schedule(dynamic)
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		auto& records	= *jobs[i].first;
+		auto& pephList	= *jobs[i].second;
+
+		auto earlier = [](const Peph& a, const Peph& b)
+		{
+			return a.time < b.time;
+		};
+
+		if (std::is_sorted(records.begin(), records.end(), earlier) == false)
+		{
+			std::stable_sort(records.begin(), records.end(), earlier);
+		}
+
+		for (size_t j = 0; j < records.size(); j++)
+		{
+			//later duplicates replace earlier ones
+			if	( j + 1 < records.size()
+				&&(records[j].time < records[j + 1].time) == false)
+			{
+				continue;
+			}
+
+			pephList.emplace_hint(pephList.end(), records[j].time, records[j]);
+		}
+	}
+
+	return pephMap;
+}
+
+/** Parse the body of a rinex clock file, collecting the clocks of each satellite or receiver in the order they appear.
+* This follows readrnxclk() exactly, so that results are identical for all files it accepts.
+*/
+void parseClk(
+	const char*							data,		///< Start of the body of the file
+	size_t								size,		///< Length of the body of the file
+	double								ver,		///< Rinex version from the header
+	int									index,		///< File number
+	unordered_map<string, vector<Pclk>>&	clkMap)		///< Map of clocks to append to
+{
+	struct ClkField
+	{
+		short offset;
+		short length;
+	};
+
+	ClkField as  = {3,	3};
+	ClkField ar  = {3,	4};
+	ClkField tim = {8,	26};
+	ClkField clk = {40,	19};
+	ClkField std = {60,	19};
+
+	//special case for 3.04 rnx with 9 char AR names
+	if (ver == 3.04)
+	{
+		ar.length  += 5;
+		tim.offset += 5;
+		clk.offset += 5;
+		std.offset += 5;
+	}
+
+	string id;
+
+	forEachLine(data, size, [&](const LineView& line)
+	{
+		GTime time;
+		bool pass = fieldTime(line, tim.offset, tim.length, time);
+		if (pass == false)
+		{
+			return true;
+		}
+
+		ClkField idField;
+		if		(line.startsWith("AS"))		idField = as;
+		else if	(line.startsWith("AR"))		idField = ar;
+		else								return true;
+
+		//the id is before the epoch, so is always within the line
+		id.assign(line.buff + idField.offset, idField.length);
+
+		Pclk preciseClock = {};
+
+		preciseClock.clk	= fieldNumber(line, clk.offset, clk.length);
+		preciseClock.std	= fieldNumber(line, std.offset, std.length);
+		preciseClock.time	= time;
+		preciseClock.index	= index;
+
+		clkMap[id].push_back(preciseClock);
+
+		return true;
+	});
+}
+
+/** Read a set of rinex clock files, appending their clocks to the navigation data in the order the files are listed.
+* Headers are read in turn with the rinex reader, the bodies of the files are then mapped and parsed concurrently.
+*/
+void readClkFiles(
+	const vector<string>&	files,	///< Files to read
+	nav_t&					nav)	///< Navigation data to add clocks to
+{
+	//keep track of file numbers
+	static int fileCount = 0;
+	int firstIndex = fileCount + 1;
+	fileCount += files.size();
+
+	vector<MappedFile>	mappedFiles	(files.size());
+	vector<size_t>		bodyOffsets	(files.size(), 0);
+	vector<double>		versions	(files.size(), 0);
+	vector<bool>		valid		(files.size(), false);
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		auto& filename	= files[i];
+		auto& file		= mappedFiles[i];
+
+		bool pass = file.open(filename);
+		if (pass == false)
+		{
+			BOOST_LOG_TRIVIAL(error)
+			<< "ERROR: Failed to open clock file " << filename;
+
+			continue;
+		}
+
+		//find the end of the header and pass it to the usual reader, which may also take biases from its comments
+		size_t offset = 0;
+		bool found = false;
+		forEachLine(file.data, file.size, [&](const LineView& line)
+		{
+			offset += line.length + 1;
+
+			if	( line.length > 60
+				&&string(line.buff + 60, line.length - 60).find("END OF HEADER") != string::npos)
+			{
+				found = true;
+				return false;
+			}
+
+			return true;
+		});
+
+		if (found == false)
+		{
+			BOOST_LOG_TRIVIAL(error)
+			<< "ERROR: Failed to read header from RINEX file " << filename;
+
+			continue;
+		}
+
+		std::istringstream headerStream(string(file.data, std::min(offset, file.size)));
+
+		char							type	= ' ';
+		double							ver		= 0;
+		E_Sys							sys		= E_Sys::NONE;
+		int								tsys	= TSYS_GPS;
+		map<E_Sys, vector<CodeType>>	sysCodeTypes;
+		ObsList							obsList;
+
+		readrnx(headerStream, type, obsList, nav, nullptr, ver, sys, tsys, sysCodeTypes);
+
+		if (type != 'C')
+		{
+			BOOST_LOG_TRIVIAL(error)
+			<< "ERROR: " << filename << " is not a RINEX clock file";
+
+			continue;
+		}
+
+		bodyOffsets	[i]	= std::min(offset, file.size);
+		versions	[i]	= ver;
+		valid		[i]	= true;
+	}
+
+	vector<unordered_map<string, vector<Pclk>>> fileClocks(files.size());
+
+	int threads = ThreadBudget::stageThreads(E_Stage::PRODUCTS);
+
+#	pragma omp parallel for num_threads(threads) schedule(dynamic)
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		if (valid[i] == false)
+		{
+			continue;
+		}
+
+		auto& file = mappedFiles[i];
+
+		parseClk(file.data + bodyOffsets[i], file.size - bodyOffsets[i], versions[i], firstIndex + i, fileClocks[i]);
+	}
+
+	for (auto& clkMap : fileClocks)
+	for (auto& [id, clocks] : clkMap)
+	{
+		auto& pclkList = nav.pclkMap[id];
+
+		pclkList.insert(pclkList.end(), clocks.begin(), clocks.end());
+	}
+}
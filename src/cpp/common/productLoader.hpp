@@ -0,0 +1,43 @@
+#ifndef __PRODUCT_LOADER_HPP__
+#define __PRODUCT_LOADER_HPP__
+
+
+#include <unordered_map>
+#include <string>
+#include <vector>
+
+using std::unordered_map;
+using std::string;
+using std::vector;
+
+#include "navigation.hpp"
+
+
+/** Read only view of the contents of a file.
+* The file is memory mapped where possible, otherwise it is read into a buffer.
+*/
+struct MappedFile
+{
+	const char*	data		= nullptr;
+	size_t		size		= 0;
+	void*		mapping		= nullptr;		///< Start of the mapped region, if the file was mapped
+	string		buffer;						///< Contents of the file, if it could not be mapped
+
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile();
+
+	bool	open(
+		const string&	filename);
+};
+
+unordered_map<int, PephList> readSp3Files(
+	const vector<string>&	files);
+
+void readClkFiles(
+	const vector<string>&	files,
+	nav_t&					nav);
+
+#endif
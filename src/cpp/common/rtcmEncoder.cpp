@@ -111,11 +111,12 @@ void RtcmEncoder::SSREncoder::encodeSsrComb(
 		}
 		else
 		{
-			if (satNav.ssr.ssrEph_map.size() == 0)
+			auto ssrEph_ptr = satNav.ssr.ssrEph_map.newest();
+			if (ssrEph_ptr == nullptr)
 			{
 				continue;
 			}
-			ssrEph = satNav.ssr.ssrEph_map.begin()->second;
+			ssrEph = *ssrEph_ptr;
 		}
 		
 		if (ssrEph.iod == -1)
@@ -148,7 +149,12 @@ void RtcmEncoder::SSREncoder::encodeSsrComb(
 		}
 		else
 		{
-			ssrClk = satNav.ssr.ssrClk_map.begin()->second;
+			auto ssrClk_ptr = satNav.ssr.ssrClk_map.newest();
+			if (ssrClk_ptr == nullptr)
+			{
+				continue;
+			}
+			ssrClk = *ssrClk_ptr;
 		}
 		
 		if (ssrClk.iod == -1)
@@ -331,7 +337,12 @@ void RtcmEncoder::SSREncoder::encodeSsrPhase(
 		}
 		else
 		{
-			ssrPhasBias = satNav.ssr.ssrPhasBias_map.begin()->second;
+			auto ssrPhasBias_ptr = satNav.ssr.ssrPhasBias_map.newest();
+			if (ssrPhasBias_ptr == nullptr)
+			{
+				continue;
+			}
+			ssrPhasBias = *ssrPhasBias_ptr;
 		}
 		
 		if	(  ssrPhasBias.t0.time	== 0 
@@ -479,7 +490,12 @@ void RtcmEncoder::SSREncoder::encodeSsrCode(
 		}
 		else
 		{
-			ssrCodeBias = satNav.ssr.ssrCodeBias_map.begin()->second; 
+			auto ssrCodeBias_ptr = satNav.ssr.ssrCodeBias_map.newest();
+			if (ssrCodeBias_ptr == nullptr)
+			{
+				continue;
+			}
+			ssrCodeBias = *ssrCodeBias_ptr;
 		}
 		
 		if	(  ssrCodeBias.t0.time	== 0  
@@ -1,13 +1,20 @@
 
 
+#include <algorithm>
+#include <vector>
 #include <map>
 
+using std::vector;
 using std::map;
 
+#include <boost/log/trivial.hpp>
+
 #include "eigenIncluder.hpp"
 
 #include "algebraTrace.hpp"
 #include "rtsSmoothing.hpp"
+#include "threadBudget.hpp"
+#include "traceSink.hpp"
 #include "writeClock.hpp"
 #include "acsConfig.hpp"
 #include "algebra.hpp"
@@ -37,8 +44,67 @@ bool isPositiveSemiDefinite(MatrixXd& mat)
 	return true;
 }
 
+/** Get the filter state of the i'th record in a filter's history, from memory or directly from the mapped archive
+*/
+bool getRTSObject(
+	RTSRingBuffer*			ringBuffer_ptr,		///< In-memory history, or nullptr to use the archive
+	FilterArchiveReader&	archiveReader,		///< Reader of the forward archive
+	int						index,				///< Index of the record
+	KFState&				kfState)			///< Filter state to populate
+{
+	if (ringBuffer_ptr)
+	{
+		kfState = ringBuffer_ptr->records[index].kfState;
+		return true;
+	}
+
+	return archiveReader.read(index, kfState);
+}
+
+/** Get the state transition matrix of the i'th record in a filter's history, from memory or directly from the mapped archive
+*/
+bool getRTSObject(
+	RTSRingBuffer*			ringBuffer_ptr,		///< In-memory history, or nullptr to use the archive
+	FilterArchiveReader&	archiveReader,		///< Reader of the forward archive
+	int						index,				///< Index of the record
+	MatrixXd&				transitionMatrix)	///< Dense transition matrix to populate
+{
+	TransitionMatrixObject	fileTransitionMatrixObject;
+	TransitionMatrixObject*	transitionMatrixObject_ptr = &fileTransitionMatrixObject;
+
+	if (ringBuffer_ptr)
+	{
+		transitionMatrixObject_ptr = &ringBuffer_ptr->records[index].transitionMatrixObject;
+	}
+	else
+	{
+		bool pass = archiveReader.read(index, fileTransitionMatrixObject);
+		if (pass == false)
+		{
+			return false;
+		}
+	}
+
+	auto& transitionMatrixObject = *transitionMatrixObject_ptr;
+
+	transitionMatrix = MatrixXd::Zero(transitionMatrixObject.rows, transitionMatrixObject.cols);
+
+	for (auto& [keyPair, value] : transitionMatrixObject.forwardTransitionMap)
+	{
+		transitionMatrix(keyPair.first, keyPair.second) = value;
+	}
+
+	return true;
+}
+
+/** Smooth the filter history backwards from the most recent epoch.
+* Filters with a finite lag are smoothed from their in-memory history.
+* Others are smoothed in a single pass over the memory mapped forward archive, with each record decoded once, directly into the state that uses it
+*/
 KFState RTS_Process(KFState& kfState, bool write)
 {
+	StageScope stageScope(E_Stage::RTS);
+
 	MatrixXd transistionMatrix;
 
 	KFState kalmanMinus;
@@ -50,47 +116,51 @@ KFState RTS_Process(KFState& kfState, bool write)
 	string inputFile	= kfState.rts_forward_filename;
 	string outputFile	= kfState.rts_filename + BACKWARD_SUFFIX;
 
+	std::ofstream outputStream;
 	if (write)
 	{
-		std::ofstream ofs(outputFile,	std::ofstream::out | std::ofstream::trunc);
+		outputStream.open(outputFile,	std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
 	}
 
-	long int startPos = -1;
-	int lag = 0;
-	while (lag != kfState.rts_lag)
+	RTSRingBuffer*		ringBuffer_ptr = getRTSRingBuffer(kfState);
+	FilterArchiveReader	archiveReader;
+
+	int index;
+	if (ringBuffer_ptr)
 	{
-		E_SerialObject type = getFilterTypeFromFile(startPos, inputFile);
+		index = ringBuffer_ptr->records.size() - 1;
+	}
+	else
+	{
+		finaliseFilterArchive(inputFile);
 
-		if (type == +E_SerialObject::NONE)
-		{
-			break;
-		}
+		archiveReader.open(inputFile);
+
+		index = archiveReader.index.size() - 1;
+	}
+
+	int lag = 0;
+	for (; index >= 0 && lag != kfState.rts_lag; index--)
+	{
+		E_SerialObject type = E_SerialObject::NONE;
+		if (ringBuffer_ptr)		type = ringBuffer_ptr->records	[index].type;
+		else					type = archiveReader.index		[index].type;
 
 		switch (type)
 		{
 			case E_SerialObject::TRANSITION_MATRIX:
 			{
-				TransitionMatrixObject transistionMatrixObject;
-				bool pass = getFilterObjectFromFile(type, transistionMatrixObject, startPos, inputFile);
+				bool pass = getRTSObject(ringBuffer_ptr, archiveReader, index, transistionMatrix);
 				if (pass == false)
 				{
 					return KFState();
 				}
 
-//				std::cout << "Setting transition matrix " << transistionMatrixObject.rows << std::endl;
-
-				transistionMatrix = MatrixXd::Zero(transistionMatrixObject.rows, transistionMatrixObject.cols);
-
-				for (auto& [keyPair, value] : transistionMatrixObject.forwardTransitionMap)
-				{
-					transistionMatrix(keyPair.first, keyPair.second) = value;
-				}
-
 				break;
 			}
 			case E_SerialObject::FILTER_MINUS:
 			{
-				bool pass = getFilterObjectFromFile(type, kalmanMinus, startPos, inputFile);
+				bool pass = getRTSObject(ringBuffer_ptr, archiveReader, index, kalmanMinus);
 				if (pass == false)
 				{
 					return KFState();
@@ -113,7 +183,7 @@ KFState RTS_Process(KFState& kfState, bool write)
 				}
 
 				KFState kalmanPlus;
-				bool pass = getFilterObjectFromFile(type, kalmanPlus, startPos, inputFile);
+				bool pass = getRTSObject(ringBuffer_ptr, archiveReader, index, kalmanPlus);
 				if (pass == false)
 				{
 					return KFState();
@@ -126,7 +196,7 @@ KFState RTS_Process(KFState& kfState, bool write)
 
 					if (write)
 					{
-						spitFilterToFile(smoothedKF, E_SerialObject::FILTER_PLUS, outputFile);
+						spitFilterToFile(smoothedKF, E_SerialObject::FILTER_PLUS, outputStream);
 					}
 
 					break;
@@ -158,52 +228,125 @@ KFState RTS_Process(KFState& kfState, bool write)
 				smoothedKF.P = ( kalmanPlus.P + Ck * (smoothedKF.P - kalmanMinus.P) * Ck.transpose()	).eval();
 
 				smoothedKF.kfIndexMap = kalmanPlus.kfIndexMap;
+				smoothedKF.updateHandleIndices();
 
 				if (write)
 				{
-					spitFilterToFile(smoothedKF, E_SerialObject::FILTER_PLUS, outputFile);
+					spitFilterToFile(smoothedKF, E_SerialObject::FILTER_PLUS, outputStream);
 				}
 				
 				break;
 			}
 		}
+	}
 
-		if (startPos == 0)
-		{
-			break;
-		}
+	if (write)
+	{
+		outputStream.close();
+
+		finaliseFilterArchive(outputFile);
 	}
 
 	if (lag == kfState.rts_lag)
 	{
-		//delete the beginning of the history file
-		string tempFile	= kfState.rts_forward_filename + "_temp";
-		{
-			std::ofstream	tempStream(tempFile,	std::ifstream::binary | std::ofstream::out | std::ofstream::trunc);
-			std::fstream	inputStream(inputFile,	std::ifstream::binary | std::ifstream::in);
+		return smoothedKF;
+	}
+	else
+	{
+		return KFState();
+	}
+}
 
-			inputStream.seekg(0,	inputStream.end);
-				long int lengthPos = inputStream.tellg();
+/** Estimate the memory needed to smooth a filter, from the number of states in the last record of its forward archive
+*/
+double RTS_MemoryEstimate(
+	KFState&	kfState)	///< Filter to estimate for
+{
+	//index the archive now, so the smoother does not need to walk it again
+	finaliseFilterArchive(kfState.rts_forward_filename);
 
-			vector<char>	fileContents(lengthPos - startPos);
+	FilterArchiveReader archiveReader;
+	archiveReader.open(kfState.rts_forward_filename);
 
-			inputStream.seekg(startPos,	inputStream.beg);
+	for (int index = archiveReader.index.size() - 1; index >= 0; index--)
+	{
+		if (archiveReader.index[index].type != +E_SerialObject::FILTER_PLUS)
+		{
+			continue;
+		}
 
-			inputStream.read(&fileContents[0], lengthPos - startPos);
-			tempStream.write(&fileContents[0], lengthPos - startPos);
+		FilterRecordView filterView;
+		bool pass = archiveReader.view(index, filterView);
+		if (pass == false)
+		{
+			return 0;
 		}
 
-		std::remove(inputFile.c_str());
-		std::rename(tempFile.c_str(), inputFile.c_str());
+		//the smoother holds about eight dense matrices of the state size at once
+		double numStates = filterView.numStates;
+		return 8 * sizeof(double) * numStates * numStates;
 	}
 
-	if (lag == kfState.rts_lag)
+	return 0;
+}
+
+/** Smooth many independent filters at the end of processing, running their backward passes concurrently.
+* The number of filters smoothed at once is limited by the threads allocated to the RTS stage, and by the memory budget.
+* Outputs are written afterward in the order the filters are given, so they do not depend on the scheduling
+*/
+void RTS_ProcessConcurrent(
+	vector<KFState*>&	kfState_ptrs,		///< Filters to smooth
+	double				memoryBudget)		///< Memory available for concurrent smoothing (MB, 0 for unlimited)
+{
+	int numFilters = kfState_ptrs.size();
+
+	vector<double>	memoryEstimates(numFilters);
+	double			largestEstimate = 0;
+	for (int i = 0; i < numFilters; i++)
 	{
-		return smoothedKF;
+		memoryEstimates[i]	= RTS_MemoryEstimate(*kfState_ptrs[i]);
+		largestEstimate		= std::max(largestEstimate, memoryEstimates[i]);
 	}
-	else
+
+	//start the largest filters first so the small ones fill in around them
+	vector<int> order(numFilters);
+	for (int i = 0; i < numFilters; i++)
 	{
-		return KFState();
+		order[i] = i;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+	{
+		return memoryEstimates[a] > memoryEstimates[b];
+	});
+
+	{
+		StageScope stageScope(E_Stage::RTS);
+
+		int concurrent = stageScope.threads;
+		if	( memoryBudget		> 0
+			&&largestEstimate	> 0)
+		{
+			concurrent = std::min(concurrent, (int) (memoryBudget * 1e6 / largestEstimate));
+			concurrent = std::max(concurrent, 1);
+		}
+
+		BOOST_LOG_TRIVIAL(info)
+		<< "Smoothing " << numFilters << " filters, " << concurrent << " at a time";
+
+#		ifdef ENABLE_PARALLELISATION
+		Eigen::setNbThreads(1);
+#		pragma omp parallel for schedule(dynamic) num_threads(concurrent)
+#		endif
+		for (int i = 0; i < numFilters; i++)
+		{
+			RTS_Process(*kfState_ptrs[order[i]], true);
+		}
+	}
+
+	for (auto& kfState_ptr : kfState_ptrs)
+	{
+		RTS_Output(*kfState_ptr);
 	}
 }
 
@@ -213,14 +356,22 @@ void RTS_Output(
 	KFState&	kfState,			///< State to get filter traces from
 	string		clockFilename)		///< Filename to output clocks to once smoothed
 {
-	std::ofstream ofs(kfState.rts_filename + SMOOTHED_SUFFIX,	std::ofstream::out | std::ofstream::app);
+	TraceStream ofs(kfState.rts_filename + SMOOTHED_SUFFIX);
+
+	//the backward archive is in reverse time order, read it from the end to output in time order
+	FilterArchiveReader archiveReader;
+	archiveReader.open(kfState.rts_filename + BACKWARD_SUFFIX);
 
-	long int startPos = -1;
-	while (1)
+	for (int index = archiveReader.index.size() - 1; index >= 0; index--)
 	{
-		E_SerialObject type = getFilterTypeFromFile(startPos, kfState.rts_filename + BACKWARD_SUFFIX);
+		RTSRecord record;
+		bool pass = archiveReader.read(index, record);
+		if (pass == false)
+		{
+			return;
+		}
 
-		switch (type)
+		switch (record.type)
 		{
 			default:
 			{
@@ -230,8 +381,7 @@ void RTS_Output(
 
 			case E_SerialObject::FILTER_PLUS:
 			{
-				KFState archiveKF;
-				bool pass = getFilterObjectFromFile(type, archiveKF, startPos, kfState.rts_filename + BACKWARD_SUFFIX);
+				KFState& archiveKF = record.kfState;
 
 				if	( acsConfig.output_clocks
 					&&clockFilename.empty() == false)
@@ -254,13 +404,10 @@ void RTS_Output(
 #				endif
 
 				pppoutstat(ofs, archiveKF, true);
+
+				ofs.queueOutput();
 				break;
 			}
 		}
-
-		if (startPos == 0)
-		{
-			return;
-		}
 	}
 }
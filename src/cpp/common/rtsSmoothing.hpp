@@ -2,8 +2,10 @@
 #ifndef __RTS_SMOOTHING_HPP__
 #define __RTS_SMOOTHING_HPP__
 
+#include <vector>
 #include <map>
 
+using std::vector;
 using std::map;
 
 #include "algebra.hpp"
@@ -13,6 +15,10 @@ KFState RTS_Process(
 	KFState&	kfState, 
 	bool		write = false);
 
+void RTS_ProcessConcurrent(
+	vector<KFState*>&	kfState_ptrs,
+	double				memoryBudget = 0);
+
 void RTS_Output(
 	KFState&	kfState,
 	string		clockFilename = "");
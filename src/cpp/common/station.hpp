@@ -61,6 +61,8 @@ struct Station : IonoStation, StationLogs
 	ClockJump			cj				= {};
 
 	string				traceFilename;
+
+	double				processingTime	= 0;		///< Wall time spent processing this station in its most recent epoch (s), used to schedule the stations of following epochs
 	
 	
 	bool		primaryApriori = false;
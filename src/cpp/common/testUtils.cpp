@@ -586,6 +586,25 @@ void TestStack::testMat(
 #endif
 }
 
+/** Compare sparse matrix against test dataset
+	*/
+void TestStack::testMat(
+	string									id,			///< ID value to append to stack
+	SparseMatrix<double, Eigen::RowMajor>&	mat,		///< Matrix data to compare
+	double									precision)	///< The threshold for failing a comparison
+{
+#ifdef	ENABLE_UNIT_TESTS
+	if	( (acsConfig.process_tests == false)
+		||(DontTest))
+	{
+		return;
+	}
+
+	MatrixXd dense = mat;
+	testMat(id, dense, precision);
+#endif
+}
+
 /** Compare matrix against test dataset
 	*/
 void TestStack::checkMat(
@@ -70,6 +70,11 @@ struct TestStack
 		MatrixXd&	mat,
 		double		precision = 1e-4);
 
+	static void testMat(
+		string									id,
+		SparseMatrix<double, Eigen::RowMajor>&	mat,
+		double									precision = 1e-4);
+
 	static void checkMat(
 		string		id,
 		MatrixXd&	mat);
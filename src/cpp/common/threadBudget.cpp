@@ -0,0 +1,181 @@
+
+#include <algorithm>
+#include <thread>
+
+#include "omp.h"
+
+#include "threadBudget.hpp"
+
+int								ThreadBudget::budget		= 0;
+map<int, int>					ThreadBudget::stageLimits;
+map<int, StageTiming>			ThreadBudget::stageTimings;
+std::mutex						ThreadBudget::timingsMutex;
+
+static const std::thread::id	mainThreadId		= std::this_thread::get_id();	///< Static initialisation is performed by the main thread
+thread_local StageScope*		activeStageScope	= nullptr;						///< Outermost stage running on this thread
+
+
+/** Set the total number of threads available, and any limits for individual stages.
+* A budget of zero uses all threads available to OpenMP.
+*/
+void ThreadBudget::configure(
+	int				threads,	///< Total number of threads to use (0 for all available)
+	map<int, int>&	limits)		///< Maximum threads for each stage (0 or missing for no limit)
+{
+	if (threads <= 0)
+	{
+		threads = omp_get_max_threads();
+	}
+
+	budget		= threads;
+	stageLimits	= limits;
+
+	Eigen::setNbThreads(budget);
+}
+
+/** Number of threads to use for a stage, within the total budget
+*/
+int ThreadBudget::stageThreads(
+	E_Stage		stage)		///< Stage to get the thread allocation for
+{
+	int threads = budget;
+	if (threads <= 0)
+	{
+		threads = omp_get_max_threads();
+	}
+
+	auto it = stageLimits.find(stage);
+	if	( (it != stageLimits.end())
+		&&(it->second > 0))
+	{
+		threads = std::min(threads, it->second);
+	}
+
+	return threads;
+}
+
+/** Output the accumulated timings of all stages that have been run
+*/
+void ThreadBudget::outputTimings(
+	Trace&		trace)		///< Trace to output to
+{
+	std::lock_guard<std::mutex> guard(timingsMutex);
+
+	tracepdeex(0, trace, "\n%-22s %8s %8s %12s %12s %12s", "Stage", "Threads", "Count", "Total (s)", "Mean (s)", "Longest (s)");
+
+	for (auto& [stage, timing] : stageTimings)
+	{
+		if (timing.count == 0)
+		{
+			continue;
+		}
+
+		tracepdeex(0, trace, "\n%-22s %8d %8d %12.3f %12.5f %12.5f",
+				E_Stage::_from_integral(stage)._to_string(),
+				timing.threads,
+				timing.count,
+				timing.total,
+				timing.total / timing.count,
+				timing.longest);
+	}
+
+	trace << std::endl;
+}
+
+StageScope::StageScope(
+	E_Stage		stage)		///< Stage that is being started
+:	stage	{stage}
+{
+	if (omp_in_parallel())
+	{
+		return;
+	}
+
+	if (activeStageScope)
+	{
+		threads = activeStageScope->threads;
+
+		return;
+	}
+
+	activeStageScope	= this;
+	active				= true;
+	threads				= ThreadBudget::stageThreads(stage);
+	start				= std::chrono::steady_clock::now();
+
+	if (std::this_thread::get_id() == mainThreadId)
+	{
+		setEigenThreads	= true;
+		previousThreads	= Eigen::nbThreads();
+
+		Eigen::setNbThreads(threads);
+	}
+}
+
+StageScope::~StageScope()
+{
+	if (active == false)
+	{
+		return;
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	{
+		std::lock_guard<std::mutex> guard(ThreadBudget::timingsMutex);
+
+		auto& timing = ThreadBudget::stageTimings[stage];
+
+		timing.count++;
+		timing.total	+= elapsed;
+		timing.longest	= std::max(timing.longest, elapsed);
+		timing.threads	= threads;
+	}
+
+	if (setEigenThreads)
+	{
+		Eigen::setNbThreads(previousThreads);
+	}
+
+	activeStageScope = nullptr;
+}
+
+/** Calculate the lower triangle of P += alpha * A' * B in parallel column blocks, then mirror it to the upper triangle.
+* Eigen does not parallelise products that are assigned to a triangular view, so the product is split into
+* independent blocks of columns, each of which is a general product over the rows at and below its diagonal.
+* The number of threads is taken from the current Eigen setting, as allocated by a StageScope.
+*/
+void lowerTriangularProduct(
+	MatrixXd&		P,			///< [in/out]	Symmetric matrix to update
+	const MatrixXd&	A,			///< [in]		Left factor (transposed in the product)
+	const MatrixXd&	B,			///< [in]		Right factor
+	double			alpha)		///< [in]		Scale of the product
+{
+	int n			= P.rows();
+	int threads		= Eigen::nbThreads();
+
+	if	( (threads <= 1)
+		||(n < 256))
+	{
+		P.triangularView<Eigen::Lower>() += alpha * A.transpose() * B;
+		P.triangularView<Eigen::StrictlyUpper>() = P.transpose();
+
+		return;
+	}
+
+	//small enough blocks to balance the triangular work between threads
+	int blockSize	= std::max(32, n / (threads * 4));
+	int numBlocks	= (n + blockSize - 1) / blockSize;
+
+#	pragma omp parallel for schedule(dynamic) num_threads(threads)
+	for (int block = 0; block < numBlocks; block++)
+	{
+		int col		= block * blockSize;
+		int cols	= std::min(blockSize, n - col);
+		int rows	= n - col;
+
+		P.block(col, col, rows, cols).noalias() += alpha * A.middleCols(col, rows).transpose() * B.middleCols(col, cols);
+	}
+
+	P.triangularView<Eigen::StrictlyUpper>() = P.transpose();
+}
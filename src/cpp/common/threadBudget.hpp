@@ -0,0 +1,76 @@
+#ifndef __THREAD_BUDGET_HPP__
+#define __THREAD_BUDGET_HPP__
+
+
+#include <chrono>
+#include <mutex>
+#include <map>
+
+using std::map;
+
+#include "eigenIncluder.hpp"
+#include "streamTrace.hpp"
+#include "enums.h"
+
+
+/** Accumulated timing for a processing stage
+*/
+struct StageTiming
+{
+	int		count		= 0;			///< Number of times the stage has been run
+	double	total		= 0;			///< Total wall time spent in the stage (seconds)
+	double	longest		= 0;			///< Longest single run of the stage (seconds)
+	int		threads		= 0;			///< Threads allocated to the stage on its last run
+};
+
+/** Allocation of threads to the large linear algebra stages of processing.
+* The total budget and any per-stage limits are taken from the configuration,
+* and the time spent in each stage is accumulated for reporting.
+*/
+struct ThreadBudget
+{
+	static int								budget;			///< Total threads available for processing
+	static map<int, int>					stageLimits;	///< Optional per-stage thread limits
+	static map<int, StageTiming>			stageTimings;	///< Accumulated timings, indexed by stage
+	static std::mutex						timingsMutex;	///< Lock for stageTimings, which may be updated by stages running on other threads
+
+	static void	configure(
+		int				threads,
+		map<int, int>&	limits);
+
+	static int	stageThreads(
+		E_Stage			stage);
+
+	static void	outputTimings(
+		Trace&			trace);
+};
+
+/** Scoped thread allocation and timing for a processing stage.
+* While the object exists Eigen (and any kernels that query it) use the threads allocated to the stage,
+* the previous setting is restored and the elapsed time is recorded when it goes out of scope.
+* Stages entered from within a parallel region are left single threaded and are not timed.
+* Stages entered while another stage is active on the same thread are counted as part of the outer stage, and use its allocation.
+* The Eigen thread setting is global, so it is only changed by stages running on the main thread.
+*/
+struct StageScope
+{
+	E_Stage									stage;
+	bool									active			= false;
+	bool									setEigenThreads	= false;	///< This scope changed the Eigen thread setting, and must restore it
+	int										threads			= 1;
+	int										previousThreads	= 1;
+	std::chrono::steady_clock::time_point	start;
+
+	StageScope(
+		E_Stage		stage);
+
+	~StageScope();
+};
+
+void lowerTriangularProduct(
+	MatrixXd&		P,
+	const MatrixXd&	A,
+	const MatrixXd&	B,
+	double			alpha);
+
+#endif
@@ -0,0 +1,368 @@
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <boost/log/trivial.hpp>
+
+#include "traceSink.hpp"
+
+using namespace std::literals::chrono_literals;
+
+TraceSinkManager traceSinks;
+
+
+TraceSinkManager::~TraceSinkManager()
+{
+	shutdown();
+}
+
+/** Queue a command and its data for the writer thread, starting the thread if required.
+* Blocks are pushed onto a lock free list, the writer takes the whole list at once and reverses it to recover the queued order.
+*/
+void TraceSinkManager::queue(
+	E_TraceCommand	command,		///< Action to perform on the file
+	const string&	filename,		///< File to write to
+	string&&		data)			///< Output to write after performing the action
+{
+	if	( filename.empty()
+		&&command != +E_TraceCommand::FLUSH)
+	{
+		return;
+	}
+
+	std::call_once(startFlag, [this]()
+	{
+		writerThread = std::thread(&TraceSinkManager::run, this);
+	});
+
+	auto block_ptr = new TraceBlock;
+	block_ptr->command	= command;
+	block_ptr->filename	= filename;
+	block_ptr->data		= std::move(data);
+
+	//counted before the block is visible to the writer, which subtracts it once written
+	queuedBytes += block_ptr->data.size();
+
+	if (command == +E_TraceCommand::FLUSH)
+	{
+		block_ptr->flushId = ++flushRequested;
+	}
+
+	TraceBlock* head = queueHead.load(std::memory_order_relaxed);
+	do
+	{
+		block_ptr->next = head;
+	}
+	while (queueHead.compare_exchange_weak(head, block_ptr, std::memory_order_release, std::memory_order_relaxed) == false);
+
+	if (head == nullptr)
+	{
+		//the writer may be idle, wake it
+		wakeCondition.notify_one();
+	}
+
+	if	( maxQueuedBytes	== 0
+		||queuedBytes		<= maxQueuedBytes
+		||std::this_thread::get_id() == writerThread.get_id())
+	{
+		return;
+	}
+
+	//the writer is not keeping up, wait for it rather than holding ever more output in memory
+	std::unique_lock<std::mutex> lock(wakeMutex);
+	drainCondition.wait(lock, [&]()
+	{
+		return queuedBytes <= maxQueuedBytes
+			|| stop;
+	});
+}
+
+/** Have all output queued so far passed to the operating system.
+* The writer is always asked to flush, waiting for it is optional so that the processing loop need not stall.
+*/
+void TraceSinkManager::flush(
+	bool	wait)		///< Wait for the flush to complete
+{
+	if (writerThread.joinable() == false)
+	{
+		//nothing has been queued
+		return;
+	}
+
+	queue(E_TraceCommand::FLUSH, "", "");
+
+	if (wait == false)
+	{
+		return;
+	}
+
+	long int flushId = flushRequested;
+
+	std::unique_lock<std::mutex> lock(wakeMutex);
+	flushCondition.wait(lock, [&]()
+	{
+		return flushCompleted >= flushId;
+	});
+}
+
+/** Write out all queued output, close all files and stop the writer thread
+*/
+void TraceSinkManager::shutdown()
+{
+	if (writerThread.joinable() == false)
+	{
+		return;
+	}
+
+	stop = true;
+	wakeCondition.notify_one();
+
+	writerThread.join();
+}
+
+/** Get the open file for a filename, opening it with a large buffer if required
+*/
+TraceSink* TraceSinkManager::getSink(
+	const string&	filename,		///< File to get sink for
+	bool			truncate)		///< Discard any existing contents of the file
+{
+	useCount++;
+
+	auto it = sinkMap.find(filename);
+	if (it != sinkMap.end())
+	{
+		auto& sink = *it->second;
+
+		if (truncate == false)
+		{
+			sink.lastUse = useCount;
+			return &sink;
+		}
+
+		sinkMap.erase(it);
+	}
+
+	if (maxOpenFiles == 0)
+	{
+		//leave plenty of descriptors for input files and streams
+		rlimit limit;
+		getrlimit(RLIMIT_NOFILE, &limit);
+
+		maxOpenFiles = std::max(limit.rlim_cur / 2, (rlim_t) 16);
+	}
+
+	if (sinkMap.size() >= maxOpenFiles)
+	{
+		auto oldest = sinkMap.begin();
+		for (auto it = sinkMap.begin(); it != sinkMap.end(); it++)
+		{
+			if (it->second->lastUse < oldest->second->lastUse)
+			{
+				oldest = it;
+			}
+		}
+
+		sinkMap.erase(oldest);
+	}
+
+	auto sink_ptr = std::make_unique<TraceSink>();
+	auto& sink = *sink_ptr;
+
+	//the buffer must be set before the file is opened
+	sink.buffer = unique_ptr<char[]>(new char[bufferSize]);
+	sink.stream.rdbuf()->pubsetbuf(sink.buffer.get(), bufferSize);
+
+	if (truncate)	sink.stream.open(filename, std::ofstream::out | std::ofstream::trunc);
+	else			sink.stream.open(filename, std::ofstream::out | std::ofstream::app);
+
+	if (!sink.stream)
+	{
+		BOOST_LOG_TRIVIAL(error)
+		<< "Could not open trace file " << filename;
+
+		return nullptr;
+	}
+
+	sink.lastUse = useCount;
+
+	auto& entry = sinkMap[filename];
+	entry = std::move(sink_ptr);
+
+	return entry.get();
+}
+
+/** Perform the action of a single queued block
+*/
+void TraceSinkManager::process(
+	TraceBlock&		block)		///< Block to process
+{
+	switch (block.command)
+	{
+		case E_TraceCommand::WRITE:
+		case E_TraceCommand::CREATE:
+		{
+			bool truncate = (block.command == +E_TraceCommand::CREATE);
+
+			auto sink_ptr = getSink(block.filename, truncate);
+			if (sink_ptr == nullptr)
+			{
+				return;
+			}
+
+			sink_ptr->stream.write(block.data.data(), block.data.size());
+
+			break;
+		}
+		case E_TraceCommand::CLOSE:
+		{
+			sinkMap.erase(block.filename);
+
+			break;
+		}
+		case E_TraceCommand::FLUSH:
+		{
+			for (auto& [filename, sink_ptr] : sinkMap)
+			{
+				sink_ptr->stream.flush();
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(wakeMutex);
+
+				flushCompleted = block.flushId;
+			}
+
+			flushCondition.notify_all();
+
+			break;
+		}
+	}
+}
+
+/** Writer thread, processes queued blocks in the order they were queued
+*/
+void TraceSinkManager::run()
+{
+	while (true)
+	{
+		TraceBlock* list = queueHead.exchange(nullptr, std::memory_order_acquire);
+		if (list == nullptr)
+		{
+			if (stop)
+			{
+				break;
+			}
+
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wakeCondition.wait_for(lock, 20ms, [&]()
+			{
+				return queueHead.load() != nullptr
+					|| stop;
+			});
+
+			continue;
+		}
+
+		//reverse the list into queued order
+		TraceBlock* first = nullptr;
+		while (list)
+		{
+			TraceBlock* next = list->next;
+			list->next	= first;
+			first		= list;
+			list		= next;
+		}
+
+		while (first)
+		{
+			TraceBlock* next = first->next;
+
+			process(*first);
+
+			queuedBytes -= first->data.size();
+
+			delete first;
+			first = next;
+		}
+
+		//release any threads waiting for the queue to drain
+		{
+			std::lock_guard<std::mutex> guard(wakeMutex);
+		}
+
+		drainCondition.notify_all();
+	}
+
+	//closing the files writes out their buffers
+	sinkMap.clear();
+
+	{
+		std::lock_guard<std::mutex> guard(wakeMutex);
+
+		flushCompleted = (long int) flushRequested;
+	}
+
+	flushCondition.notify_all();
+	drainCondition.notify_all();
+}
+
+
+TraceStream::TraceStream(
+	const string&	filename,		///< File to write to when the stream is destroyed
+	bool			truncate)		///< Create the file, discarding any previous contents
+:	std::ostream	(nullptr),
+	filename		(filename),
+	truncate		(truncate)
+{
+	rdbuf(&buffer);
+
+	if	( filename.empty())
+	{
+		setstate(std::ios::badbit);
+	}
+}
+
+TraceStream::TraceStream(
+	TraceStream&&	other)
+:	std::ostream	(std::move(other)),
+	filename		(std::move(other.filename)),
+	truncate		(other.truncate),
+	buffer			(std::move(other.buffer))
+{
+	set_rdbuf(&buffer);
+
+	other.filename.clear();
+}
+
+TraceStream::~TraceStream()
+{
+	queueOutput();
+}
+
+/** Queue the output collected so far to the trace writer
+*/
+void TraceStream::queueOutput()
+{
+	if (filename.empty())
+	{
+		return;
+	}
+
+	string data = buffer.str();
+
+	if	( data.empty()
+		&&truncate == false)
+	{
+		return;
+	}
+
+	buffer.str("");
+
+	if (truncate)	traceSinks.queue(E_TraceCommand::CREATE,	filename, std::move(data));
+	else			traceSinks.queue(E_TraceCommand::WRITE,		filename, std::move(data));
+
+	//any further output follows what was just written
+	truncate = false;
+}
@@ -0,0 +1,121 @@
+#ifndef __TRACE_SINK_HPP__
+#define __TRACE_SINK_HPP__
+
+
+#include <condition_variable>
+#include <unordered_map>
+#include <ostream>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+using std::unordered_map;
+using std::unique_ptr;
+using std::string;
+
+#include "enums.h"
+
+
+/** Block of output queued for the trace writer thread
+*/
+struct TraceBlock
+{
+	TraceBlock*		next		= nullptr;
+	E_TraceCommand	command		= E_TraceCommand::WRITE;
+	string			filename;
+	string			data;
+	long int		flushId		= 0;
+};
+
+/** Open output file held by the trace writer thread
+*/
+struct TraceSink
+{
+	unique_ptr<char[]>	buffer;						///< Declared before the stream so that it outlives it
+	std::ofstream		stream;
+	long int			lastUse		= 0;
+};
+
+/** Owner of all trace type output files.
+* Output is queued from any thread without locking and written by a single background thread,
+* which keeps the files open with large buffers, so that tracing costs no file system calls in the processing loop.
+* Files are created (truncated) and closed by queued commands so that rotation is ordered with the output around it,
+* and are flushed to the operating system whenever a flush is requested, eg at the end of each epoch.
+* If the writer falls behind, threads queueing output wait for it once the queued output exceeds maxQueuedBytes, so that memory use is bounded.
+*/
+struct TraceSinkManager
+{
+	size_t							bufferSize		= 1 << 18;		///< Size of the output buffer for each open file
+	size_t							maxOpenFiles	= 0;			///< Least recently used files are closed beyond this limit (0 for half the process limit)
+	size_t							maxQueuedBytes	= 1 << 28;		///< Queueing blocks until the writer has caught up beyond this much queued output (0 for no limit)
+
+	std::atomic<size_t>				queuedBytes		= 0;			///< Size of output queued but not yet written
+
+	std::atomic<TraceBlock*>		queueHead		= nullptr;		///< Most recently queued block, blocks are linked to those queued before them
+	std::atomic<long int>			flushRequested	= 0;
+	std::atomic<long int>			flushCompleted	= 0;
+	std::atomic<bool>				stop			= false;
+
+	std::once_flag					startFlag;
+	std::thread						writerThread;
+	std::mutex						wakeMutex;
+	std::condition_variable			wakeCondition;
+	std::condition_variable			flushCondition;
+	std::condition_variable			drainCondition;
+
+	unordered_map<string, unique_ptr<TraceSink>>	sinkMap;		///< Open files, only used by the writer thread
+	long int										useCount	= 0;
+
+	~TraceSinkManager();
+
+	void	queue(
+		E_TraceCommand	command,
+		const string&	filename,
+		string&&		data);
+
+	void	flush(
+		bool			wait = true);
+
+	void	shutdown();
+
+protected:
+	void	run();
+
+	void	process(
+		TraceBlock&		block);
+
+	TraceSink*	getSink(
+		const string&	filename,
+		bool			truncate);
+};
+
+extern TraceSinkManager traceSinks;
+
+/** Output stream for trace files.
+* Output is collected in memory and queued to the trace writer when the stream is destroyed,
+* long lived streams may queue their output as they go.
+* Streams with no filename discard their output.
+*/
+struct TraceStream : std::ostream
+{
+	string			filename;
+	bool			truncate	= false;
+	std::stringbuf	buffer;
+
+	TraceStream(
+		const string&	filename,
+		bool			truncate = false);
+
+	TraceStream(
+		TraceStream&&	other);
+
+	~TraceStream();
+
+	void	queueOutput();
+};
+
+#endif
@@ -4,7 +4,15 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include <unordered_set>
+#include <mutex>
+
+using std::unordered_set;
+
+#include <boost/filesystem.hpp>
+
 #include "streamTrace.hpp"
+#include "traceSink.hpp"
 #include "acsConfig.hpp"
 #include "constants.h"
 #include "station.hpp"
@@ -23,7 +31,7 @@ void outputReceiverClocks(
 	KFState&	kfState,	///< Kalman filter to pull clocks from
 	double*		epoch)		///< Epoch time
 {
-	std::ofstream clockFile(filename, std::ofstream::app);
+	TraceStream clockFile(filename);
 
 	/* output receiver clock value */
 	for (auto& [key, index] : kfState.kfIndexMap)
@@ -50,7 +58,6 @@ void outputReceiverClocks(
 						stddev);
 		}
 	}
-	clockFile.flush();
 	return;
 }
 
@@ -61,7 +68,7 @@ void outputSatelliteClocks(
 	KFState&	kfState,	///< Kalman filter to pull clocks from
 	double*		epoch)		///< Epoch time
 {
-	std::ofstream clockFile(filename, std::ofstream::app);
+	TraceStream clockFile(filename);
 
 	for (auto& [key, index] : kfState.kfIndexMap)
 	{
@@ -94,7 +101,6 @@ void outputSatelliteClocks(
 			}
 		}
 	}
-	clockFile.flush();
 	return;
 }
 
@@ -105,14 +111,30 @@ void outputClockfileHeader(
 	KFState&	kfState,	///< Kalman filter to pull clocks from
 	double*		epoch)		///< Epoch time
 {
-	std::ofstream clockFile(filename, std::ofstream::app);
-	
-	auto pos = clockFile.tellp();
-	if (pos != 0)
+	//only check the file itself the first time, once all previous output for it has been written
+	//the lock is held until the header has been queued, so that no other thread can output clocks before it
+	static std::mutex				checkedFilesMutex;
+	static unordered_set<string>	checkedFiles;
+
+	std::lock_guard<std::mutex> guard(checkedFilesMutex);
+
+	if (checkedFiles.insert(filename).second == false)
 	{
 		return;
 	}
 
+	traceSinks.flush();
+
+	boost::system::error_code ec;
+	auto size = boost::filesystem::file_size(filename, ec);
+	if	( !ec
+		&&size != 0)
+	{
+		return;
+	}
+
+	TraceStream clockFile(filename);
+
 	/* determine satellite system type */
 	char syschar		= 0;
 	int firstBiasGroup	= 0;
@@ -1,6 +1,7 @@
 
 #include "observations.hpp"
 #include "streamTrace.hpp"
+#include "traceSink.hpp"
 #include "corrections.hpp"
 #include "ionoModel.hpp"
 #include "acsConfig.hpp"
@@ -166,7 +167,7 @@ void write_receivr_measr(
 	
 	tracepdeex(2, trace, "Writing Ionosphere measurements %5d %12.3f  %4d %2d ", week, tow, stations.size(), nlayer);
 
-	std::ofstream stecfile(acsConfig.ionstec_filename, std::ofstream::app);
+	TraceStream stecfile(acsConfig.ionstec_filename);
 
 	tracepdeex(2,stecfile,"\n#IONO_MEAS  week       tow        sta  sat  Iono. meas  Iono. var.  state  # layers");
 
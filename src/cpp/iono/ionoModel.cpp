@@ -9,6 +9,7 @@ using std::map;
 #include "algebra.hpp"
 #include "common.hpp"
 #include "testUtils.hpp"
+#include "traceSink.hpp"
 #include "acsConfig.hpp"
 #include "enums.h"
 
@@ -28,12 +29,15 @@ extern int config_ionosph_model()
 {
 	fp_iondebug = nullptr;
 	
-	if (acsConfig.output_ionstec) std::ofstream(acsConfig.ionstec_filename);
+	if (acsConfig.output_ionstec) TraceStream(acsConfig.ionstec_filename, true);
 	if (acsConfig.output_ionex)   std::ofstream(acsConfig.ionex_filename);
 	
 	iono_KFState.max_filter_iter	= acsConfig.ionFilterOpts.max_filter_iter;
 	iono_KFState.max_prefit_remv	= acsConfig.ionFilterOpts.max_prefit_remv;
 	iono_KFState.inverter			= acsConfig.ionFilterOpts.inverter;
+	iono_KFState.chunk_size			= acsConfig.ionFilterOpts.chunk_size;
+	iono_KFState.incremental_rejection	= acsConfig.ionFilterOpts.incremental_rejection;
+	iono_KFState.rts_spill				= acsConfig.ionFilterOpts.rts_spill;
 		
 	// fp_iondebug = fopen("iono_debug_trace.txt", "w");
 	switch (acsConfig.ionFilterOpts.model)
@@ -149,7 +153,7 @@ void update_ionosph_model(
 	} 
 	
 	//add measurements and create design matrix entries
-	KFMeasEntryList kfMeasEntryList;
+	KFMeasBuilder measBuilder(iono_KFState);
 
 	for (auto& rec_ptr	: stations)
 	{
@@ -166,7 +170,7 @@ void update_ionosph_model(
 			ObsKey obsKey;
 			obsKey.Sat = obs.Sat;
 			obsKey.str = sta;
-			KFMeasEntry meas(&iono_KFState, obsKey);
+			KFMeasRef meas = measBuilder.addMeas(obsKey);
 			meas.setValue(obs.STECsmth);
 			meas.setNoise(obs.STECsmvr);
 			
@@ -214,11 +218,9 @@ void update_ionosph_model(
 				meas.addDsgnEntry(ionModelKey, coef, ionModelInit);
 				
 				tracepde(5, trace,"#IONO_MOD %s %4d %9.5f %10.5f %8.5f %8.5f %12.5e %9.5f %12.5e\n",
-					((string)meas.obsKey).c_str(), i, obs.latIPP[0]*R2D, obs.lonIPP[0]*R2D, obs.angIPP[0], 
+					((string)meas.obsKey()).c_str(), i, obs.latIPP[0]*R2D, obs.lonIPP[0]*R2D, obs.angIPP[0], 
 					obs.STECtoDELAY, coef, obs.STECsmth, obs.STECsmvr);
 			}
-			
-			kfMeasEntryList.push_back(meas);
 		}
 	}
 	
@@ -226,7 +228,7 @@ void update_ionosph_model(
 	iono_KFState.stateTransition(trace, iontime);
 
 	//combine the measurement list into a single design matrix, measurement vector, and measurement noise vector
-	KFMeas combinedMeas = iono_KFState.combineKFMeasList(kfMeasEntryList);
+	KFMeas combinedMeas = measBuilder.combine();
 
 	//if there are uninitialised state values, estimate them using least squares
 	if (iono_KFState.lsqRequired)
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <future>
 #include <chrono>
 #include <thread>
 #include <string>
@@ -27,6 +28,10 @@ using std::string;
 #include "networkEstimator.hpp"
 #include "peaCommitVersion.h"
 #include "algebraTrace.hpp"
+#include "threadBudget.hpp"
+#include "productLoader.hpp"
+#include "traceSink.hpp"
+#include "fileWatcher.hpp"
 #include "rtsSmoothing.hpp"
 #include "corrections.hpp"
 #include "streamTrace.hpp"
@@ -98,6 +103,12 @@ void dumpConfig(Trace& trace)
 
 bool fileChanged(string filename)
 {
+	//only files with change notifications (or without notification available) need to be checked
+	if (fileWatcher.changed(filename) == false)
+	{
+		return false;
+	}
+
 	bool valid = checkValidFile(filename);
 	if (valid == false)
 	{
@@ -120,6 +131,13 @@ void removeInvalidFiles(
 	for (auto it = files.begin(); it != files.end(); )
 	{
 		auto& filename = *it;
+		if (fileWatcher.pending(filename) == false)
+		{
+			//unchanged since it was last found to be valid
+			it++;
+			continue;
+		}
+
 		bool valid = checkValidFile(filename);
 		if (valid == false)
 		{
@@ -178,8 +196,27 @@ void recordNetworkStatistics(std::multimap<std::string, std::shared_ptr<NtripRtc
 						<< runData << "," << connData << "}";	
 }
 
-void reloadInputFiles()
+std::future<unordered_map<int, PephList>> sp3Reload;		///< Precise ephemerides being parsed in the background, to replace those in nav at the next reload
+
+/** Load any input files that have changed since they were last loaded.
+* When any sp3 file changes all of them are parsed again, and when background loading is requested this is done in a separate buffer while processing continues,
+* and the results are swapped into the navigation data at the start of the following call.
+*/
+void reloadInputFiles(
+	bool	background = false)		///< Parse large products in the background, for use from the next epoch
 {
+	bool preciseUpdated	= false;
+	bool navUpdated		= false;
+
+	if (sp3Reload.valid())
+	{
+		auto pephMap = sp3Reload.get();
+
+		nav.pephMap.swap(pephMap);
+
+		preciseUpdated = true;
+	}
+
 	removeInvalidFiles(acsConfig.atxfiles);
 	for (auto& atxfile : acsConfig.atxfiles)
 	{
@@ -199,6 +236,8 @@ void reloadInputFiles()
 
 			continue;
 		}
+
+		navUpdated = true;
 	}
 
 	removeInvalidFiles(acsConfig.erpfiles);
@@ -240,10 +279,13 @@ void reloadInputFiles()
 		if (updated)
 		{
 			orb2sp3(nav);
+
+			preciseUpdated = true;
 		}
 	}
 	else
 	{
+		bool changed = false;
 		for (auto& sp3file : acsConfig.sp3files)
 		{
 			if (fileChanged(sp3file) == false)
@@ -254,8 +296,27 @@ void reloadInputFiles()
 			BOOST_LOG_TRIVIAL(info)
 			<< "Loading SP3 file " << sp3file << std::endl;
 
-			nav.pephMap.clear();
-			readsp3(sp3file, &nav, 0);
+			changed = true;
+		}
+
+		//the lists are rebuilt from all files together, so that overlapping files are combined consistently
+		if	( changed
+			&&background)
+		{
+			sp3Reload = std::async(std::launch::async, [sp3files = acsConfig.sp3files]()
+			{
+				return readSp3Files(sp3files);
+			});
+		}
+		else if (changed)
+		{
+			StageScope scope(E_Stage::PRODUCTS);
+
+			auto pephMap = readSp3Files(acsConfig.sp3files);
+
+			nav.pephMap.swap(pephMap);
+
+			preciseUpdated = true;
 		}
 	}
 
@@ -273,9 +334,12 @@ void reloadInputFiles()
 		FileRinexStream rinexStream(navfile);
 
 		rinexStream.parse();
+
+		navUpdated = true;
 	}
 
 	removeInvalidFiles(acsConfig.clkfiles);
+	vector<string> changedClkFiles;
 	for (auto& clkfile : acsConfig.clkfiles)
 	{
 		if (fileChanged(clkfile) == false)
@@ -287,9 +351,16 @@ void reloadInputFiles()
 		BOOST_LOG_TRIVIAL(info)
 		<< "Loading CLK file " << clkfile;
 
-		FileRinexStream rinexStream(clkfile);
+		changedClkFiles.push_back(clkfile);
+	}
 
-		rinexStream.parse();
+	if (changedClkFiles.empty() == false)
+	{
+		StageScope scope(E_Stage::PRODUCTS);
+
+		readClkFiles(changedClkFiles, nav);
+
+		preciseUpdated = true;
 	}
 
 	removeInvalidFiles(acsConfig.dcbfiles);
@@ -359,25 +430,28 @@ void reloadInputFiles()
 		
 		once = false;
 	}
-}
 
-template<typename T>
-std::ofstream getTraceFile(
-	T& thing)
-{
-	if (thing.traceFilename.empty())
+	if (preciseUpdated)
 	{
-		return std::ofstream();
+		buildPreciseCache(nav);
 	}
-	
-	std::ofstream trace(thing.traceFilename, std::ios::app);
-	if (!trace)
+
+	//shared satellite states calculated from the old products are no longer valid
+	if	( preciseUpdated
+		||navUpdated)
 	{
-		BOOST_LOG_TRIVIAL(error)
-		<< "Could not open trace file for " << thing.id << " at " << thing.traceFilename;
+		satStateCache.clear();
 	}
-	
-	return trace;
+}
+
+/** Get a stream for the trace file of a station, network, or stream.
+* Output is written to the file in the background once the stream goes out of scope
+*/
+template<typename T>
+TraceStream getTraceFile(
+	T& thing)
+{
+	return TraceStream(thing.traceFilename);
 }
 
 void createNewTraceFile(
@@ -399,6 +473,12 @@ void createNewTraceFile(
 		return;
 	}
 			
+	if (old_path_trace.empty() == false)
+	{
+		//the previous file wont be written again, release it
+		traceSinks.queue(E_TraceCommand::CLOSE, old_path_trace + suffix, "");
+	}
+	
 	old_path_trace = new_path_trace;
 	
 	string suffixedPath = old_path_trace + suffix;
@@ -406,14 +486,7 @@ void createNewTraceFile(
 	BOOST_LOG_TRIVIAL(debug)
 	<< "\tCreating new file for " << id << " at " << suffixedPath;
 	
-	ofstream trace(suffixedPath);
-	if (!trace)
-	{
-		BOOST_LOG_TRIVIAL(error)
-		<< "Could not create file for " << id << " at " << suffixedPath;
-		
-		return;
-	}
+	TraceStream trace(suffixedPath, true);
 	
 	// Trace file head
 	if (outputHeader)
@@ -508,6 +581,8 @@ void mainOncePerEpochPerStation(
 {
 	TestStack ts(rec.id);
 
+	auto startTime = std::chrono::steady_clock::now();
+
 	auto trace = getTraceFile(rec);
 
 	trace << std::endl << "################# Starting Epoch " << epoch << " << ############" << std::endl;
@@ -597,22 +672,15 @@ void mainOncePerEpochPerStation(
 			Vector3d diffEnu;
 			diffEnu = Vector3d::Map(diffEnuArr, diffEnu.rows());
 
-			std::ofstream fout(acsConfig.ppp_sol_filename, std::ios::out | std::ios::app);
-			if (!fout)
-			{
-				BOOST_LOG_TRIVIAL(error)
-				<< "Could not open trace file for PPP solution at " << acsConfig.ppp_sol_filename;
-			}
-			else
-			{
-				fout << epoch << " ";
-				fout << rec.id << " ";
-				fout << snxPos.transpose() << " ";
-				fout << estPos.transpose() << " ";
-				fout << diffEcef.transpose() << " ";
-				fout << diffEnu.transpose() << " ";
-				fout << std::endl;
-			}
+			TraceStream fout(acsConfig.ppp_sol_filename);
+			
+			fout << epoch << " ";
+			fout << rec.id << " ";
+			fout << snxPos.transpose() << " ";
+			fout << estPos.transpose() << " ";
+			fout << diffEcef.transpose() << " ";
+			fout << diffEnu.transpose() << " ";
+			fout << std::endl;
 		}
 	}
 
@@ -647,7 +715,7 @@ void mainOncePerEpochPerStation(
 		&&(epoch > acsConfig.pppOpts.rts_lag))
 	{
 		KFState rts = RTS_Process(rec.rtk.pppState);
-		std::ofstream rtsTrace(rec.rtk.pppState.rts_filename + SMOOTHED_SUFFIX, std::ofstream::out | std::ofstream::app);
+		TraceStream rtsTrace(rec.rtk.pppState.rts_filename + SMOOTHED_SUFFIX);
 		pppoutstat(rtsTrace, rts);
 
 #		ifdef ENABLE_MONGODB
@@ -671,6 +739,10 @@ void mainOncePerEpochPerStation(
 		mongoStates(rec.rtk.pppState);
 	}
 #	endif
+
+	rec.processingTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	trace << std::endl << "Station processing took " << rec.processingTime << "s (thread " << omp_get_thread_num() << ")" << std::endl;
 }
 
 void mainOncePerEpoch(
@@ -752,7 +824,7 @@ void mainOncePerEpoch(
 		{
 			KFState rts = RTS_Process(net.kfState, false);
 			
-			std::ofstream rtsTrace(net.kfState.rts_filename + SMOOTHED_SUFFIX, std::ofstream::out | std::ofstream::app);
+			TraceStream rtsTrace(net.kfState.rts_filename + SMOOTHED_SUFFIX);
 			
 			if (rts.time != GTime::noTime())
 			{
@@ -800,7 +872,7 @@ void mainOncePerEpoch(
 
 	if (acsConfig.output_persistance)
 	{
-		outputPersistanceNav();
+		outputPersistance(net.kfState, epochStations);
 	}
 
 	TestStack::saveData();
@@ -846,7 +918,13 @@ void mainPostProcessing(
 		BOOST_LOG_TRIVIAL(info)
 		<< "Storing persistant states to continue processing...";
 
-		outputPersistanceStates(stationMap, net.kfState);
+		StationList stations;
+		for (auto& [id, rec] : stationMap)
+		{
+			stations.push_back(&rec);
+		}
+
+		outputPersistance(net.kfState, stations, true);
 	}
 
 	if (acsConfig.process_network)
@@ -858,19 +936,18 @@ void mainPostProcessing(
 	if	(acsConfig.process_rts)
 	{
 		if (acsConfig.pppOpts.rts_lag < 0)
-		for (auto& [id, rec] : stationMap)
 		{
 			BOOST_LOG_TRIVIAL(info)
 			<< std::endl
 			<< "---------------PROCESSING PPP WITH RTS------------------------- " << std::endl;
 
-			RTS_Process(rec.rtk.pppState, true);
-
-			BOOST_LOG_TRIVIAL(info)
-			<< std::endl
-			<< "---------------OUTPUTTING PPP RTS RESULTS---------------------- " << std::endl;
+			vector<KFState*> kfState_ptrs;
+			for (auto& [id, rec] : stationMap)
+			{
+				kfState_ptrs.push_back(&rec.rtk.pppState);
+			}
 
-			RTS_Output(rec.rtk.pppState);
+			RTS_ProcessConcurrent(kfState_ptrs, acsConfig.pppOpts.rts_memory_budget);
 		}
 
 		if (acsConfig.netwOpts.rts_lag < 0)
@@ -968,6 +1045,8 @@ int main(int argc, char **argv)
 	TestStack::openData();
 
 
+	ThreadBudget::configure(acsConfig.thread_budget, acsConfig.stage_threads);
+
 	BOOST_LOG_TRIVIAL(info)
 	<< "Threading with " << Eigen::nbThreads()
 	<< " threads" << std::endl;
@@ -1089,7 +1168,7 @@ int main(int argc, char **argv)
 	}
 	if (acsConfig.output_ppp_sol)
 	{
-		std::ofstream(acsConfig.ppp_sol_filename);
+		TraceStream(acsConfig.ppp_sol_filename, true);
 	}
 
 	Network net;
@@ -1097,6 +1176,9 @@ int main(int argc, char **argv)
 		net.kfState.max_filter_iter		= acsConfig.netwOpts.max_filter_iter;
 		net.kfState.max_prefit_remv		= acsConfig.netwOpts.max_prefit_remv;
 		net.kfState.inverter			= acsConfig.netwOpts.inverter;
+		net.kfState.chunk_size			= acsConfig.netwOpts.chunk_size;
+		net.kfState.incremental_rejection	= acsConfig.netwOpts.incremental_rejection;
+		net.kfState.rts_spill				= acsConfig.netwOpts.rts_spill;
 		net.kfState.output_residuals	= acsConfig.output_residuals;
 		net.kfState.rejectCallbacks.push_back(deweightMeas);
 		net.kfState.rejectCallbacks.push_back(incrementPhaseSignalError);
@@ -1150,8 +1232,15 @@ int main(int argc, char **argv)
 	bool complete = false;
 	int loopEpochs = 1;
 	auto nextNominalLoopStartTime = system_clock::now();
+	std::future<void> obsPrefetch;
 	while (complete == false)
 	{
+		//streams may still be decoding observations for this epoch in the background, wait before using them
+		if (obsPrefetch.valid())
+		{
+			obsPrefetch.get();
+		}
+
 		if (tsync != GTime::noTime())
 		{
 			tsync.time				+= loopEpochs * acsConfig.epoch_interval;
@@ -1297,6 +1386,9 @@ int main(int argc, char **argv)
 						rec.rtk.pppState.max_filter_iter	= acsConfig.pppOpts.max_filter_iter;
 						rec.rtk.pppState.max_prefit_remv	= acsConfig.pppOpts.max_prefit_remv;
 						rec.rtk.pppState.inverter			= acsConfig.pppOpts.inverter;
+						rec.rtk.pppState.chunk_size			= acsConfig.pppOpts.chunk_size;
+						rec.rtk.pppState.incremental_rejection	= acsConfig.pppOpts.incremental_rejection;
+						rec.rtk.pppState.rts_spill				= acsConfig.pppOpts.rts_spill;
 						rec.rtk.pppState.output_residuals	= acsConfig.output_residuals;
 
 						rec.rtk.pppState.rejectCallbacks.push_back(countSignalErrors);
@@ -1375,7 +1467,6 @@ int main(int argc, char **argv)
 			auto down_it = ntripRtcmMultimap.find(rec.id);
 			if( down_it != ntripRtcmMultimap.end() )
 			{
-				std::ofstream stecfile(acsConfig.ionstec_filename, std::ofstream::app);
 				auto trace = getTraceFile(rec);
 				trace << std::endl << "<<<<<<<<<<< Network Trace : Epoch " << epoch << " >>>>>>>>>>>" << std::endl;      
 				NtripRtcmStream& downStream = *down_it->second;
@@ -1453,27 +1544,68 @@ int main(int argc, char **argv)
 		auto epochStartTime = boost::posix_time::from_time_t(system_clock::to_time_t(system_clock::now()));
 
 		acsConfig.parse();
-		reloadInputFiles();
-		
-#		ifdef ENABLE_PARALLELISATION
-#		ifndef ENABLE_UNIT_TESTS
-		Eigen::setNbThreads(1);
-#			pragma omp parallel for
-#		endif
-#		endif
-		for (int i = 0; i < epochStations.size(); i++)
+		reloadInputFiles(true);
+
+		if (acsConfig.pipeline_depth > 0)
 		{
-			auto rec_ptr_iterator = epochStations.begin();
-			std::advance(rec_ptr_iterator, i);
+			//decode observations for the following epochs while this one is processed, processing order is unchanged
+			vector<ACSObsStreamPtr> obsStreams;
+			for (auto& [id, s] : obsStreamMultimap)
+			{
+				obsStreams.push_back(s);
+			}
+
+			obsPrefetch = std::async(std::launch::async, [obsStreams]()
+			{
+				for (auto& obsStream_ptr : obsStreams)
+				{
+					//the current epoch remains at the front of each stream until it is eaten
+					obsStream_ptr->prefetchObs(acsConfig.pipeline_depth + 1);
+				}
+			});
+		}
+		
+		//satellite states from the previous epoch may use outdated ephemerides
+		satStateCache.clear();
 
-			Station& rec = **rec_ptr_iterator;
-			mainOncePerEpochPerStation(rec, orog, gptg);
-		}	
+		{
+			StageScope stageScope(E_Stage::STATIONS);
 
-		Eigen::setNbThreads(0);
+			//start the most expensive stations first, so that the cheaper ones fill in around them, stations without history are assumed expensive
+			vector<Station*> scheduledStations(epochStations.begin(), epochStations.end());
+			std::stable_sort(scheduledStations.begin(), scheduledStations.end(), [](Station* a, Station* b)
+			{
+				if (a->processingTime == 0)		return b->processingTime != 0;
+				if (b->processingTime == 0)		return false;
+												return a->processingTime > b->processingTime;
+			});
+
+#			ifdef ENABLE_PARALLELISATION
+#			ifndef ENABLE_UNIT_TESTS
+			Eigen::setNbThreads(1);
+#				pragma omp parallel for num_threads(stageScope.threads) schedule(dynamic)
+#			endif
+#			endif
+			for (int i = 0; i < scheduledStations.size(); i++)
+			{
+				Station& rec = *scheduledStations[i];
+				mainOncePerEpochPerStation(rec, orog, gptg);
+			}
+		}
 
 		mainOncePerEpoch(net, epochStations, tsync);
 
+		if (acsConfig.ephemeris_retention > 0)
+		{
+			//ephemerides older than the validity period are never selected again, keep at least that long
+			double retention = std::max(acsConfig.ephemeris_retention, MAXDTOE);
+
+			pruneEphemerides(tsync - retention, nav);
+		}
+
+		//pass this epoch's trace output to the operating system, without waiting for it
+		traceSinks.flush(false);
+
 		auto epochStopTime = boost::posix_time::from_time_t(system_clock::to_time_t(system_clock::now()));
 
 		int week;
@@ -1520,6 +1652,11 @@ int main(int argc, char **argv)
 	}
 
 
+	if (obsPrefetch.valid())
+	{
+		obsPrefetch.get();
+	}
+
 #ifndef	ENABLE_UNIT_TESTS
 	// Disconnect the downloading clients and stop the io_service for clean shutdown.
 	for (auto& [id, s] : ntripRtcmMultimap)
@@ -1544,6 +1681,15 @@ int main(int argc, char **argv)
 
 	mainPostProcessing(net, stationMap);
 
+	traceSinks.flush();
+
+	std::stringstream stageTimings;
+	ThreadBudget::outputTimings(stageTimings);
+
+	BOOST_LOG_TRIVIAL(info)
+	<< std::endl
+	<< "Processing stage timings:" << stageTimings.str();
+
 	auto peaStopTime = boost::posix_time::from_time_t(system_clock::to_time_t(system_clock::now()));
 
 	BOOST_LOG_TRIVIAL(info)
@@ -25,18 +25,17 @@ void minimum(
 
 	//Determine transformation state
 	KFState			kfStateTrans;
-	KFMeasEntryList	measList;
 
 	kfStateTrans.initFilterEpoch();
 
+	//one measurement per state, in state index order so that the generalised inverse lines up with the filter states.
+	//states that are not constrained keep a null measurement, its needed for inverse later
+	vector<KFMeasEntry> measVec(kfStateStations.x.rows(), KFMeasEntry(&kfStateTrans));
+
 	for (auto& [key, index] : kfStateStations.kfIndexMap)
 	{
-		KFMeasEntry meas(&kfStateTrans);
-
 		if (key.type != KF::REC_POS)
 		{
-			//Add null measurement and continue, its needed for inverse later
-			measList.push_back(meas);
 			continue;
 		}
 
@@ -45,8 +44,6 @@ void minimum(
 
 		if (stationOpts.noise <= 0)
 		{
-			//Add null measurement and continue, its needed for inverse later
-			measList.push_back(meas);
 			continue;
 		}
 
@@ -57,12 +54,14 @@ void minimum(
 		}
 
 		//get all of the position elements for this station
-		Vector3d filterPos;
+		Vector3d	filterPos;
+		int			posIndex[3];
 		for (int i = 0; i < 3; i++)
 		{
 			KFKey kfKey = key;
 			kfKey.num = i;
 			kfStateStations.getKFValue(kfKey, filterPos(i));
+			posIndex[i] = kfStateStations.getKFIndex(kfKey);
 		}
 
 		Vector3d aprioriPos = rec.snx.pos;
@@ -78,6 +77,11 @@ void minimum(
 
 		for (short xyz = 0; xyz < 3; xyz++)
 		{
+			if (posIndex[xyz] < 0)
+			{
+				continue;
+			}
+
 			ObsKey obsKey = {{}, rec.id, { (char)('X' + xyz)}};
 
 			KFMeasEntry meas(&kfStateTrans, obsKey);
@@ -102,10 +106,12 @@ void minimum(
 			meas.setNoise(stationOpts.noise);
 			meas.setValue(deltaR(xyz));
 
-			measList.push_back(meas);
+			measVec[posIndex[xyz]] = meas;
 		}
 	}
 
+	KFMeasEntryList measList(measVec.begin(), measVec.end());
+
 	//use a state transition to initialise elements
 	kfStateTrans.stateTransition(trace, GTime::noTime());
 
@@ -141,7 +147,7 @@ void minimum(
 		KFMeas pseudoMeas;
 		int rows = kfStateTrans.x.rows() - 1;
 		pseudoMeas.V = - kfStateTrans.x.bottomRows(rows);
-		pseudoMeas.A = Tdash.bottomRows	(rows);
+		pseudoMeas.A = Tdash.bottomRows	(rows).sparseView();
 		pseudoMeas.R = VectorXd::Zero	(rows);
 		pseudoMeas.obsKeys.resize		(rows);
 
@@ -153,7 +159,7 @@ void minimum(
 
 		if (kfState.rts_filename.empty() == false)
 		{
-			spitFilterToFile(kfState, E_SerialObject::FILTER_MINUS, kfState.rts_forward_filename);
+			spitFilterToRTS(kfState, E_SerialObject::FILTER_MINUS);
 		}
 
 		MatrixXd Pp;
@@ -174,7 +180,7 @@ void minimum(
 
 		if (kfState.rts_filename.empty() == false)
 		{
-			spitFilterToFile(kfState, E_SerialObject::FILTER_PLUS, kfState.rts_forward_filename);
+			spitFilterToRTS(kfState, E_SerialObject::FILTER_PLUS);
 		}
 	}
 }
@@ -209,7 +209,7 @@ void networkEstimator(
 	}
 																								TestStack::testStr("recString", recString);
 
-	KFMeasEntryList		kfMeasEntryList;
+	KFMeasBuilder		measBuilder(kfState, 2 * total);
 	Station*	refRec = nullptr;
 	bool		refClk = false;
 
@@ -247,17 +247,17 @@ void networkEstimator(
 		ObsKey obsKeyCode = {	obs.Sat, rec.id, "P", ft	};
 		ObsKey obsKeyPhas = {	obs.Sat, rec.id, "L", ft	};
 
-		KFMeasEntry	codeMeas(&kfState, obsKeyCode);
-		KFMeasEntry	phasMeas(&kfState, obsKeyPhas);
+		KFMeasRef	codeMeas = measBuilder.addMeas(obsKeyCode);
+		KFMeasRef	phasMeas = measBuilder.addMeas(obsKeyPhas);
 
 		SatStat& satStat = *obs.satStat_ptr;
 		SigStat& sigStat = satStat.sigStatMap[ft];
 
-		codeMeas.metaDataMap["obs_ptr"]	= &obs;
-		phasMeas.metaDataMap["obs_ptr"]	= &obs;
+		codeMeas.metaData().obs_ptr	= &obs;
+		phasMeas.metaData().obs_ptr	= &obs;
 		
-		phasMeas.metaDataMap["phaseRejectCount_ptr"] = &sigStat.netwPhaseRejectCount;
-		phasMeas.metaDataMap["phaseOutageCount_ptr"] = &sigStat.netwPhaseOutageCount;
+		phasMeas.metaData().phaseRejectCount_ptr = &sigStat.netwPhaseRejectCount;
+		phasMeas.metaData().phaseOutageCount_ptr = &sigStat.netwPhaseOutageCount;
 
 		//initialise this rec/sat's measurements
 		codeMeas.setValue(sig.codeRes);
@@ -312,8 +312,9 @@ void networkEstimator(
 		if (&rec != refRec)
 		{
 			InitialState init		= initialStateFromConfig(recOpts.clk);
-			codeMeas.addDsgnEntry(recClockKey,		+1,					init);
-			phasMeas.addDsgnEntry(recClockKey,		+1,					init);
+			int handle				= kfState.getKFHandle(recClockKey);
+			codeMeas.addDsgnHandle(handle,		+1,					init);
+			phasMeas.addDsgnHandle(handle,		+1,					init);
 
 			if (recOpts.clk_rate.estimate)
 			{
@@ -327,13 +328,12 @@ void networkEstimator(
 			{
 				refClk = true;
 
-				KFMeasEntry	pseudoMeas(&kfState);	//todo aaron, add pseudomeasurements to set the reference receiver to 0 rather than being blank?
+				KFMeasRef	pseudoMeas = measBuilder.addMeas();	//todo aaron, add pseudomeasurements to set the reference receiver to 0 rather than being blank?
 				pseudoMeas.setValue(0);				//this works, but is it general? what happens after the first epoch?
 				pseudoMeas.setNoise(0.000001);
 
 				InitialState init		= {0, SQR(0.0001), SQR(0)};
 				pseudoMeas.addDsgnEntry(refClockKey,	+1,					init);
-				kfMeasEntryList.push_back(pseudoMeas);
 			}
 		}
 
@@ -342,16 +342,18 @@ void networkEstimator(
 		if (obs.Sat.sys != +E_Sys::GPS)
 		{
 			InitialState init		= initialStateFromConfig(recOpts.clk);
-			codeMeas.addDsgnEntry(recSysBiasKey,	+1,						init);
-			phasMeas.addDsgnEntry(recSysBiasKey,	+1,						init);
+			int handle				= kfState.getKFHandle(recSysBiasKey);
+			codeMeas.addDsgnHandle(handle,	+1,						init);
+			phasMeas.addDsgnHandle(handle,	+1,						init);
 		}
 
 		if (recOpts.pos.estimate)
 		for (int i = 0; i < 3; i++)
 		{
 			InitialState init		= initialStateFromConfig(recOpts.pos, i);
-			codeMeas.addDsgnEntry(recPosKeys[i],	-satStat.e[i], 			init);
-			phasMeas.addDsgnEntry(recPosKeys[i],	-satStat.e[i], 			init);
+			int handle				= kfState.getKFHandle(recPosKeys[i]);
+			codeMeas.addDsgnHandle(handle,	-satStat.e[i], 			init);
+			phasMeas.addDsgnHandle(handle,	-satStat.e[i], 			init);
 			if (rec.aprioriVar(i) == 0)
 			{
 				rec.aprioriVar(i) = sqrt(init.P);
@@ -361,14 +363,16 @@ void networkEstimator(
 		if (recOpts.trop.estimate)
 		{
 			InitialState init		= initialStateFromConfig(recOpts.trop);
-			codeMeas.addDsgnEntry(tropKeys[0],		satStat.mapWet,			init);
-			phasMeas.addDsgnEntry(tropKeys[0],		satStat.mapWet,			init);
+			int handle				= kfState.getKFHandle(tropKeys[0]);
+			codeMeas.addDsgnHandle(handle,		satStat.mapWet,			init);
+			phasMeas.addDsgnHandle(handle,		satStat.mapWet,			init);
 
 			if (recOpts.trop_gauss_markov.estimate)
 			{
 				InitialState initGM		= initialStateFromConfig(recOpts.trop_gauss_markov);
-				codeMeas.addDsgnEntry(		tropGMKeys[0],	satStat.mapWet,	initGM);
-				phasMeas.addDsgnEntry(		tropGMKeys[0],	satStat.mapWet,	initGM);
+				int gmHandle			= kfState.getKFHandle(tropGMKeys[0]);
+				codeMeas.addDsgnHandle(		gmHandle,	satStat.mapWet,	initGM);
+				phasMeas.addDsgnHandle(		gmHandle,	satStat.mapWet,	initGM);
 				kfState.setKFGaussMarkovTau(tropGMKeys[0],	recOpts.trop_gauss_markov.tau.front());
 			}
 		}
@@ -377,14 +381,16 @@ void networkEstimator(
 		for (int i = 0; i < 2; i++)
 		{
 			InitialState init	= initialStateFromConfig(recOpts.trop_grads, i);
-			codeMeas.addDsgnEntry(tropKeys[i+1],	satStat.mapWetGrads[i],	init);
-			phasMeas.addDsgnEntry(tropKeys[i+1],	satStat.mapWetGrads[i],	init);
+			int handle				= kfState.getKFHandle(tropKeys[i+1]);
+			codeMeas.addDsgnHandle(handle,	satStat.mapWetGrads[i],	init);
+			phasMeas.addDsgnHandle(handle,	satStat.mapWetGrads[i],	init);
 
 			if (recOpts.trop_grads_gauss_markov.estimate)
 			{
 				InitialState initGM		= initialStateFromConfig(recOpts.trop_grads_gauss_markov);
-				codeMeas.addDsgnEntry(		tropGMKeys[i+1],	satStat.mapWet,	initGM);
-				phasMeas.addDsgnEntry(		tropGMKeys[i+1],	satStat.mapWet,	initGM);
+				int gmHandle			= kfState.getKFHandle(tropGMKeys[i+1]);
+				codeMeas.addDsgnHandle(		gmHandle,	satStat.mapWet,	initGM);
+				phasMeas.addDsgnHandle(		gmHandle,	satStat.mapWet,	initGM);
 				kfState.setKFGaussMarkovTau(tropGMKeys[i+1],	recOpts.trop_grads_gauss_markov.tau.front());
 			}
 		}
@@ -392,8 +398,9 @@ void networkEstimator(
 		if (satOpts.clk.estimate)
 		{
 			InitialState init		= initialStateFromConfig(satOpts.clk);
-			codeMeas.addDsgnEntry(satClockKey,		-1,						init);
-			phasMeas.addDsgnEntry(satClockKey,		-1,						init);
+			int handle				= kfState.getKFHandle(satClockKey);
+			codeMeas.addDsgnHandle(handle,		-1,						init);
+			phasMeas.addDsgnHandle(handle,		-1,						init);
 
 			if (satOpts.clk_rate.estimate)
 			{
@@ -406,8 +413,9 @@ void networkEstimator(
 		for (int i = 0; i < 3; i++)
 		{
 			InitialState init		= initialStateFromConfig(satOpts.pos, i);
-			codeMeas.addDsgnEntry(satPosKeys[i],	-satStat.e[i], 			init);
-			phasMeas.addDsgnEntry(satPosKeys[i],	-satStat.e[i], 			init);
+			int handle				= kfState.getKFHandle(satPosKeys[i]);
+			codeMeas.addDsgnHandle(handle,	-satStat.e[i], 			init);
+			phasMeas.addDsgnHandle(handle,	-satStat.e[i], 			init);
 		
 			if (satOpts.pos_rate.estimate)
 			{
@@ -433,6 +441,8 @@ void networkEstimator(
 			bool pass = orbPartials(trace, time, obs, obs.satPartialMat);
 			if (pass == false)
 			{
+				codeMeas.discard();
+				phasMeas.discard();
 				continue;
 			}
 
@@ -444,8 +454,9 @@ void networkEstimator(
 				KFKey orbPtKey	= {KF::ORBIT_PTS,	obs.Sat,	std::to_string(100 + i).substr(1) + "_" + name};
 
 				InitialState init	= initialStateFromConfig(satOpts.orb, i);
-				codeMeas.addDsgnEntry(orbPtKey,		orbitPartials(i),			init);
-				phasMeas.addDsgnEntry(orbPtKey,		orbitPartials(i),			init);
+				int handle				= kfState.getKFHandle(orbPtKey);
+				codeMeas.addDsgnHandle(handle,		orbitPartials(i),			init);
+				phasMeas.addDsgnHandle(handle,		orbitPartials(i),			init);
 			}
 		}
 
@@ -457,13 +468,11 @@ void networkEstimator(
 			for (int i = 0; i < 3; i++)
 			{
 				InitialState init	= initialStateFromConfig(acsConfig.netwOpts.eop, i);
-				codeMeas.addDsgnEntry(eopKeys[i],	eopPartials(i),				init);
-				phasMeas.addDsgnEntry(eopKeys[i],	eopPartials(i),				init);
+				int handle				= kfState.getKFHandle(eopKeys[i]);
+				codeMeas.addDsgnHandle(handle,	eopPartials(i),				init);
+				phasMeas.addDsgnHandle(handle,	eopPartials(i),				init);
 			}
 		}
-		
-		kfMeasEntryList.push_back(codeMeas);
-		kfMeasEntryList.push_back(phasMeas);
 
 		//record number of observations per satellite - for publishing SSR corrections
 		nav.satNavMap[obs.Sat].ssrOut.numObs++;
@@ -480,7 +489,7 @@ void networkEstimator(
 	}
 
 	//combine the measurement list into a single matrix
-	KFMeas combinedMeas = kfState.combineKFMeasList(kfMeasEntryList);
+	KFMeas combinedMeas = measBuilder.combine();
 	combinedMeas.time = stations.front()->obsList.front().time;
 
 	correctRecClocks(trace, kfState, refRec);
@@ -0,0 +1,11 @@
+
+#ifndef __PEA_COMMIT_VERSION_H
+#define __PEA_COMMIT_VERSION_H
+
+
+#define PEA_COMMIT_VERSION	""
+#define PEA_BRANCH_NAME		""
+#define PEA_COMMIT_DATE		""
+
+
+#endif
@@ -798,9 +798,9 @@ bool incrementPhaseSignalError(
 	KFMeas&		kfMeas,
 	int			index)
 {
-	map<string, void*>& metaDataMap = kfMeas.metaDataMaps[index];
+	MeasMetaData& metaData = kfMeas.metaDataList[index];
 
-	unsigned int* phaseRejectCount_ptr = (unsigned int*) metaDataMap["phaseRejectCount_ptr"];
+	unsigned int* phaseRejectCount_ptr = metaData.phaseRejectCount_ptr;
 
 	if (phaseRejectCount_ptr == nullptr)
 	{
@@ -811,7 +811,7 @@ bool incrementPhaseSignalError(
 
 	//increment counter, and clear the pointer so it cant be reset to zero in subsequent operations (because this is a failure)
 	phaseRejectCount++;
-	metaDataMap["phaseRejectCount_ptr"] = nullptr;
+	metaData.phaseRejectCount_ptr = nullptr;
 
 	
 	return true;
@@ -823,9 +823,9 @@ bool countSignalErrors(
 	KFMeas&		kfMeas,
 	int			index)
 {
-	map<string, void*>& metaDataMap = kfMeas.metaDataMaps[index];
+	MeasMetaData& metaData = kfMeas.metaDataList[index];
 
-	Obs* obs_ptr = (Obs*) metaDataMap["obs_ptr"];
+	Obs* obs_ptr = metaData.obs_ptr;
 
 	if (obs_ptr == nullptr)
 	{
@@ -848,10 +848,10 @@ bool resetPhaseSignalError(
 	KFMeas&		kfMeas,
 	int			index)
 {
-	map<string, void*>& metaDataMap = kfMeas.metaDataMaps[index];
+	MeasMetaData& metaData = kfMeas.metaDataList[index];
 
 	//this will have been set to null if there was an error after adding the measurement to the list
-	unsigned int* phaseRejectCount_ptr = (unsigned int*) metaDataMap["phaseRejectCount_ptr"];
+	unsigned int* phaseRejectCount_ptr = metaData.phaseRejectCount_ptr;
 
 	if (phaseRejectCount_ptr == nullptr)
 	{
@@ -869,9 +869,9 @@ bool resetPhaseSignalOutage(
 	KFMeas&		kfMeas,
 	int			index)
 {
-	map<string, void*>& metaDataMap = kfMeas.metaDataMaps[index];
+	MeasMetaData& metaData = kfMeas.metaDataList[index];
 
-	unsigned int* phaseOutageCount_ptr = (unsigned int*) metaDataMap["phaseOutageCount_ptr"];
+	unsigned int* phaseOutageCount_ptr = metaData.phaseOutageCount_ptr;
 
 	if (phaseOutageCount_ptr == nullptr)
 	{
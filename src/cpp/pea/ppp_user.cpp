@@ -394,7 +394,7 @@ int ppp_filter(
 
 	udbias_ppp(trace, rtk, obsList);
 
-	KFMeasEntryList		kfMeasEntryList;
+	KFMeasBuilder		measBuilder(kfState, 4 * obsList.size());
 	map<KFKey, bool>	measuredStates;
 
 	for (auto& obs : obsList)
@@ -712,8 +712,8 @@ int ppp_filter(
 			ObsKey obsKeyCode = {obs.Sat, obs.mount, "P", ft};
 			ObsKey obsKeyPhas = {obs.Sat, obs.mount, "L", ft};
 
-			KFMeasEntry	codeMeas(&kfState, obsKeyCode);
-			KFMeasEntry	phasMeas(&kfState, obsKeyPhas);
+			KFMeasRef	phasMeas = measBuilder.addMeas(obsKeyPhas);
+			KFMeasRef	codeMeas = measBuilder.addMeas(obsKeyCode);
 
 			codeMeas.setInnov(codeInnov);
 			phasMeas.setInnov(phasInnov);
@@ -721,8 +721,8 @@ int ppp_filter(
 			codeMeas.setNoise(codeVar);
 			phasMeas.setNoise(phasVar);
 
-			codeMeas.metaDataMap["obs_ptr"] = &obs;
-			phasMeas.metaDataMap["obs_ptr"] = &obs;
+			codeMeas.metaData().obs_ptr = &obs;
+			phasMeas.metaData().obs_ptr = &obs;
 
 			// (Re)Initialise any states with values, covariances, and process noises
 
@@ -873,14 +873,11 @@ int ppp_filter(
 			{
 				tracepde(2, std::cout, "outlier rejected  sat=%s %d res=%9.4f %9.4f el=%4.1f\n", obs.Sat.id().c_str(), ft, codeInnov, phasInnov, satStat.el * R2D);
 				obs.excludeOutlier = true;
+				codeMeas.discard();
+				phasMeas.discard();
 				continue;			//todo aaron, moved to filer
 			}
 
-			//Add the completed measurements to the filter
-
-			kfMeasEntryList.push_back(phasMeas);
-			kfMeasEntryList.push_back(codeMeas);
-
 			tracepde(4, trace, "%s sat=%2d P%d res=%9.4f sig=%9.4f el=%4.1f\n", str, obs.Sat, ft, codeInnov, sqrt(codeVar), satStat.el * R2D);
 			tracepde(4, trace, "%s sat=%2d L%d res=%9.4f sig=%9.4f el=%4.1f\n", str, obs.Sat, ft, phasInnov, sqrt(phasVar), satStat.el * R2D);
 
@@ -894,7 +891,7 @@ int ppp_filter(
 	kfState.stateTransition(std::cout, obsTime);
 
 	//combine the measurement list into a single matrix
-	KFMeas combinedMeas = kfState.combineKFMeasList(kfMeasEntryList);
+	KFMeas combinedMeas = measBuilder.combine();
 	combinedMeas.time = obsList.front().time;
 
 	if (combinedMeas.V.rows() == 0)
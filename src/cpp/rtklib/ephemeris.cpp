@@ -39,8 +39,6 @@
 #define DEFURASSR 0.03            /* default accurary of ssr corr (m) */
 #define MAXECORSSR 10.0           /* max orbit correction of ssr (m) */
 #define MAXCCORSSR (1E-6*CLIGHT)  /* max clock correction of ssr (m) */
-#define MAXAGESSR 90.0            /* max age of ssr orbit and clock (s) */
-#define MAXAGESSR_HRCLK 10.0      /* max age of ssr high-rate clock (s) */
 #define STD_BRDCCLK 30.0          /* error of broadcast clock (m) */
 
 #define MAX_ITER_KEPLER 30        /* max number of iteration of Kelpler */
@@ -375,18 +373,37 @@ extern void seph2pos(GTime time, Seph* seph, double* rs, double* dts, double* va
 		*var = var_uraeph(seph->sva);
 }
 
-/* select ephememeris --------------------------------------------------------*/
+/** Remove broadcast ephemerides that are too old to be selected again, so that selection does not slow as ephemerides accumulate.
+* Navigation pointers to removed ephemerides are cleared.
+*/
+void pruneEphemerides(
+	GTime	oldest,		///< Oldest reference time to keep
+	nav_t&	nav)		///< Navigation data to prune
+{
+	for (auto& [Sat, satNav] : nav.satNavMap)
+	{
+		if (satNav.eph_ptr	&& satNav.eph_ptr	->toe	< oldest)		satNav.eph_ptr	= nullptr;
+		if (satNav.geph_ptr	&& satNav.geph_ptr	->toe	< oldest)		satNav.geph_ptr	= nullptr;
+		if (satNav.seph_ptr	&& satNav.seph_ptr	->t0	< oldest)		satNav.seph_ptr	= nullptr;
+	}
+
+	for (auto& [Sat, ephStore]	: nav.ephMap)		ephStore.	prune(oldest);
+	for (auto& [Sat, gephStore]	: nav.gephMap)		gephStore.	prune(oldest);
+	for (auto& [Sat, sephStore]	: nav.sephMap)		sephStore.	prune(oldest);
+}
+
+/** Select the broadcast ephemeris to use for a satellite.
+* Without an issue of data, the ephemeris with the latest toe within the validity period of the system is selected.
+* With an issue of data, the first matching ephemeris received with toe within the validity period is selected.
+*/
 Eph* seleph(
-	GTime	time, 
-	SatSys	Sat, 
-	int		iode, 
-	nav_t&	nav)
+	GTime	time,		///< Time to select ephemeris for
+	SatSys	Sat,		///< Satellite to select ephemeris for
+	int		iode,		///< Issue of data to match, or -1 for any
+	nav_t&	nav)		///< Navigation data
 {
-	double t;
 	double tmax;
-//	double tmin;
 	
-	Eph* chosen = nullptr;
 //     trace(4,"seleph  : time=%s sat=%2d iode=%d\n",time.to_string(3).c_str(),Sat,iode);
 
 	switch (Sat.sys)
@@ -397,111 +414,61 @@ Eph* seleph(
 		default: 			tmax = MAXDTOE		+ 1; break;
 	}
 
-//	tmin = tmax + 1;
-
-	auto& ephList = nav.ephMap[Sat];
-
-	GTime latestToe = GTime::noTime();
-	for (auto& eph : ephList)
+	//find rather than index, this is called from parallel station processing
+	auto it = nav.ephMap.find(Sat);
+	if (it == nav.ephMap.end())
 	{
-		if 	( iode >= 0
-			&&iode != eph.iode)
-			continue;
-
-		t = fabs(timediff(eph.toe, time));
-
-		if (t > tmax)
-			continue;
-
-		if (iode >= 0)
-			return &eph;
-
-//		if (t <= tmin)
-//		{
-//			/* toe closest to time */
-//			chosen	= &eph;
-//			tmin	= t;
-//		}
-		if (eph.toe > latestToe)
-		{
-			/* latest ephem with toe within +-MAXDTOE of current epoch */
-			chosen	= &eph;
-			latestToe = eph.toe;
-		}
-	}
-
-	if	(  iode >= 0
-		|| chosen == nullptr)
-	{
-//         trace(2,"no broadcast ephemeris: %s sat=%2d iode=%3d\n",time.to_string(0).c_str(), Sat,iode);
 		return nullptr;
 	}
 
-	return chosen;
+	auto& ephStore = it->second;
+
+	if (iode >= 0)	return ephStore.find	(iode, time, tmax);
+	else			return ephStore.latest	(time, tmax);
 }
 
-/* select glonass ephememeris ------------------------------------------------*/
-Geph* selgeph(GTime time, SatSys Sat, int iode, nav_t& nav)
+/** Select the broadcast ephemeris to use for a glonass satellite, the ephemeris with toe closest to the time is selected
+*/
+Geph* selgeph(
+	GTime	time,		///< Time to select ephemeris for
+	SatSys	Sat,		///< Satellite to select ephemeris for
+	int		iode,		///< Issue of data to match, or -1 for any
+	nav_t&	nav)		///< Navigation data
 {
-	double t, tmax = MAXDTOE_GLO, tmin = tmax + 1.0;
+	double tmax = MAXDTOE_GLO;
 
-	Geph* closest = NULL;
 //     trace(4,"selgeph : time=%s sat=%2d iode=%2d\n",time.to_string(3).c_str(),Sat,iode);
 
-	auto& gephList = nav.gephMap[Sat];
-
-	for (auto& geph : gephList)
+	auto it = nav.gephMap.find(Sat);
+	if (it == nav.gephMap.end())
 	{
-		if (iode >= 0 && geph.iode != iode) 				continue;
-		if ((t = fabs(timediff(geph.toe, time))) > tmax)	continue;
-		if (iode >= 0)										return &geph;
-		if (t <= tmin)
-		{
-			/* toe closest to time */
-			closest = &geph;
-			tmin = t;
-		}
+		return nullptr;
 	}
 
-	if (iode >= 0 || closest == NULL)
-	{
-//         trace(3,"no glonass ephemeris  : %s sat=%2d iode=%2d\n",time.to_string(0).c_str(),Sat,iode);
-		return NULL;
-	}
+	auto& gephStore = it->second;
 
-	return closest;
+	if (iode >= 0)	return gephStore.find		(iode, time, tmax);
+	else			return gephStore.closest	(time, tmax);
 }
 
-/* select sbas ephememeris ---------------------------------------------------*/
-Seph* selseph(GTime time, SatSys Sat, nav_t& nav)
+/** Select the broadcast ephemeris to use for an sbas satellite, the ephemeris with t0 closest to the time is selected
+*/
+Seph* selseph(
+	GTime	time,		///< Time to select ephemeris for
+	SatSys	Sat,		///< Satellite to select ephemeris for
+	nav_t&	nav)		///< Navigation data
 {
-	double t, tmax = MAXDTOE_SBS, tmin = tmax + 1.0;
-	Seph* closest = NULL;
+	double tmax = MAXDTOE_SBS;
 
 //     trace(4,"selseph : time=%s sat=%2d\n",time.to_string(3).c_str(),Sat);
 
-	auto& sephList = nav.sephMap[Sat];
-
-	for (auto& seph : sephList)
+	auto it = nav.sephMap.find(Sat);
+	if (it == nav.sephMap.end())
 	{
-		if ((t = fabs(timediff(seph.t0, time))) > tmax)
-			continue;
-
-		if (t <= tmin)
-		{
-			closest = &seph;
-			tmin = t;
-
-		} /* toe closest to time */
-	}
-
-	if (closest == NULL)
-	{
-//         trace(3,"no sbas ephemeris     : %s sat=%2d\n",time.to_string(0).c_str(),Sat);
-		return NULL;
+		return nullptr;
 	}
 
-	return closest;
+	return it->second.closest(time, tmax);
 }
 
 /* satellite clock with broadcast ephemeris ----------------------------------*/
@@ -676,13 +643,13 @@ int satpos_ssr(
 	const ssr_t& ssr = obs.satNav_ptr->ssr;
 	
 	//get 'price is right' closest ssr components to ephemeris time.
-	auto ephIt = ssr.ssrEph_map		.lower_bound(time);			if (ephIt == ssr.ssrEph_map		.end())		return 0;
-	auto clkIt = ssr.ssrClk_map		.lower_bound(time);			if (clkIt == ssr.ssrClk_map		.end())		return 0;
-	auto uraIt = ssr.ssrUra_map		.lower_bound(time);		//	if (uraIt == ssr.ssrUra_map		.end())		return 0;	//check these later
-	auto hrcIt = ssr.ssrHRClk_map	.lower_bound(time);		//	if (hrcIt == ssr.ssrHRClk_map	.end())		return 0;
+	auto ssrEph_ptr	= ssr.ssrEph_map	.atTime(time);			if (ssrEph_ptr == nullptr)		return 0;
+	auto ssrClk_ptr	= ssr.ssrClk_map	.atTime(time);			if (ssrClk_ptr == nullptr)		return 0;
+	auto ssrUra_ptr	= ssr.ssrUra_map	.atTime(time);		//	if (ssrUra_ptr == nullptr)		return 0;	//check these later
+	auto ssrHrc_ptr	= ssr.ssrHRClk_map	.atTime(time);		//	if (ssrHrc_ptr == nullptr)		return 0;
 	
-	auto& [t_e, ssrEph] = *ephIt;
-	auto& [t_c, ssrClk] = *clkIt;
+	auto& ssrEph = *ssrEph_ptr;
+	auto& ssrClk = *ssrClk_ptr;
 
 	/* inconsistency between orbit and clock correction */
 	if (ssrEph.iod != ssrClk.iod)
@@ -722,9 +689,9 @@ int satpos_ssr(
 				+ ssrClk.dclk[2] * tClk * tClk;
 
 	/* ssr highrate clock correction (ref [4]) */
-	if (hrcIt != ssr.ssrHRClk_map.end())	
+	if (ssrHrc_ptr)
 	{
-		auto& [t_h, ssrHrc] = *hrcIt;
+		auto& ssrHrc = *ssrHrc_ptr;
 		
 		double tHrc = timediff(time, ssrHrc.t0);
 		
@@ -798,11 +765,9 @@ int satpos_ssr(
 
 	/* variance by ssr ura */
 	double ura = -1;
-	if (uraIt != ssr.ssrUra_map.end())
+	if (ssrUra_ptr)
 	{
-		auto& [t_u, ssrUra] = *uraIt;
-		
-		ura = ssrUra.ura;
+		ura = ssrUra_ptr->ura;
 	}
 	obs.var = var_urassr(ura);
 
@@ -864,6 +829,189 @@ int satpos(
 	return 0;
 }
 
+/** Satellite position and clock at a transmission time, including the satellite antenna information
+*/
+int satposAntenna(
+	Trace&		trace,		///< Trace file to output to
+	GTime		time,		///< Transmission time
+	GTime		teph,		///< Time to select ephemeris
+	Obs&		obs,		///< Observation to calculate the satellite state for
+	int			ephopt,		///< Ephemeris option
+	nav_t&		nav)		///< Navigation data
+{
+	char id[5];
+	obs.Sat.getId(id);
+
+	/* satellite antenna information */
+	PcoMapType* pcoMap_ptr = NULL;
+	{
+		double ep[6];
+		time2epoch(time, ep);
+		pcvacs_t* pcsat = findAntenna(id, ep, nav);
+
+		if (pcsat == NULL)
+		{
+			if (obs.Sat < MINPRNSBS)
+			{
+				tracepde(1, trace,	"Warning: no satellite (%s) pco information\n", id);
+				printf(				"Warning: no satellite (%s) pco information\n", id);
+			}
+		}
+		else
+		{
+			pcoMap_ptr = &pcsat->pcoMap;
+		}
+	}
+
+	//todo aaron, send through satNav_ptrs rather than the whole set of options
+	return satpos(trace, time, teph, obs, ephopt, nav, pcoMap_ptr);
+}
+
+SatStateCache satStateCache;
+
+/** Remove the nodes of the previous epoch
+*/
+void SatStateCache::clear()
+{
+	for (auto& shard : shards)
+	{
+		std::lock_guard<std::mutex> guard(shard.mutex);
+
+		shard.nodeMap.clear();
+	}
+}
+
+/** Remove the nodes of a satellite, after its navigation data has changed
+*/
+void SatStateCache::invalidate(
+	SatSys		Sat)		///< Satellite to remove the nodes of
+{
+	auto& shard = shards[(unsigned int) Sat % numShards];
+
+	std::lock_guard<std::mutex> guard(shard.mutex);
+
+	for (auto it = shard.nodeMap.begin(); it != shard.nodeMap.end(); )
+	{
+		if (it->first.Sat == (int) Sat)		it = shard.nodeMap.erase(it);
+		else								it++;
+	}
+}
+
+/** Get the satellite state at a node of the grid, calculating it if no station has needed it yet.
+* Nodes are calculated with the issue of data requested by the observation, if any.
+*/
+SatStateNode SatStateCache::getNode(
+	Trace&		trace,		///< Trace file to output to
+	long int	node,		///< Index of the node, the number of grid intervals since the time origin
+	GTime		teph,		///< Time to select ephemeris
+	Obs&		obs,		///< Observation of the satellite
+	int			ephopt,		///< Ephemeris option
+	nav_t&		nav)		///< Navigation data
+{
+	SatStateKey key;
+	key.teph	= teph;
+	key.Sat		= obs.Sat;
+	key.ephopt	= ephopt;
+	key.iode	= obs.iode;
+	key.node	= node;
+
+	auto& shard = shards[(unsigned int) key.Sat % numShards];
+	{
+		std::lock_guard<std::mutex> guard(shard.mutex);
+
+		auto it = shard.nodeMap.find(key);
+		if (it != shard.nodeMap.end())
+		{
+			return it->second;
+		}
+	}
+
+	//calculate outside the lock, if another station gets here first the results are the same
+	GTime nodeTime;
+	nodeTime.time	= node / nodesPerSecond;
+	nodeTime.sec	= (double) (node % nodesPerSecond) / nodesPerSecond;
+
+	Obs nodeObs;
+	nodeObs.Sat			= obs.Sat;
+	nodeObs.satNav_ptr	= obs.satNav_ptr;
+	nodeObs.iode		= obs.iode;
+
+	SatStateNode state;
+	state.pass		= satposAntenna(trace, nodeTime, teph, nodeObs, ephopt, nav);
+	state.rSat		= nodeObs.rSat;
+	state.satVel	= nodeObs.satVel;
+	state.dtSat[0]	= nodeObs.dtSat[0];
+	state.dtSat[1]	= nodeObs.dtSat[1];
+	state.var		= nodeObs.var;
+	state.svh		= nodeObs.svh;
+	state.iode		= nodeObs.iode;
+
+	std::lock_guard<std::mutex> guard(shard.mutex);
+
+	shard.nodeMap.emplace(key, state);
+
+	return state;
+}
+
+/** Satellite position and clock at a transmission time, interpolated from the states at the surrounding grid nodes.
+* Positions use cubic Hermite interpolation with the node velocities, the other values are interpolated linearly.
+* Falls back to calculating the state directly if either node is unavailable or they use different ephemerides.
+*/
+int SatStateCache::satpos(
+	Trace&		trace,		///< Trace file to output to
+	GTime		time,		///< Transmission time
+	GTime		teph,		///< Time to select ephemeris
+	Obs&		obs,		///< Observation to calculate the satellite state for
+	int			ephopt,		///< Ephemeris option
+	nav_t&		nav)		///< Navigation data
+{
+	double		interval	= 1.0 / nodesPerSecond;
+	double		subNodes	= floor(time.sec * nodesPerSecond);
+	long int	node		= (long int) time.time * nodesPerSecond + (long int) subNodes;
+
+	SatStateNode state0 = getNode(trace, node,		teph, obs, ephopt, nav);
+	SatStateNode state1 = getNode(trace, node + 1,	teph, obs, ephopt, nav);
+
+	if	( state0.pass	== false
+		||state1.pass	== false
+		||state0.svh	!= state1.svh
+		||state0.iode	!= state1.iode)
+	{
+		return satposAntenna(trace, time, teph, obs, ephopt, nav);
+	}
+
+	double s = time.sec * nodesPerSecond - subNodes;
+
+	//satpos velocities are forward differences over 1ms, move them back to the node times
+	double		tt		= 1E-3;
+	Vector3d	acc		= (state1.satVel - state0.satVel) / interval;
+	Vector3d	d0		= state0.satVel - acc * tt / 2;
+	Vector3d	d1		= state1.satVel - acc * tt / 2;
+
+	double h00	= (2 * s - 3) * s * s + 1;
+	double h10	= ((s - 2) * s + 1) * s;
+	double h01	= (3 - 2 * s) * s * s;
+	double h11	= (s - 1) * s * s;
+
+	obs.rSat	= h00 * state0.rSat
+				+ h10 * interval * d0
+				+ h01 * state1.rSat
+				+ h11 * interval * d1;
+
+	obs.satVel		= state0.satVel		+ s * (state1.satVel	- state0.satVel);
+	obs.dtSat[0]	= state0.dtSat[0]	+ s * (state1.dtSat[0]	- state0.dtSat[0]);
+	obs.dtSat[1]	= state0.dtSat[1]	+ s * (state1.dtSat[1]	- state0.dtSat[1]);
+	obs.var			= state0.var		+ s * (state1.var		- state0.var);
+	obs.svh			= state0.svh;
+
+	if (state0.iode >= 0)
+	{
+		obs.iode	= state0.iode;
+	}
+
+	return 1;
+}
+
 /* satellite positions and clocks ----------------------------------------------
 * compute satellite positions, velocities and clocks
 * args   : gtime_t teph     I   time to select ephemeris (gpst)
@@ -930,30 +1078,15 @@ void satposs(
 
 		time = timeadd(time, -dt);
 
-		/* satellite antenna information */
-		PcoMapType* pcoMap_ptr = NULL;
+		/* satellite position and clock at transmission time */
+		if (acsConfig.share_satellite_states)
 		{
-			double ep[6];
-			time2epoch(time, ep);
-			pcvacs_t* pcsat = findAntenna(id, ep, nav);
-
-			if (pcsat == NULL)
-			{
-				if (obs.Sat < MINPRNSBS)
-				{
-					tracepde(1, trace,	"Warning: no satellite (%s) pco information\n", id);
-					printf(				"Warning: no satellite (%s) pco information\n", id);
-				}
-			}
-			else
-			{
-				pcoMap_ptr = &pcsat->pcoMap;
-			}
+			pass = satStateCache.satpos(trace, time, teph, obs, ephopt, nav);
+		}
+		else
+		{
+			pass = satposAntenna(trace, time, teph, obs, ephopt, nav);
 		}
-		
-		//todo aaron, send through satNav_ptrs rather than the whole set of options
-		/* satellite position and clock at transmission time */
-		pass = satpos(trace, time, teph, obs, ephopt, nav, pcoMap_ptr);
 
 		if (pass == false)
 		{
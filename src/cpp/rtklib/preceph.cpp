@@ -14,6 +14,7 @@
 *-----------------------------------------------------------------------------*/
 
 #include <unordered_map>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <array>
@@ -222,38 +223,301 @@ double interppol(const double *x, double *y, int n)
 	return y[0];
 }
 
-/* satellite position by precise ephemeris -----------------------------------*/
-int pephpos(
-	GTime time,
-	SatSys Sat,
-	nav_t& nav,
-	double *rs,
-	double *dts,
-	double *vare,
-	double *varc)
+/** Index of the first sample at or after a time, or the number of samples if there are none.
+* Uniformly spaced series are indexed directly, others use a binary search.
+*/
+template<typename SERIES>
+int seriesLowerBound(
+	const SERIES&	series,		///< Series to search
+	double			time)		///< Time relative to the start of the series (s)
 {
-	double t[NMAX+1],p[3][NMAX+1],c[2],s[3];
+	int n = series.t.size();
 
-	char id[4];
-	Sat.getId(id);
-//     trace(4,"pephpos : time=%s sat=%s\n",time.to_string(3).c_str(),id);
+	if (series.spacing <= 0)
+	{
+		return std::lower_bound(series.t.begin(), series.t.end(), time) - series.t.begin();
+	}
 
-	rs[0]	= 0;
-	rs[1]	= 0;
-	rs[2]	= 0;
-	*dts	= 0;
+	int index = ceil(time / series.spacing);
+	if (index < 0)		index = 0;
+	if (index > n)		index = n;
+
+	//correct for any rounding at the sample times
+	while (index > 0 && series.t[index - 1] >= time)	index--;
+	while (index < n && series.t[index]		< time)		index++;
+
+	return index;
+}
+
+int PephSeries::lowerBound(
+	double	time)	const	///< Time relative to the start of the series (s)
+{
+	return seriesLowerBound(*this, time);
+}
+
+int PclkSeries::lowerBound(
+	double	time)	const	///< Time relative to the start of the series (s)
+{
+	return seriesLowerBound(*this, time);
+}
+
+/** Interval between uniformly spaced sample times, or zero if they are not uniform
+*/
+double uniformSpacing(
+	vector<double>&	t)		///< Sample times (s)
+{
+	if (t.size() < 2)
+	{
+		return 0;
+	}
+
+	double spacing = t[1] - t[0];
+	if (spacing <= 0)
+	{
+		return 0;
+	}
+
+	for (int i = 2; i < t.size(); i++)
+	{
+		if (fabs(t[i] - t[i-1] - spacing) > 1E-6)
+		{
+			return 0;
+		}
+	}
+
+	return spacing;
+}
+
+/** Arrange the precise ephemerides and clocks in nav for interpolation.
+* Must be called (outside of any parallel region) after the precise products are modified, until then the products are used directly.
+*/
+void buildPreciseCache(
+	nav_t&	nav)	///< Navigation data to build the cache for
+{
+	auto& cache = nav.preciseCache;
+
+	cache.pephSeriesMap.clear();
+	cache.pclkSeriesMap.clear();
+
+	for (auto& [Sat, pephList] : nav.pephMap)
+	{
+		if (pephList.empty())
+		{
+			continue;
+		}
 
-	PephList pephList = nav.pephMap[Sat];
+		auto& series = cache.pephSeriesMap[Sat];
+
+		series.start		= pephList.begin()	->first;
+		series.stop			= pephList.rbegin()	->first;
+		series.sourceSize	= pephList.size();
+
+		series.t		.reserve(pephList.size());
+		series.pos		.reserve(pephList.size());
+		series.posStd	.reserve(pephList.size());
+		series.clk		.reserve(pephList.size());
+		series.clkStd	.reserve(pephList.size());
+
+		for (auto& [time, peph] : pephList)
+		{
+			series.t		.push_back(timediff(time, series.start));
+			series.pos		.push_back(peph.Pos);
+			series.posStd	.push_back(peph.PosStd);
+			series.clk		.push_back(peph.Clk);
+			series.clkStd	.push_back(peph.ClkStd);
+		}
+
+		series.spacing = uniformSpacing(series.t);
+	}
+
+	for (auto& [id, pclkList] : nav.pclkMap)
+	{
+		if (pclkList.empty())
+		{
+			continue;
+		}
+
+		auto& series = cache.pclkSeriesMap[id];
+
+		series.start		= pclkList.front()	.time;
+		series.stop			= pclkList.back()	.time;
+		series.sourceSize	= pclkList.size();
+
+		series.t	.reserve(pclkList.size());
+		series.clk	.reserve(pclkList.size());
+		series.std	.reserve(pclkList.size());
+
+		for (auto& pclk : pclkList)
+		{
+			series.t	.push_back(timediff(pclk.time, series.start));
+			series.clk	.push_back(pclk.clk);
+			series.std	.push_back(pclk.std);
+		}
+
+		series.spacing = uniformSpacing(series.t);
+	}
+}
+
+/** Samples of a precise orbit used to interpolate at a single time
+*/
+struct PephWindow
+{
+	GTime		firstTime;					///< Time of the first sample
+	double		spacing			= 0;		///< Interval between samples if uniformly spaced (s)
+	double		x[NMAX + 1];				///< Sample times relative to the interpolation time (s)
+	Vector3d	pos[NMAX + 1];
+	bool		valid			= true;		///< All samples have positions
+	Vector3d	middlePosStd;				///< Position std of the sample nearest the interpolation time
+	double		clkT	[2];				///< Interpolation time relative to the clock samples either side (s)
+	double		clk		[2];
+	double		clkStd	[2];
+};
+
+/** Normalised barycentric interpolation coefficients and earth rotation terms for a set of sample times.
+* These depend only on the sample times relative to the interpolation time,
+* so uniformly spaced windows are reused for all satellites with samples at the same times
+*/
+struct PephWeights
+{
+	GTime		firstTime;
+	GTime		time;
+	double		spacing		= 0;
+	int			exact		= -1;			///< Index of the sample at the interpolation time, if any
+	double		coef[NMAX + 1];
+	double		sinl[NMAX + 1];
+	double		cosl[NMAX + 1];
+};
+
+/** Calculate the interpolation coefficients for a window
+*/
+void pephWeights(
+	PephWindow&		window,		///< Window of samples to interpolate
+	GTime			time,		///< Interpolation time
+	PephWeights&	weights)	///< Coefficients for the window
+{
+	weights.firstTime	= window.firstTime;
+	weights.time		= time;
+	weights.spacing		= window.spacing;
+	weights.exact		= -1;
+
+	double w[NMAX + 1];
+	if (window.spacing > 0)
+	{
+		//constant factors cancel, leaving alternating binomial coefficients
+		double binomial = 1;
+		for (int i = 0; i <= NMAX; i++)
+		{
+			w[i] = (i % 2 == 0) ? binomial : -binomial;
+			binomial = binomial * (NMAX - i) / (i + 1);
+		}
+	}
+	else
+	{
+		for (int i = 0; i <= NMAX; i++)
+		{
+			w[i] = 1;
+			for (int j = 0; j <= NMAX; j++)
+			{
+				if (j != i)
+					w[i] /= window.x[i] - window.x[j];
+			}
+		}
+	}
+
+	double sum = 0;
+	for (int i = 0; i <= NMAX; i++)
+	{
+		weights.sinl[i] = sin(OMGE * window.x[i]);
+		weights.cosl[i] = cos(OMGE * window.x[i]);
+
+		if (window.x[i] == 0)
+		{
+			weights.exact = i;
+		}
+
+		weights.coef[i]	= w[i] / -window.x[i];
+		sum				+= weights.coef[i];
+	}
+
+	for (int i = 0; i <= NMAX; i++)
+	{
+		weights.coef[i] /= sum;
+	}
+}
+
+/** Find the window of samples to interpolate at a time, from the cache if it is current, or from the precise ephemeris list
+*/
+bool pephWindow(
+	GTime			time,		///< Interpolation time
+	SatSys			Sat,		///< Satellite to get samples for
+	nav_t&			nav,		///< Navigation data
+	PephWindow&		window)		///< Window of samples
+{
+	auto list_it = nav.pephMap.find(Sat);
+	if (list_it == nav.pephMap.end())
+	{
+		return false;
+	}
+
+	const PephList& pephList = list_it->second;
 
 	if	( (pephList.size()							< NMAX + 1)
 		||(timediff(time, pephList.begin()->first)	< -MAXDTE)
 		||(timediff(time, pephList.rbegin()->first)	> +MAXDTE))
 	{
-//         trace(3,"no prec ephem %s sat=%s\n",time.to_string(0).c_str(),id);
-		return 0;
+		return false;
+	}
+
+	auto series_it = nav.preciseCache.pephSeriesMap.find(Sat);
+	if	( series_it != nav.preciseCache.pephSeriesMap.end()
+		&&series_it->second.sourceSize	== pephList.size()
+		&&series_it->second.start		== pephList.begin()	->first
+		&&series_it->second.stop		== pephList.rbegin()->first)
+	{
+		auto& series = series_it->second;
+		int n = series.t.size();
+
+		//same selection as for the list below, the middle sample is followed by up to NMAX/2 samples
+		double	q		= timediff(time, series.start);
+		int		middle	= series.lowerBound(q);
+		if (middle == n)
+		{
+			middle--;
+		}
+
+		int begin = std::min(middle + NMAX / 2, n) - (NMAX + 1);
+		if (begin < 0)
+		{
+			begin = 0;
+		}
+
+		window.firstTime	= series.start + series.t[begin];
+		window.spacing		= series.spacing;
+
+		for (int i = 0; i <= NMAX; i++)
+		{
+			window.x	[i] = series.t	[begin + i] - q;
+			window.pos	[i] = series.pos[begin + i];
+		}
+
+		int middle0 = middle;
+		if (middle0 != 0)
+		{
+			middle0--;
+		}
+
+		window.middlePosStd	= series.posStd[middle];
+		window.clkT		[0]	= q - series.t		[middle0];
+		window.clkT		[1]	= q - series.t		[middle];
+		window.clk		[0]	= series.clk		[middle0];
+		window.clk		[1]	= series.clk		[middle];
+		window.clkStd	[0]	= series.clkStd		[middle0];
+		window.clkStd	[1]	= series.clkStd		[middle];
+
+		return true;
 	}
 
-// 	//search for the ephemeris in the list
+	//search for the ephemeris in the list
 
 	auto peph_it = pephList.lower_bound(time);
 	if (peph_it == pephList.end())
@@ -283,84 +547,151 @@ int pephpos(
 		}
 	}
 
-	auto begin = peph_it;
+	window.firstTime	= peph_it->first;
+	window.spacing		= 0;
 
-	//get interpolation parameters and check all ephemerides have values.
-	peph_it = begin;
 	for (int i = 0; i <= NMAX; i++, peph_it++)
 	{
-		Peph& peph = peph_it->second;
-		if (peph.Pos.norm() <= 0)
+		const Peph& peph = peph_it->second;
+
+		window.x	[i] = timediff(peph.time, time);
+		window.pos	[i] = peph.Pos;
+	}
+
+	window.middlePosStd = middle0->second.PosStd;
+
+	auto middle1 = middle0;
+	if (middle0 != pephList.begin())
+	{
+		middle0--;
+	}
+
+	window.clkT		[0]	= timediff(time, middle0->second.time);
+	window.clkT		[1]	= timediff(time, middle1->second.time);
+	window.clk		[0]	= middle0->second.Clk;
+	window.clk		[1]	= middle1->second.Clk;
+	window.clkStd	[0]	= middle0->second.ClkStd;
+	window.clkStd	[1]	= middle1->second.ClkStd;
+
+	return true;
+}
+
+/* satellite position by precise ephemeris -----------------------------------*/
+int pephpos(
+	GTime time,
+	SatSys Sat,
+	nav_t& nav,
+	double *rs,
+	double *dts,
+	double *vare,
+	double *varc)
+{
+	double t[2],c[2],s[3];
+
+	char id[4];
+	Sat.getId(id);
+//     trace(4,"pephpos : time=%s sat=%s\n",time.to_string(3).c_str(),id);
+
+	rs[0]	= 0;
+	rs[1]	= 0;
+	rs[2]	= 0;
+	*dts	= 0;
+
+	PephWindow window;
+	bool found = pephWindow(time, Sat, nav, window);
+	if (found == false)
+	{
+//         trace(3,"no prec ephem %s sat=%s\n",time.to_string(0).c_str(),id);
+		return 0;
+	}
+
+	//check all ephemerides have values.
+	for (int i = 0; i <= NMAX; i++)
+	{
+		if (window.pos[i].norm() <= 0)
 		{
 //             trace(3,"prec ephem outage %s sat=%s\n",time.to_string(0).c_str(), id);
 			return 0;
 		}
+	}
+
+	//the coefficients are shared by all satellites with uniform samples at the same times
+	thread_local PephWeights lastWeights;
+
+	PephWeights	newWeights;
+	PephWeights* weights_ptr = &lastWeights;
+	if	( window.spacing		== 0
+		||lastWeights.spacing	!= window.spacing
+		||lastWeights.firstTime	!= window.firstTime
+		||lastWeights.time		!= time)
+	{
+		if (window.spacing == 0)
+		{
+			weights_ptr = &newWeights;
+		}
 
-		t[i] = timediff(peph.time, time);
-		auto& pos = peph.Pos;
-#if 0
-		p[0][i]=pos[0];
-		p[1][i]=pos[1];
-#else
-		/* correciton for earh rotation ver.2.4.0 */
-		double sinl = sin(OMGE * t[i]);
-		double cosl = cos(OMGE * t[i]);
-		p[0][i] = cosl * pos[0] - sinl * pos[1];
-		p[1][i] = sinl * pos[0] + cosl * pos[1];
-#endif
-		p[2][i] = pos[2];
+		pephWeights(window, time, *weights_ptr);
 	}
+	auto& weights = *weights_ptr;
 
-	for (int i = 0; i < 3; i++)
+	/* correciton for earh rotation ver.2.4.0 */
+	if (weights.exact >= 0)
+	{
+		auto& pos = window.pos[weights.exact];
+		rs[0] = pos[0];
+		rs[1] = pos[1];
+		rs[2] = pos[2];
+	}
+	else
+	for (int i = 0; i <= NMAX; i++)
 	{
-		rs[i] = interppol(t, p[i], NMAX + 1);
+		auto& pos = window.pos[i];
+		rs[0] += weights.coef[i] * (weights.cosl[i] * pos[0] - weights.sinl[i] * pos[1]);
+		rs[1] += weights.coef[i] * (weights.sinl[i] * pos[0] + weights.cosl[i] * pos[1]);
+		rs[2] += weights.coef[i] * pos[2];
 	}
+
 	double std = 0;
 	if (vare)
 	{
 		for (int i = 0; i < 3; i++)
-			s[i] = middle0->second.PosStd[i];
+			s[i] = window.middlePosStd[i];
 		std = norm(s, 3);
 
 		/* extrapolation error for orbit */
-		if      (t[0   ] > 0) std += EXTERR_EPH * SQR(t[0   ]) / 2;		//todo aaron, needs straigtening as below?
-		else if (t[NMAX] < 0) std += EXTERR_EPH * SQR(t[NMAX]) / 2;
+		if      (window.x[0   ] > 0) std += EXTERR_EPH * SQR(window.x[0   ]) / 2;		//todo aaron, needs straigtening as below?
+		else if (window.x[NMAX] < 0) std += EXTERR_EPH * SQR(window.x[NMAX]) / 2;
 
 		*vare = SQR(std);
 	}
 
 	/* linear interpolation for clock */
-	auto middle1 = middle0;
-	if (middle0 != pephList.begin())
-	{
-		middle0--;
-	}
-	t[0] = timediff(time, middle0->second.time);
-	t[1] = timediff(time, middle1->second.time);
-	c[0] = middle0->second.Clk;
-	c[1] = middle1->second.Clk;
+	t[0] = window.clkT[0];
+	t[1] = window.clkT[1];
+	c[0] = window.clk[0];
+	c[1] = window.clk[1];
 
 	if 		(t[0] <= 0)
 	{
 		*dts = c[0];
 
 		if (*dts != 0)
-			std = middle0->second.ClkStd * CLIGHT	+ EXTERR_CLK * fabs(t[0]);
+			std = window.clkStd[0] * CLIGHT	+ EXTERR_CLK * fabs(t[0]);
 	}
 	else if (t[1] >= 0)
 	{
 		*dts = c[1];
 
 		if (*dts != 0)
-			std = middle1->second.ClkStd * CLIGHT	+ EXTERR_CLK * fabs(t[1]);
+			std = window.clkStd[1] * CLIGHT	+ EXTERR_CLK * fabs(t[1]);
 	}
 	else if ( c[0] != 0
 			&&c[1] != 0)
 	{
 		*dts = (c[1] * t[0] - c[0] * t[1]) / (t[0] - t[1]);
 
-		double inv0 = 1 / middle0->second.ClkStd * CLIGHT + EXTERR_CLK * fabs(t[0]);
-		double inv1 = 1 / middle1->second.ClkStd * CLIGHT + EXTERR_CLK * fabs(t[1]);
+		double inv0 = 1 / window.clkStd[0] * CLIGHT + EXTERR_CLK * fabs(t[0]);
+		double inv1 = 1 / window.clkStd[1] * CLIGHT + EXTERR_CLK * fabs(t[1]);
 		std			= 1 / (inv0 + inv1);
 	}
 	else
@@ -379,11 +710,12 @@ int pephclk(GTime time, string id, nav_t& nav, double *dtSat, double *varc)
 // 	<< "pephclk : time=" << time.to_string(3)
 // 	<< " id=" << id;
 
-	PclkList pclkList = nav.pclkMap[id];
+	auto list_it = nav.pclkMap.find(id);
 
-	if	( (pclkList.size()							< 2)
-		||(timediff(time, pclkList.front().	time)	< -MAXDTE)
-		||(timediff(time, pclkList.back().	time)	> +MAXDTE))
+	if	( (list_it == nav.pclkMap.end())
+		||(list_it->second.size()							< 2)
+		||(timediff(time, list_it->second.front().	time)	< -MAXDTE)
+		||(timediff(time, list_it->second.back().	time)	> +MAXDTE))
 	{
 		BOOST_LOG_TRIVIAL(debug)
 		<< "no prec clock " << time.to_string(0)
@@ -392,32 +724,69 @@ int pephclk(GTime time, string id, nav_t& nav, double *dtSat, double *varc)
 		return -1;	//non zero for pass, negative for no result
 	}
 
-	//search for the ephemeris in the list
-	auto pclk_it = pclkList.begin();
-	while (pclk_it->time < time)
+	const PclkList& pclkList = list_it->second;
+
+	double t[2];
+	double c[2];
+	double s[2];
+
+	auto series_it = nav.preciseCache.pclkSeriesMap.find(id);
+	if	( series_it != nav.preciseCache.pclkSeriesMap.end()
+		&&series_it->second.sourceSize	== pclkList.size()
+		&&series_it->second.start		== pclkList.front()	.time
+		&&series_it->second.stop		== pclkList.back()	.time)
 	{
-		pclk_it++;
-		if (pclk_it == pclkList.end())
+		auto& series = series_it->second;
+
+		double	q		= timediff(time, series.start);
+		int		middle1	= series.lowerBound(q);
+		if (middle1 == series.t.size())
 		{
-			pclk_it--;
-			break;
+			middle1--;
+		}
+
+		int middle0 = middle1;
+		if (middle0 != 0)
+		{
+			middle0--;
 		}
+
+		t[0] = q - series.t[middle0];
+		t[1] = q - series.t[middle1];
+		c[0] = series.clk[middle0];
+		c[1] = series.clk[middle1];
+		s[0] = series.std[middle0];
+		s[1] = series.std[middle1];
 	}
-	auto middle1 = pclk_it;
-	auto middle0 = middle1;
-	if (middle0 != pclkList.begin())
+	else
 	{
-		middle0--;
+		//search for the ephemeris in the list
+		auto pclk_it = pclkList.begin();
+		while (pclk_it->time < time)
+		{
+			pclk_it++;
+			if (pclk_it == pclkList.end())
+			{
+				pclk_it--;
+				break;
+			}
+		}
+		auto middle1 = pclk_it;
+		auto middle0 = middle1;
+		if (middle0 != pclkList.begin())
+		{
+			middle0--;
+		}
+
+		t[0] = timediff(time, middle0->time);
+		t[1] = timediff(time, middle1->time);
+		c[0] = middle0->clk;
+		c[1] = middle1->clk;
+		s[0] = middle0->std;
+		s[1] = middle1->std;
 	}
 
 	/* linear interpolation for clock */
-	double t[2];
-	double c[2];
-	t[0] = timediff(time, middle0->time);
-	t[1] = timediff(time, middle1->time);
-	c[0] = middle0->clk;
-	c[1] = middle1->clk;
-
 	double std = 0;
 
 	if		(t[0] <= 0)
@@ -427,7 +796,7 @@ int pephclk(GTime time, string id, nav_t& nav, double *dtSat, double *varc)
 		if (*dtSat == 0)
 			return 0;
 
-		std	= middle0->std * CLIGHT	+ EXTERR_CLK * fabs(t[0]);
+		std	= s[0] * CLIGHT	+ EXTERR_CLK * fabs(t[0]);
 	}
 	else if (t[1] >= 0)
 	{
@@ -436,15 +805,15 @@ int pephclk(GTime time, string id, nav_t& nav, double *dtSat, double *varc)
 		if (*dtSat == 0)
 			return 0;
 
-		std	= middle1->std * CLIGHT	+ EXTERR_CLK * fabs(t[1]);
+		std	= s[1] * CLIGHT	+ EXTERR_CLK * fabs(t[1]);
 	}
 	else if	( c[0] != 0
 			&&c[1] != 0)
 	{
 		*dtSat = (c[1] * t[0] - c[0] * t[1]) / (t[0] - t[1]);
 
-		double inv0 = 1 / middle0->std * CLIGHT + EXTERR_CLK * fabs(t[0]);
-		double inv1 = 1 / middle1->std * CLIGHT + EXTERR_CLK * fabs(t[1]);
+		double inv0 = 1 / s[0] * CLIGHT + EXTERR_CLK * fabs(t[0]);
+		double inv1 = 1 / s[1] * CLIGHT + EXTERR_CLK * fabs(t[1]);
 		std			= 1 / (inv0 + inv1);
 	}
 	else
@@ -602,7 +971,24 @@ int peph2pos(
 	/* satellite antenna offset correction */
 	if (opt)
 	{
-		satantoff(trace, time, obs.rSat, Sat, &nav.satNavMap[Sat], dAnt, pcoMap_ptr);
+		//prefer the object connected before processing, the map is shared by stations processed in parallel so must not be added to here
+		SatNav* satNav_ptr = obs.satNav_ptr;
+		if	( satNav_ptr	== nullptr
+			||(int) obs.Sat	!= (int) Sat)
+		{
+			auto it = nav.satNavMap.find(Sat);
+			if (it != nav.satNavMap.end())	satNav_ptr = &it->second;
+			else							satNav_ptr = nullptr;
+		}
+
+		if (satNav_ptr)
+		{
+			satantoff(trace, time, obs.rSat, Sat, satNav_ptr, dAnt, pcoMap_ptr);
+		}
+		else
+		{
+			tracepde(2, trace, "peph2pos: no navigation data for antenna offset of %s\n", Sat.id().c_str());
+		}
 	}
 
 	obs.satVel = (rst - obs.rSat) / tt;
@@ -27,6 +27,7 @@ int peph2pos(
 	PcoMapType*	pcoMap_ptr);
 
 
+E_Sys	code2sys(char code);
 void 	readsp3(string& file, nav_t *nav, int opt);
 int  	readsap(string& file, GTime time, nav_t *nav);
 // int  	readfcb(string& file, nav_t *nav);
@@ -35,4 +36,6 @@ void	orb2sp3(nav_t& nav);
 
 int		pephclk(GTime time, string id, nav_t& nav, double *dts, double *varc);
 
+void	buildPreciseCache(nav_t& nav);
+
 #endif
@@ -1272,9 +1272,9 @@ int readrnxnav(
 		{
 			switch (type)
 			{
-				case 1 : nav.gephMap[geph.Sat].push_back(geph);	break;
-				case 2 : nav.sephMap[seph.Sat].push_back(seph);	break;
-				default: nav.ephMap [eph.Sat] .push_back(eph);	break;
+				case 1 : nav.gephMap[geph.Sat].add(geph);	break;
+				case 2 : nav.sephMap[seph.Sat].add(seph);	break;
+				default: nav.ephMap [eph.Sat] .add(eph);	break;
 			}
 		}
 	}
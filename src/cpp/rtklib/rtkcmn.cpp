@@ -723,6 +723,15 @@ void updatenav(Obs& obs)
 		return;
 	}
 
+	//create every entry that may be looked up later, the satellite is shared by stations that are processed in parallel
+	for (int ft : {FTYPE_NONE, F1, F2, F3, F4, F5, F6, F7, F8, FTYPE_IF12, FTYPE_IF15, FTYPE_IF25, G1, G2, B1, B2, B3})
+	{
+		obs.satNav_ptr->lamMap.try_emplace(ft, 0);
+	}
+
+	obs.satNav_ptr->cBiasMap.try_emplace(F1, 0);
+	obs.satNav_ptr->cBiasMap.try_emplace(F2, 0);
+
 	if		( (sys == +E_Sys::GLO)
 			&&(obs.satNav_ptr->geph_ptr != nullptr))
 	{
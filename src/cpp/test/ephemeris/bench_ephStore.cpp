@@ -0,0 +1,293 @@
+
+#include "minunit.hpp"
+#include "navigation.hpp"
+#include "constants.h"
+
+#include <iostream>
+#include <chrono>
+#include <list>
+#include <map>
+
+using std::cout;
+using std::endl;
+using std::list;
+using std::map;
+
+/** Ephemeris selection as made by seleph() when ephemerides were held in lists, the first matching ephemeris in the order received wins ties
+*/
+Eph* listSeleph(
+	GTime		time,
+	int			iode,
+	double		tmax,
+	list<Eph>&	ephList)
+{
+	Eph*	chosen		= nullptr;
+	GTime	latestToe	= GTime::noTime();
+
+	for (auto& eph : ephList)
+	{
+		if	( iode >= 0
+			&&iode != eph.iode)
+		{
+			continue;
+		}
+
+		double t = fabs(timediff(eph.toe, time));
+		if (t > tmax)
+		{
+			continue;
+		}
+
+		if (iode >= 0)
+		{
+			return &eph;
+		}
+
+		if (eph.toe > latestToe)
+		{
+			chosen		= &eph;
+			latestToe	= eph.toe;
+		}
+	}
+
+	return chosen;
+}
+
+/** Ephemeris selection as made by selgeph() when ephemerides were held in lists
+*/
+Geph* listSelgeph(
+	GTime		time,
+	double		tmax,
+	list<Geph>&	gephList)
+{
+	Geph*	closest	= nullptr;
+	double	tmin	= tmax + 1;
+
+	for (auto& geph : gephList)
+	{
+		double t = fabs(timediff(geph.toe, time));
+		if (t > tmax)
+		{
+			continue;
+		}
+
+		if (t <= tmin)
+		{
+			closest	= &geph;
+			tmin	= t;
+		}
+	}
+
+	return closest;
+}
+
+double seconds(
+	std::chrono::steady_clock::duration	duration)
+{
+	return std::chrono::duration<double>(duration).count();
+}
+
+/** Stream 7 days of broadcast ephemerides into the stores, selecting them for several stations each 30s epoch.
+* GPS ephemerides arrive every 2 hours, with a second upload that reuses the issue of data, Galileo every 10 minutes as I/NAV and F/NAV duplicates, and GLONASS every 30 minutes.
+* Every selection must match the list based selection. Once the stores hold a full day the time taken by them should level off, while the lists keep growing.
+*/
+MU_TEST(test_ephStore_stream)
+{
+	const int numStations	= 4;
+	const int retention		= 86400;
+
+	map<int, EphStore<Eph>>		ephMap;
+	map<int, EphStore<Geph>>	gephMap;
+	map<int, list<Eph>>			ephLists;
+	map<int, list<Geph>>		gephLists;
+
+	vector<SatSys> gpsSats;
+	vector<SatSys> galSats;
+	vector<SatSys> gloSats;
+	for (int prn = 1; prn <= 32; prn++)		gpsSats.push_back(SatSys(E_Sys::GPS, prn));
+	for (int prn = 1; prn <= 30; prn++)		galSats.push_back(SatSys(E_Sys::GAL, prn));
+	for (int prn = 1; prn <= 24; prn++)		gloSats.push_back(SatSys(E_Sys::GLO, prn));
+
+	GTime start;
+	start.time = 1600000000 - 1600000000 % 7200;
+
+	long int	numAdded		= 0;
+	long int	numSelections	= 0;
+	long int	numMismatches	= 0;
+	double		storeTotal		= 0;
+	double		listTotal		= 0;
+
+	auto addEph = [&](SatSys Sat, GTime toe, int iode, int code)
+	{
+		Eph eph		= {};
+		eph.Sat		= Sat;
+		eph.toe		= toe;
+		eph.iode	= iode;
+		eph.code	= code;
+
+		//the rtcm decoder only adds ephemerides with a new issue of data, navigation files add duplicates from other sources
+		auto& ephStore = ephMap[Sat];
+		if	( code > 0
+			||ephStore.find(iode, toe, 6*60*60) == nullptr)
+		{
+			ephStore.add(eph);
+		}
+
+		ephLists[Sat].push_back(eph);
+		numAdded++;
+	};
+
+	for (int day = 0; day < 7; day++)
+	{
+		double storeDay	= 0;
+		double listDay	= 0;
+
+		for (int sec = day * 86400; sec < (day + 1) * 86400; sec += 30)
+		{
+			GTime time = start + (double) sec;
+
+			if (sec % 7200 == 0)
+			for (auto& Sat : gpsSats)
+			{
+				int iode = (sec / 7200) % 256;
+				addEph(Sat, start + (double) (sec + 3600),			iode, 0);
+				addEph(Sat, start + (double) (sec + 3600 + 600),	iode, 1);
+			}
+
+			if (sec % 600 == 0)
+			for (auto& Sat : galSats)
+			{
+				int iode = (sec / 600) % 1024;
+				addEph(Sat, time, iode, 1);
+				addEph(Sat, time, iode, 2);
+			}
+
+			if (sec % 1800 == 0)
+			for (auto& Sat : gloSats)
+			{
+				Geph geph	= {};
+				geph.Sat	= Sat;
+				geph.toe	= start + (double) (sec + 900);
+				geph.iode	= (sec / 1800) % 96;
+
+				gephMap		[Sat].add(geph);
+				gephLists	[Sat].push_back(geph);
+				numAdded++;
+			}
+
+			int gpsIode = ((sec - 3600) / 7200 + 1) % 256;
+			int galIode = (sec / 600) % 1024;
+
+			vector<Eph*>	storeEphs;
+			vector<Eph*>	listEphs;
+			vector<Geph*>	storeGephs;
+			vector<Geph*>	listGephs;
+
+			auto t0 = std::chrono::steady_clock::now();
+
+			for (int station = 0; station < numStations; station++)
+			{
+				for (auto& Sat : gpsSats)
+				{
+					storeEphs.push_back(ephMap[Sat].latest	(time,				MAXDTOE + 1));
+					storeEphs.push_back(ephMap[Sat].find	(gpsIode,	time,	MAXDTOE + 1));
+				}
+
+				for (auto& Sat : galSats)
+				{
+					storeEphs.push_back(ephMap[Sat].latest	(time,				MAXDTOE_GAL + 1));
+					storeEphs.push_back(ephMap[Sat].find	(galIode,	time,	MAXDTOE_GAL + 1));
+				}
+
+				for (auto& Sat : gloSats)
+				{
+					storeGephs.push_back(gephMap[Sat].closest(time, MAXDTOE_GLO));
+				}
+			}
+
+			auto t1 = std::chrono::steady_clock::now();
+
+			for (int station = 0; station < numStations; station++)
+			{
+				for (auto& Sat : gpsSats)
+				{
+					listEphs.push_back(listSeleph(time, -1,			MAXDTOE + 1,		ephLists[Sat]));
+					listEphs.push_back(listSeleph(time, gpsIode,	MAXDTOE + 1,		ephLists[Sat]));
+				}
+
+				for (auto& Sat : galSats)
+				{
+					listEphs.push_back(listSeleph(time, -1,			MAXDTOE_GAL + 1,	ephLists[Sat]));
+					listEphs.push_back(listSeleph(time, galIode,	MAXDTOE_GAL + 1,	ephLists[Sat]));
+				}
+
+				for (auto& Sat : gloSats)
+				{
+					listGephs.push_back(listSelgeph(time, MAXDTOE_GLO, gephLists[Sat]));
+				}
+			}
+
+			auto t2 = std::chrono::steady_clock::now();
+
+			storeDay	+= seconds(t1 - t0);
+			listDay		+= seconds(t2 - t1);
+
+			for (int i = 0; i < storeEphs.size(); i++)
+			{
+				numSelections++;
+
+				Eph* a = storeEphs	[i];
+				Eph* b = listEphs	[i];
+
+				if	( (a == nullptr) != (b == nullptr)
+					||(a && (a->toe != b->toe || a->iode != b->iode || a->code != b->code)))
+				{
+					numMismatches++;
+				}
+			}
+
+			for (int i = 0; i < storeGephs.size(); i++)
+			{
+				numSelections++;
+
+				Geph* a = storeGephs[i];
+				Geph* b = listGephs	[i];
+
+				if	( (a == nullptr) != (b == nullptr)
+					||(a && (a->toe != b->toe || a->iode != b->iode)))
+				{
+					numMismatches++;
+				}
+			}
+
+			GTime oldest = time + (double) -retention;
+			for (auto& [Sat, ephStore]	: ephMap)		ephStore	.prune(oldest);
+			for (auto& [Sat, gephStore]	: gephMap)		gephStore	.prune(oldest);
+		}
+
+		size_t held = 0;
+		for (auto& [Sat, ephStore]	: ephMap)		held += ephStore	.size();
+		for (auto& [Sat, gephStore]	: gephMap)		held += gephStore	.size();
+
+		printf("\n\tDay %d: stores %8.3fs (%6zu held), lists %8.3fs (%6ld held)", day + 1, storeDay, held, listDay, numAdded);
+
+		storeTotal	+= storeDay;
+		listTotal	+= listDay;
+	}
+
+	printf("\n\t%ld selections, %ld mismatches, stores %.3fs, lists %.3fs\n", numSelections, numMismatches, storeTotal, listTotal);
+
+	mu_assert_int_eq(0, numMismatches);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+	MU_RUN_TEST(test_ephStore_stream);
+}
+
+int main(int argc, char* argv[])
+{
+	MU_RUN_SUITE(test_suite);
+	MU_REPORT();
+	return 0;
+}
@@ -0,0 +1,284 @@
+
+#include "minunit.hpp"
+#include "productLoader.hpp"
+#include "navigation.hpp"
+#include "preceph.hpp"
+#include "rinex.hpp"
+
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <memory>
+
+using std::string;
+using std::vector;
+
+const int	numDays			= 7;
+const char*	systems			= "GRECJ";
+const int	numSats[]		= {32, 24, 30, 40, 4};
+const int	numReceivers	= 20;
+
+vector<string>	sp3Files;
+vector<string>	clkFiles;
+
+double seconds(
+	std::chrono::steady_clock::duration	duration)
+{
+	return std::chrono::duration<double>(duration).count();
+}
+
+/** Write a week of daily sp3 and rinex clock files, similar in size to final products.
+* Each sp3 file includes the first epoch of the following day, so that the files overlap.
+* Some records have no standard deviations, or bad clock values, to exercise those cases of the parsers.
+*/
+void writeProducts(
+	string	directory)		///< Directory to write files to
+{
+	std::mt19937						gen(7);
+	std::uniform_real_distribution<double>	u(-1, 1);
+
+	for (int day = 0; day < numDays; day++)
+	{
+		char name[256];
+		snprintf(name, sizeof(name), "%s/bench%d.sp3", directory.c_str(), day);
+		sp3Files.push_back(name);
+
+		FILE* file = fopen(name, "w");
+		fprintf(file, "#dP2022  1 %2d  0  0  0.00000000     289 ORBIT IGS20 HLM  IGS\n", day + 1);
+		fprintf(file, "## 2191 518400.00000000   300.00000000 59580 0.0000000000000\n");
+		fprintf(file, "%%c M  cc GPS ccc cccc cccc cccc cccc ccccc ccccc ccccc ccccc\n");
+		fprintf(file, "%%f %10.7f %12.9f  0.00000000000  0.000000000000000\n", 1.25, 1.025);
+
+		for (int epoch = 0; epoch <= 288; epoch++)
+		{
+			int sec		= epoch * 300;
+			int dom		= day + 1 + sec / 86400;
+			sec %= 86400;
+
+			fprintf(file, "*  2022  1 %2d %2d %2d %11.8f\n", dom, sec / 3600, (sec / 60) % 60, (double) (sec % 60));
+
+			for (int s = 0; s < 5;				s++)
+			for (int prn = 1; prn <= numSats[s];	prn++)
+			{
+				double clk = 100 * u(gen);
+				if (epoch % 97 == prn)
+					clk = 999999.999999;
+
+				double x = 20000 * u(gen);
+				double y = 20000 * u(gen);
+				double z = 20000 * u(gen);
+
+				if (epoch % 50 == prn)
+				{
+					fprintf(file, "P%c%02d%14.6f%14.6f%14.6f%14.6f\n", systems[s], prn, x, y, z, clk);
+				}
+				else
+				{
+					fprintf(file, "P%c%02d%14.6f%14.6f%14.6f%14.6f %2d %2d %2d %3d\n", systems[s], prn, x, y, z, clk,
+						(int) (10 + 5 * u(gen)),
+						(int) (10 + 5 * u(gen)),
+						(int) (10 + 5 * u(gen)),
+						(int) (100 + 50 * u(gen)));
+				}
+			}
+		}
+		fprintf(file, "EOF\n");
+		fclose(file);
+
+		snprintf(name, sizeof(name), "%s/bench%d.clk", directory.c_str(), day);
+		clkFiles.push_back(name);
+
+		file = fopen(name, "w");
+		fprintf(file, "%9.2f           C                   M                   RINEX VERSION / TYPE\n", 3.0);
+		fprintf(file, "%-60sEND OF HEADER\n", "");
+
+		for (int epoch = 0; epoch < 2880; epoch++)
+		{
+			int sec = epoch * 30;
+
+			for (int s = 0; s < 5;				s++)
+			for (int prn = 1; prn <= numSats[s];	prn++)
+			{
+				fprintf(file, "AS %c%02d  %4d%3d%3d%3d%3d%10.6f%3d  %19.12E %19.12E\n", systems[s], prn,
+					2022, 1, day + 1, sec / 3600, (sec / 60) % 60, (double) (sec % 60), 2, 1e-4 * u(gen), 1e-11 * fabs(u(gen)));
+			}
+
+			for (int rec = 0; rec < numReceivers; rec++)
+			{
+				fprintf(file, "AR S%03d %4d%3d%3d%3d%3d%10.6f%3d  %19.12E %19.12E\n", rec,
+					2022, 1, day + 1, sec / 3600, (sec / 60) % 60, (double) (sec % 60), 2, 1e-6 * u(gen), 1e-11 * fabs(u(gen)));
+			}
+		}
+		fclose(file);
+	}
+}
+
+/** Read the sp3 files in turn with readsp3(), and together with readSp3Files(), the results must be identical
+*/
+MU_TEST(test_sp3_loader)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	auto legacyNav_ptr = std::make_unique<nav_t>();
+	auto& legacyNav = *legacyNav_ptr;
+	for (auto& file : sp3Files)
+	{
+		readsp3(file, &legacyNav, 0);
+	}
+
+	auto t1 = std::chrono::steady_clock::now();
+
+	auto pephMap = readSp3Files(sp3Files);
+
+	auto t2 = std::chrono::steady_clock::now();
+
+	long int numRecords		= 0;
+	long int numMismatches	= 0;
+
+	if (pephMap.size() != legacyNav.pephMap.size())
+	{
+		numMismatches++;
+	}
+
+	for (auto& [Sat, legacyList] : legacyNav.pephMap)
+	{
+		auto& pephList = pephMap[Sat];
+		if (pephList.size() != legacyList.size())
+		{
+			numMismatches++;
+			continue;
+		}
+
+		for (auto it = pephList.begin(), legacyIt = legacyList.begin(); legacyIt != legacyList.end(); it++, legacyIt++)
+		{
+			numRecords++;
+
+			auto& a = it		->second;
+			auto& b = legacyIt	->second;
+
+			if	( it->first	!= legacyIt->first
+				||a.time	!= b.time
+				||a.Pos		!= b.Pos
+				||a.PosStd	!= b.PosStd
+				||a.Clk		!= b.Clk
+				||a.ClkStd	!= b.ClkStd)
+			{
+				numMismatches++;
+			}
+		}
+	}
+
+	double legacyTime	= seconds(t1 - t0);
+	double loaderTime	= seconds(t2 - t1);
+
+	printf("\n\tsp3: %ld records, %ld mismatches, readsp3 %.3fs, readSp3Files %.3fs (x%.1f)", numRecords, numMismatches, legacyTime, loaderTime, legacyTime / loaderTime);
+
+	mu_assert_int_eq(0, numMismatches);
+}
+
+/** Read the clock files in turn with readrnx(), and together with readClkFiles(), the results must be identical
+*/
+MU_TEST(test_clk_loader)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	auto legacyNav_ptr = std::make_unique<nav_t>();
+	auto& legacyNav = *legacyNav_ptr;
+	for (auto& file : clkFiles)
+	{
+		std::ifstream inputStream(file);
+
+		char							type	= ' ';
+		double							ver		= 0;
+		E_Sys							sys		= E_Sys::NONE;
+		int								tsys	= TSYS_GPS;
+		ObsList							obsList;
+		map<E_Sys, vector<CodeType>>	sysCodeTypes;
+
+		while (inputStream)
+		{
+			int stat = readrnx(inputStream, type, obsList, legacyNav, nullptr, ver, sys, tsys, sysCodeTypes);
+			if (stat <= 0)
+			{
+				break;
+			}
+		}
+	}
+
+	auto t1 = std::chrono::steady_clock::now();
+
+	auto nav_ptr = std::make_unique<nav_t>();
+	auto& loadedNav = *nav_ptr;
+	readClkFiles(clkFiles, loadedNav);
+
+	auto t2 = std::chrono::steady_clock::now();
+
+	long int numRecords		= 0;
+	long int numMismatches	= 0;
+
+	if (loadedNav.pclkMap.size() != legacyNav.pclkMap.size())
+	{
+		numMismatches++;
+	}
+
+	for (auto& [id, legacyList] : legacyNav.pclkMap)
+	{
+		auto& pclkList = loadedNav.pclkMap[id];
+		if (pclkList.size() != legacyList.size())
+		{
+			numMismatches++;
+			continue;
+		}
+
+		for (auto it = pclkList.begin(), legacyIt = legacyList.begin(); legacyIt != legacyList.end(); it++, legacyIt++)
+		{
+			numRecords++;
+
+			if	( it->time	!= legacyIt->time
+				||it->clk	!= legacyIt->clk
+				||it->std	!= legacyIt->std)
+			{
+				numMismatches++;
+			}
+		}
+	}
+
+	double legacyTime	= seconds(t1 - t0);
+	double loaderTime	= seconds(t2 - t1);
+
+	printf("\n\tclk: %ld records, %ld mismatches, readrnx %.3fs, readClkFiles %.3fs (x%.1f)", numRecords, numMismatches, legacyTime, loaderTime, legacyTime / loaderTime);
+
+	mu_assert_int_eq(0, numMismatches);
+}
+
+MU_TEST_SUITE(test_suite)
+{
+	MU_RUN_TEST(test_sp3_loader);
+	MU_RUN_TEST(test_clk_loader);
+}
+
+int main(int argc, char* argv[])
+{
+	boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+	string directory = "/tmp";
+	if (argc > 1)
+	{
+		directory = argv[1];
+	}
+
+	writeProducts(directory);
+
+	MU_RUN_SUITE(test_suite);
+	MU_REPORT();
+
+	for (auto& file : sp3Files)		remove(file.c_str());
+	for (auto& file : clkFiles)		remove(file.c_str());
+
+	return 0;
+}